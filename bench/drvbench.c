@@ -0,0 +1,589 @@
+/*
+ * drvbench: globalfifo, globalmem, led_control 的用户空间压测
+ *
+ * 每个线程各自打开设备, 在 -D 秒内循环做同一种操作, 记录每次操作的耗时
+ * (从发起到完成, 包括 EAGAIN 之后的等待), 最后按操作汇总吞吐量和延迟分位数,
+ * 每种操作输出一行, 格式是制表符分隔(带表头)或每行一个 JSON 对象, 方便脚本收集
+ * 和比较. 前 -W 秒是预热, 不计入结果.
+ *
+ *   fifo: -t 个写线程 write(), -r 个读线程 read(), 吞吐量按字节算
+ *   mem:  -t 个线程随机偏移 pwrite(), -r 个线程随机偏移 pread()
+ *   led:  -t 个线程轮流翻转LED (LED_IOC_SET, -x 时用文本命令 "ledX Y", Y 是物理电平),
+ *         -r 个线程 read() 等LED变化通知
+ *
+ * 等待方式 (-m):
+ *   block     阻塞 fd, 结束时用信号把卡在系统调用里的线程打断
+ *   nonblock  O_NONBLOCK, EAGAIN 时立即重试(忙等)
+ *   poll      O_NONBLOCK, EAGAIN 时 poll() 等待
+ *   epoll     O_NONBLOCK, EAGAIN 时 epoll_wait() 等待
+ * globalmem 的读写从不阻塞, 四种方式结果应该一样.
+ *
+ * 本机和 i.MX6ULL 都可以编译, 见 Makefile.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+
+#include "globalmem.h"
+#include "ledstest.h"
+
+#define MAX_THREADS 256
+
+/*
+ * 延迟直方图: 小于16ns的值各占一个桶, 之后每个2的幂区间再均分16个桶,
+ * 相对误差不超过 1/16, 整个 u64 范围 976 个桶.
+ */
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1U << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+    uint64_t buckets[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+};
+
+enum bench_dev { DEV_FIFO, DEV_MEM, DEV_LED };
+enum bench_mode { MODE_BLOCK, MODE_NONBLOCK, MODE_POLL, MODE_EPOLL };
+enum bench_role { ROLE_WRITE, ROLE_READ, NR_ROLES };
+
+static const char *const dev_names[] = { "fifo", "mem", "led" };
+static const char *const dev_paths[] = { "/dev/globalfifo", "/dev/globalmem", "/dev/led_control" };
+static const char *const mode_names[] = { "block", "nonblock", "poll", "epoll" };
+
+struct worker {
+    pthread_t thread;
+    unsigned int id;
+    enum bench_role role;
+    int fd;
+    int epfd;
+    char *buf;
+    uint64_t rand;              // xorshift 状态
+    uint64_t seq;               // led: 已发出的命令数, 决定下一个翻转哪个LED
+    uint64_t ops;
+    uint64_t bytes;
+    uint64_t retries;           // EAGAIN 次数
+    uint64_t errors;
+    int err;                    // 最后一个错误, 结果里只报第一个线程的
+    volatile int done;
+    struct hist lat;
+};
+
+static struct {
+    enum bench_dev dev;
+    enum bench_mode mode;
+    const char *path;
+    unsigned int writers;
+    unsigned int readers;
+    size_t size;
+    unsigned int duration;
+    unsigned int warmup;
+    int json;
+    int header;
+    int text;                   // led: 用文本命令代替 ioctl
+    int pin;
+    uint64_t mem_size;
+    uint32_t nleds;
+} cfg = {
+    .mode = MODE_BLOCK,
+    .writers = 1,
+    .readers = ~0U,
+    .size = 64,
+    .duration = 5,
+    .warmup = 1,
+    .header = 1,
+};
+
+static volatile int stop;
+static volatile int measuring;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t next_rand(struct worker *w)
+{
+    w->rand ^= w->rand << 13;
+    w->rand ^= w->rand >> 7;
+    w->rand ^= w->rand << 17;
+    return w->rand;
+}
+
+static unsigned int hist_index(uint64_t v)
+{
+    unsigned int msb;
+
+    if (v < HIST_SUB)
+        return v;
+    msb = 63 - __builtin_clzll(v);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB + ((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+// 第 i 个桶里最大的值
+static uint64_t hist_upper(unsigned int i)
+{
+    unsigned int msb;
+
+    if (i < HIST_SUB)
+        return i;
+    msb = i / HIST_SUB + HIST_SUB_BITS - 1;
+    return (1ULL << msb) + ((uint64_t)(i % HIST_SUB + 1) << (msb - HIST_SUB_BITS)) - 1;
+}
+
+static void hist_add(struct hist *h, uint64_t v)
+{
+    h->buckets[hist_index(v)]++;
+    if (!h->count || v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+    h->count++;
+}
+
+static void hist_merge(struct hist *dst, const struct hist *src)
+{
+    unsigned int i;
+
+    if (!src->count)
+        return;
+    for (i = 0; i < HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    if (!dst->count || src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+    dst->count += src->count;
+}
+
+// 第 permille 千分位所在桶的上界, 不超过最大值
+static uint64_t hist_percentile(const struct hist *h, unsigned int permille)
+{
+    uint64_t want = (h->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+    unsigned int i;
+
+    if (!h->count)
+        return 0;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= want)
+            return hist_upper(i) < h->max ? hist_upper(i) : h->max;
+    }
+    return h->max;
+}
+
+/* 一次操作, 返回字节数(led 的 ioctl 算0), 出错返回 -errno */
+static ssize_t do_op(struct worker *w)
+{
+    struct led_batch batch;
+    struct led_status st;
+    uint64_t off;
+    ssize_t n;
+    unsigned int led, on;
+    int len;
+
+    switch (cfg.dev) {
+    case DEV_FIFO:
+        if (w->role == ROLE_WRITE)
+            n = write(w->fd, w->buf, cfg.size);
+        else
+            n = read(w->fd, w->buf, cfg.size);
+        break;
+
+    case DEV_MEM:
+        off = next_rand(w) % (cfg.mem_size - cfg.size + 1);
+        if (w->role == ROLE_WRITE)
+            n = pwrite(w->fd, w->buf, cfg.size, off);
+        else
+            n = pread(w->fd, w->buf, cfg.size, off);
+        break;
+
+    default:
+        if (w->role == ROLE_READ) {
+            n = read(w->fd, &st, sizeof(st));
+            break;
+        }
+        // 每个写线程从自己的LED开始轮流翻转, 每轮在亮灭之间交替
+        led = (w->id + w->seq) % cfg.nleds;
+        on = (w->seq / cfg.nleds) & 1;
+        w->seq++;
+        if (cfg.text) {
+            len = snprintf(w->buf, 32, "led%u %u", led + 1, on);
+            n = write(w->fd, w->buf, len);
+        } else {
+            batch.mask = 1ULL << led;
+            batch.value = on ? batch.mask : 0;
+            n = ioctl(w->fd, LED_IOC_SET, &batch);
+        }
+        break;
+    }
+    return n < 0 ? -errno : n;
+}
+
+// EAGAIN 之后等 fd 就绪, 超时也返回, 让循环有机会检查 stop
+static int wait_ready(struct worker *w)
+{
+    struct epoll_event ev;
+    struct pollfd pfd;
+    int ret;
+
+    switch (cfg.mode) {
+    case MODE_POLL:
+        pfd.fd = w->fd;
+        pfd.events = w->role == ROLE_WRITE ? POLLOUT : POLLIN;
+        ret = poll(&pfd, 1, 100);
+        break;
+    case MODE_EPOLL:
+        ret = epoll_wait(w->epfd, &ev, 1, 100);
+        break;
+    default:
+        return 0;
+    }
+    return ret < 0 && errno != EINTR ? -errno : 0;
+}
+
+static void *worker_fn(void *arg)
+{
+    struct worker *w = arg;
+    uint64_t t0, t1;
+    ssize_t n;
+
+    while (!stop) {
+        t0 = now_ns();
+        for (;;) {
+            n = do_op(w);
+            if (n != -EAGAIN || stop)
+                break;
+            if (measuring)
+                w->retries++;
+            n = wait_ready(w);
+            if (n < 0 || stop)
+                break;
+        }
+        t1 = now_ns();
+
+        if (n < 0) {
+            // 结束时的信号打断阻塞调用, 不算错误
+            if (stop || n == -EINTR || n == -EAGAIN)
+                continue;
+            w->errors++;
+            w->err = -n;
+            if (w->errors >= 1000)
+                break;
+            continue;
+        }
+        if (measuring) {
+            hist_add(&w->lat, t1 - t0);
+            w->ops++;
+            w->bytes += n;
+        }
+    }
+    w->done = 1;
+    return NULL;
+}
+
+static void wake_handler(int sig)
+{
+    (void)sig;
+}
+
+static int setup_worker(struct worker *w)
+{
+    struct epoll_event ev;
+    int flags = w->role == ROLE_READ && cfg.dev != DEV_LED ? O_RDONLY : O_RDWR;
+
+    if (cfg.mode != MODE_BLOCK)
+        flags |= O_NONBLOCK;
+    w->fd = open(cfg.path, flags | O_CLOEXEC);
+    if (w->fd < 0) {
+        fprintf(stderr, "open %s: %s\n", cfg.path, strerror(errno));
+        return -1;
+    }
+
+    w->epfd = -1;
+    if (cfg.mode == MODE_EPOLL) {
+        w->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (w->epfd < 0) {
+            perror("epoll_create1");
+            return -1;
+        }
+        memset(&ev, 0, sizeof(ev));
+        ev.events = w->role == ROLE_WRITE ? EPOLLOUT : EPOLLIN;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->fd, &ev) < 0) {
+            perror("epoll_ctl");
+            return -1;
+        }
+    }
+
+    // 'A'..'C' 会让 globalfifo 上报按键, 压测数据避开它们
+    w->buf = malloc(cfg.size > 32 ? cfg.size : 32);
+    if (!w->buf) {
+        perror("malloc");
+        return -1;
+    }
+    memset(w->buf, 'x', cfg.size > 32 ? cfg.size : 32);
+    w->rand = 0x9e3779b97f4a7c15ULL * (w->id + 1);
+    return 0;
+}
+
+static uint64_t read_u64_file(const char *path, uint64_t def)
+{
+    unsigned long long v;
+    FILE *f = fopen(path, "r");
+
+    if (!f)
+        return def;
+    if (fscanf(f, "%llu", &v) != 1)
+        v = def;
+    fclose(f);
+    return v;
+}
+
+static void print_result(enum bench_role role, unsigned int nthreads, struct worker *ws,
+                         unsigned int n, double seconds)
+{
+    static const char *const fifo_ops[] = { "write", "read" };
+    static const char *const mem_ops[] = { "pwrite", "pread" };
+    static const char *const led_ops[] = { "set", "notify" };
+    const char *const *ops = cfg.dev == DEV_FIFO ? fifo_ops :
+                             cfg.dev == DEV_MEM ? mem_ops : led_ops;
+    const char *op = ops[role];
+    uint64_t count = 0, bytes = 0, retries = 0, errors = 0;
+    struct hist *h;
+    int err = 0;
+    unsigned int i;
+
+    h = calloc(1, sizeof(*h));
+    if (!h) {
+        perror("calloc");
+        exit(1);
+    }
+    for (i = 0; i < n; i++) {
+        if (ws[i].role != role)
+            continue;
+        hist_merge(h, &ws[i].lat);
+        count += ws[i].ops;
+        bytes += ws[i].bytes;
+        retries += ws[i].retries;
+        errors += ws[i].errors;
+        if (!err)
+            err = ws[i].err;
+    }
+    if (cfg.dev == DEV_LED && role == ROLE_WRITE && cfg.text)
+        op = "text";
+
+    if (cfg.json) {
+        printf("{\"device\":\"%s\",\"mode\":\"%s\",\"op\":\"%s\",\"threads\":%u,\"size\":%zu,"
+               "\"seconds\":%.3f,\"ops\":%llu,\"ops_per_s\":%.1f,\"bytes_per_s\":%.1f,"
+               "\"retries\":%llu,\"errors\":%llu,\"min_ns\":%llu,\"p50_ns\":%llu,"
+               "\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu",
+               dev_names[cfg.dev], mode_names[cfg.mode], op, nthreads, cfg.size, seconds,
+               (unsigned long long)count, count / seconds, bytes / seconds,
+               (unsigned long long)retries, (unsigned long long)errors,
+               (unsigned long long)h->min, (unsigned long long)hist_percentile(h, 500),
+               (unsigned long long)hist_percentile(h, 990),
+               (unsigned long long)hist_percentile(h, 999), (unsigned long long)h->max);
+        if (err)
+            printf(",\"error\":\"%s\"", strerror(err));
+        printf("}\n");
+    } else {
+        printf("%s\t%s\t%s\t%u\t%zu\t%.3f\t%llu\t%.1f\t%.1f\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n",
+               dev_names[cfg.dev], mode_names[cfg.mode], op, nthreads, cfg.size, seconds,
+               (unsigned long long)count, count / seconds, bytes / seconds,
+               (unsigned long long)retries, (unsigned long long)errors,
+               (unsigned long long)h->min, (unsigned long long)hist_percentile(h, 500),
+               (unsigned long long)hist_percentile(h, 990),
+               (unsigned long long)hist_percentile(h, 999), (unsigned long long)h->max);
+        if (err)
+            fprintf(stderr, "%s: %s\n", op, strerror(err));
+    }
+    free(h);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s -d fifo|mem|led [options]\n"
+            "  -p PATH     device node (default /dev/globalfifo, /dev/globalmem, /dev/led_control)\n"
+            "  -t N        writer threads (default 1)\n"
+            "  -r N        reader threads (default 1 for fifo/mem, 0 for led)\n"
+            "  -s BYTES    bytes per read/write (default 64)\n"
+            "  -m MODE     block, nonblock, poll or epoll (default block)\n"
+            "  -D SECONDS  measured duration (default 5)\n"
+            "  -W SECONDS  warmup, not measured (default 1)\n"
+            "  -S BYTES    globalmem size (default from the module parameter)\n"
+            "  -x          led: write text commands instead of LED_IOC_SET\n"
+            "  -a          pin threads to CPUs round robin\n"
+            "  -j          JSON lines instead of tab separated output\n"
+            "  -H          no header line\n",
+            prog);
+    exit(2);
+}
+
+static int parse_args(int argc, char **argv)
+{
+    unsigned int i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:p:t:r:s:m:D:W:S:xajHh")) != -1) {
+        switch (opt) {
+        case 'd':
+            for (i = 0; i < 3 && strcmp(optarg, dev_names[i]); i++)
+                ;
+            if (i == 3)
+                usage(argv[0]);
+            cfg.dev = i;
+            break;
+        case 'm':
+            for (i = 0; i < 4 && strcmp(optarg, mode_names[i]); i++)
+                ;
+            if (i == 4)
+                usage(argv[0]);
+            cfg.mode = i;
+            break;
+        case 'p': cfg.path = optarg; break;
+        case 't': cfg.writers = strtoul(optarg, NULL, 0); break;
+        case 'r': cfg.readers = strtoul(optarg, NULL, 0); break;
+        case 's': cfg.size = strtoul(optarg, NULL, 0); break;
+        case 'D': cfg.duration = strtoul(optarg, NULL, 0); break;
+        case 'W': cfg.warmup = strtoul(optarg, NULL, 0); break;
+        case 'S': cfg.mem_size = strtoull(optarg, NULL, 0); break;
+        case 'x': cfg.text = 1; break;
+        case 'a': cfg.pin = 1; break;
+        case 'j': cfg.json = 1; break;
+        case 'H': cfg.header = 0; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usage(argv[0]);
+
+    if (!cfg.path)
+        cfg.path = dev_paths[cfg.dev];
+    if (cfg.readers == ~0U)
+        cfg.readers = cfg.dev == DEV_LED ? 0 : 1;
+    if (!cfg.size || !cfg.duration || (!cfg.writers && !cfg.readers) ||
+        cfg.writers + cfg.readers > MAX_THREADS) {
+        fprintf(stderr, "need a size, a duration and 1..%d threads\n", MAX_THREADS);
+        return -1;
+    }
+    // fifo 只有写没有读(或反过来)时很快就满(空)了, 之后测的全是等待
+    if (cfg.dev == DEV_FIFO && (!cfg.writers || !cfg.readers))
+        fprintf(stderr, "warning: fifo with only %s\n", cfg.writers ? "writers" : "readers");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct sigaction sa;
+    struct worker *ws;
+    cpu_set_t cpus;
+    uint64_t start, end;
+    unsigned int i, n;
+    long ncpus;
+    int fd;
+
+    if (parse_args(argc, argv))
+        return 2;
+
+    if (cfg.dev == DEV_MEM) {
+        if (!cfg.mem_size)
+            cfg.mem_size = read_u64_file("/sys/module/globalmem/parameters/globalmem_size", 0x1000);
+        if (cfg.size > cfg.mem_size) {
+            fprintf(stderr, "size %zu is larger than the device (%llu)\n",
+                    cfg.size, (unsigned long long)cfg.mem_size);
+            return 2;
+        }
+    }
+    if (cfg.dev == DEV_LED) {
+        fd = open(cfg.path, O_RDWR | O_CLOEXEC);
+        if (fd < 0 || ioctl(fd, LED_IOC_COUNT, &cfg.nleds) < 0 || !cfg.nleds) {
+            fprintf(stderr, "%s: cannot get the LED count: %s\n", cfg.path, strerror(errno));
+            return 1;
+        }
+        close(fd);
+    }
+
+    // 不带 SA_RESTART, 信号让阻塞的 read/write 返回 EINTR
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = wake_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    n = cfg.writers + cfg.readers;
+    ws = calloc(n, sizeof(*ws));
+    if (!ws) {
+        perror("calloc");
+        return 1;
+    }
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (i = 0; i < n; i++) {
+        ws[i].id = i;
+        ws[i].role = i < cfg.writers ? ROLE_WRITE : ROLE_READ;
+        if (setup_worker(&ws[i]))
+            return 1;
+    }
+    for (i = 0; i < n; i++) {
+        if (pthread_create(&ws[i].thread, NULL, worker_fn, &ws[i])) {
+            fprintf(stderr, "pthread_create failed\n");
+            return 1;
+        }
+        if (cfg.pin && ncpus > 0) {
+            CPU_ZERO(&cpus);
+            CPU_SET(i % ncpus, &cpus);
+            pthread_setaffinity_np(ws[i].thread, sizeof(cpus), &cpus);
+        }
+    }
+
+    sleep(cfg.warmup);
+    start = now_ns();
+    measuring = 1;
+    sleep(cfg.duration);
+    measuring = 0;
+    end = now_ns();
+    stop = 1;
+
+    // 线程可能在检查 stop 之后才进入阻塞调用, 一直发信号直到它退出
+    for (i = 0; i < n; i++) {
+        while (!ws[i].done) {
+            pthread_kill(ws[i].thread, SIGUSR1);
+            usleep(10000);
+        }
+        pthread_join(ws[i].thread, NULL);
+    }
+
+    if (cfg.header && !cfg.json)
+        printf("device\tmode\top\tthreads\tsize\tseconds\tops\tops_per_s\tbytes_per_s\t"
+               "retries\terrors\tmin_ns\tp50_ns\tp99_ns\tp999_ns\tmax_ns\n");
+    if (cfg.writers)
+        print_result(ROLE_WRITE, cfg.writers, ws, n, (end - start) / 1e9);
+    if (cfg.readers)
+        print_result(ROLE_READ, cfg.readers, ws, n, (end - start) / 1e9);
+
+    for (i = 0; i < n; i++) {
+        close(ws[i].fd);
+        if (ws[i].epfd >= 0)
+            close(ws[i].epfd);
+        free(ws[i].buf);
+    }
+    free(ws);
+    return 0;
+}
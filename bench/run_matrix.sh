@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# 按 设备 x 等待方式 x 大小 x 线程数 跑一遍 drvbench, 每个组合一行 JSON 输出到
+# stdout, 前面加上内核版本和时间, 方便追加到一个文件里做回归比较:
+#
+#   ./run_matrix.sh >> results.jsonl
+#   ./run_matrix.sh -d "fifo mem" -s "64 4096" -t "1 4" -D 3
+#
+# 不存在的设备节点直接跳过.
+
+DEVICES="fifo mem led"
+MODES="block nonblock poll epoll"
+SIZES="16 256 4096"
+THREADS="1 2 4"
+DURATION=5
+BENCH=$(dirname "$0")/drvbench
+
+usage() {
+    echo "usage: $0 [-d DEVICES] [-m MODES] [-s SIZES] [-t THREADS] [-D SECONDS]" >&2
+    exit 2
+}
+
+while getopts "d:m:s:t:D:h" opt; do
+    case $opt in
+    d) DEVICES=$OPTARG ;;
+    m) MODES=$OPTARG ;;
+    s) SIZES=$OPTARG ;;
+    t) THREADS=$OPTARG ;;
+    D) DURATION=$OPTARG ;;
+    *) usage ;;
+    esac
+done
+
+[ -x "$BENCH" ] || { echo "$BENCH not built, run make first" >&2; exit 1; }
+
+KERNEL=$(uname -r)
+STAMP=$(date +%s)
+
+node() {
+    case $1 in
+    fifo) echo /dev/globalfifo ;;
+    mem) echo /dev/globalmem ;;
+    led) echo /dev/led_control ;;
+    esac
+}
+
+for dev in $DEVICES; do
+    if [ ! -e "$(node "$dev")" ]; then
+        echo "skipping $dev: $(node "$dev") not found" >&2
+        continue
+    fi
+    # LED 命令没有大小, 只跑一种
+    sizes=$SIZES
+    [ "$dev" = led ] && sizes=32
+    for mode in $MODES; do
+        for size in $sizes; do
+            for t in $THREADS; do
+                # led 加一个读线程测变化通知
+                r=$t
+                [ "$dev" = led ] && r=1
+                "$BENCH" -j -d "$dev" -m "$mode" -s "$size" -t "$t" -r "$r" -D "$DURATION" |
+                    sed "s/^{/{\"kernel\":\"$KERNEL\",\"time\":$STAMP,/"
+            done
+        done
+    done
+done
@@ -0,0 +1,480 @@
+/*
+ * drvcore: 驱动共用的环形缓冲区, 每CPU统计和GPIO批量输出, 说明见 drvcore.h
+ *
+ * 基于GPLv2或更高版本授权
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/device.h>
+#include <linux/uaccess.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/gpio/consumer.h>
+#include <linux/gpio/driver.h>
+#include <linux/version.h>
+
+#include "drvcore.h"
+
+/* ---- 环形缓冲区, 实现在 drvcore_ring.h ---- */
+
+static void devm_drvcore_mpsc_release(void *r)
+{
+    drvcore_mpsc_free(r);
+}
+
+int devm_drvcore_mpsc_init(struct device *dev, struct drvcore_mpsc *r,
+                           unsigned int nslots, size_t elem_size)
+{
+    int ret;
+
+    ret = drvcore_mpsc_init(r, nslots, elem_size);
+    if (ret)
+        return ret;
+    ret = devm_add_action(dev, devm_drvcore_mpsc_release, r);
+    if (ret)
+        drvcore_mpsc_free(r);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(devm_drvcore_mpsc_init);
+
+/* ---- 每CPU计数器 ---- */
+
+struct drvcore_stats_pcpu {
+    struct u64_stats_sync syncp;
+    u64 v[];
+};
+
+struct drvcore_stats {
+    const char * const *names;
+    unsigned int n;
+    struct drvcore_stats_pcpu __percpu *pcpu;
+};
+
+struct drvcore_stats *drvcore_stats_alloc(const char * const *names, unsigned int n)
+{
+    struct drvcore_stats *s;
+    int cpu;
+
+    s = kzalloc(sizeof(*s), GFP_KERNEL);
+    if (!s)
+        return NULL;
+    s->names = names;
+    s->n = n;
+    s->pcpu = __alloc_percpu(sizeof(*s->pcpu) + n * sizeof(u64), __alignof__(u64));
+    if (!s->pcpu) {
+        kfree(s);
+        return NULL;
+    }
+    for_each_possible_cpu(cpu)
+        u64_stats_init(&per_cpu_ptr(s->pcpu, cpu)->syncp);
+    return s;
+}
+EXPORT_SYMBOL_GPL(drvcore_stats_alloc);
+
+void drvcore_stats_free(struct drvcore_stats *s)
+{
+    if (!s)
+        return;
+    free_percpu(s->pcpu);
+    kfree(s);
+}
+EXPORT_SYMBOL_GPL(drvcore_stats_free);
+
+/*
+ * 同一个CPU上进程上下文的更新可能被中断里的更新打断, 32位机器上 u64_stats 的
+ * 序号要求写者互斥, 所以更新时关本地中断. 只是几条指令.
+ */
+void drvcore_stats_add(struct drvcore_stats *s, unsigned int idx, u64 delta)
+{
+    struct drvcore_stats_pcpu *p;
+    unsigned long flags;
+
+    local_irq_save(flags);
+    p = this_cpu_ptr(s->pcpu);
+    u64_stats_update_begin(&p->syncp);
+    p->v[idx] += delta;
+    u64_stats_update_end(&p->syncp);
+    local_irq_restore(flags);
+}
+EXPORT_SYMBOL_GPL(drvcore_stats_add);
+
+void drvcore_stats_add_all(struct drvcore_stats *s, const u64 *delta)
+{
+    struct drvcore_stats_pcpu *p;
+    unsigned long flags;
+    unsigned int i;
+
+    local_irq_save(flags);
+    p = this_cpu_ptr(s->pcpu);
+    u64_stats_update_begin(&p->syncp);
+    for (i = 0; i < s->n; i++)
+        p->v[i] += delta[i];
+    u64_stats_update_end(&p->syncp);
+    local_irq_restore(flags);
+}
+EXPORT_SYMBOL_GPL(drvcore_stats_add_all);
+
+void drvcore_stats_sum(struct drvcore_stats *s, u64 *sum)
+{
+    struct drvcore_stats_pcpu *p;
+    unsigned int start, i;
+    u64 v;
+    int cpu;
+
+    memset(sum, 0, s->n * sizeof(*sum));
+    for_each_possible_cpu(cpu) {
+        p = per_cpu_ptr(s->pcpu, cpu);
+        for (i = 0; i < s->n; i++) {
+            do {
+                start = u64_stats_fetch_begin(&p->syncp);
+                v = p->v[i];
+            } while (u64_stats_fetch_retry(&p->syncp, start));
+            sum[i] += v;
+        }
+    }
+}
+EXPORT_SYMBOL_GPL(drvcore_stats_sum);
+
+static int drvcore_stats_show(struct seq_file *m, void *unused)
+{
+    struct drvcore_stats *s = m->private;
+    unsigned int i;
+    u64 *sum;
+
+    sum = kcalloc(s->n, sizeof(*sum), GFP_KERNEL);
+    if (!sum)
+        return -ENOMEM;
+    drvcore_stats_sum(s, sum);
+    for (i = 0; i < s->n; i++)
+        seq_printf(m, "%s: %llu\n", s->names[i], sum[i]);
+    kfree(sum);
+    return 0;
+}
+
+static int drvcore_stats_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, drvcore_stats_show, inode->i_private);
+}
+
+static const struct file_operations drvcore_stats_fops = {
+    .owner = THIS_MODULE,
+    .open = drvcore_stats_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+void drvcore_stats_debugfs(struct drvcore_stats *s, const char *name, struct dentry *parent)
+{
+    debugfs_create_file(name, S_IRUGO, parent, s, &drvcore_stats_fops);
+}
+EXPORT_SYMBOL_GPL(drvcore_stats_debugfs);
+
+/* ---- 每CPU log2 直方图 ---- */
+
+struct drvcore_hist_pcpu {
+    struct u64_stats_sync syncp;
+    struct drvcore_hist_snap d;
+};
+
+struct drvcore_hist {
+    struct drvcore_hist_pcpu __percpu *pcpu;
+};
+
+struct drvcore_hist *drvcore_hist_alloc(void)
+{
+    struct drvcore_hist *h;
+    int cpu;
+
+    h = kzalloc(sizeof(*h), GFP_KERNEL);
+    if (!h)
+        return NULL;
+    h->pcpu = alloc_percpu(struct drvcore_hist_pcpu);
+    if (!h->pcpu) {
+        kfree(h);
+        return NULL;
+    }
+    for_each_possible_cpu(cpu)
+        u64_stats_init(&per_cpu_ptr(h->pcpu, cpu)->syncp);
+    return h;
+}
+EXPORT_SYMBOL_GPL(drvcore_hist_alloc);
+
+void drvcore_hist_free(struct drvcore_hist *h)
+{
+    if (!h)
+        return;
+    free_percpu(h->pcpu);
+    kfree(h);
+}
+EXPORT_SYMBOL_GPL(drvcore_hist_free);
+
+static void devm_drvcore_hist_release(void *h)
+{
+    drvcore_hist_free(h);
+}
+
+struct drvcore_hist *devm_drvcore_hist_alloc(struct device *dev)
+{
+    struct drvcore_hist *h;
+
+    h = drvcore_hist_alloc();
+    if (h && devm_add_action(dev, devm_drvcore_hist_release, h)) {
+        drvcore_hist_free(h);
+        return NULL;
+    }
+    return h;
+}
+EXPORT_SYMBOL_GPL(devm_drvcore_hist_alloc);
+
+// 关本地中断的原因同 drvcore_stats_add()
+void drvcore_hist_add(struct drvcore_hist *h, u64 val)
+{
+    unsigned int b = min_t(unsigned int, fls64(val), DRVCORE_HIST_BUCKETS - 1);
+    struct drvcore_hist_snap *d;
+    struct drvcore_hist_pcpu *p;
+    unsigned long flags;
+
+    local_irq_save(flags);
+    p = this_cpu_ptr(h->pcpu);
+    d = &p->d;
+    u64_stats_update_begin(&p->syncp);
+    d->buckets[b]++;
+    if (!d->count || val < d->min)
+        d->min = val;
+    if (val > d->max)
+        d->max = val;
+    d->count++;
+    d->sum += val;
+    u64_stats_update_end(&p->syncp);
+    local_irq_restore(flags);
+}
+EXPORT_SYMBOL_GPL(drvcore_hist_add);
+
+void drvcore_hist_snapshot(struct drvcore_hist *h, struct drvcore_hist_snap *snap)
+{
+    struct drvcore_hist_snap d;
+    struct drvcore_hist_pcpu *p;
+    unsigned int start, b;
+    int cpu;
+
+    memset(snap, 0, sizeof(*snap));
+    for_each_possible_cpu(cpu) {
+        p = per_cpu_ptr(h->pcpu, cpu);
+        do {
+            start = u64_stats_fetch_begin(&p->syncp);
+            d = p->d;
+        } while (u64_stats_fetch_retry(&p->syncp, start));
+
+        if (!d.count)
+            continue;
+        for (b = 0; b < DRVCORE_HIST_BUCKETS; b++)
+            snap->buckets[b] += d.buckets[b];
+        if (!snap->count || d.min < snap->min)
+            snap->min = d.min;
+        if (d.max > snap->max)
+            snap->max = d.max;
+        snap->count += d.count;
+        snap->sum += d.sum;
+    }
+}
+EXPORT_SYMBOL_GPL(drvcore_hist_snapshot);
+
+void drvcore_hist_reset(struct drvcore_hist *h)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        memset(&per_cpu_ptr(h->pcpu, cpu)->d, 0, sizeof(struct drvcore_hist_snap));
+}
+EXPORT_SYMBOL_GPL(drvcore_hist_reset);
+
+// 第 permille 千分位所在桶的上界, 不超过最大值
+u64 drvcore_hist_percentile(const struct drvcore_hist_snap *snap, unsigned int permille)
+{
+    u64 want = div_u64(snap->count * permille + 999, 1000);
+    u64 seen = 0;
+    unsigned int b;
+
+    for (b = 0; b < DRVCORE_HIST_BUCKETS - 1; b++) {
+        seen += snap->buckets[b];
+        if (seen >= want)
+            return min(b ? 1ULL << b : 0, snap->max);
+    }
+    return snap->max;
+}
+EXPORT_SYMBOL_GPL(drvcore_hist_percentile);
+
+void drvcore_hist_show(struct seq_file *s, const char *label, const struct drvcore_hist_snap *snap)
+{
+    unsigned int b;
+
+    seq_printf(s, "%s: count=%llu", label, snap->count);
+    if (snap->count)
+        seq_printf(s, " min=%llu avg=%llu max=%llu p50=%llu p90=%llu p99=%llu p999=%llu",
+                   snap->min, div_u64(snap->sum, snap->count), snap->max,
+                   drvcore_hist_percentile(snap, 500), drvcore_hist_percentile(snap, 900),
+                   drvcore_hist_percentile(snap, 990), drvcore_hist_percentile(snap, 999));
+    seq_puts(s, "\n");
+
+    for (b = 0; b < DRVCORE_HIST_BUCKETS; b++) {
+        if (!snap->buckets[b])
+            continue;
+        if (b == DRVCORE_HIST_BUCKETS - 1)
+            seq_printf(s, "    >= %llu: %llu\n", 1ULL << (b - 1), snap->buckets[b]);
+        else
+            seq_printf(s, "    < %llu: %llu\n", 1ULL << b, snap->buckets[b]);
+    }
+}
+EXPORT_SYMBOL_GPL(drvcore_hist_show);
+
+static int drvcore_hist_file_show(struct seq_file *s, void *unused)
+{
+    struct drvcore_hist_snap *snap;
+
+    // 快照有 300 多字节, 不放在栈上
+    snap = kmalloc(sizeof(*snap), GFP_KERNEL);
+    if (!snap)
+        return -ENOMEM;
+    drvcore_hist_snapshot(s->private, snap);
+    drvcore_hist_show(s, file_dentry(s->file)->d_name.name, snap);
+    kfree(snap);
+    return 0;
+}
+
+static int drvcore_hist_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, drvcore_hist_file_show, inode->i_private);
+}
+
+static ssize_t drvcore_hist_write(struct file *file, const char __user *buf,
+                                  size_t count, loff_t *ppos)
+{
+    drvcore_hist_reset(((struct seq_file *)file->private_data)->private);
+    return count;
+}
+
+static const struct file_operations drvcore_hist_fops = {
+    .owner = THIS_MODULE,
+    .open = drvcore_hist_open,
+    .read = seq_read,
+    .write = drvcore_hist_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+void drvcore_hist_debugfs(struct drvcore_hist *h, const char *name, struct dentry *parent)
+{
+    debugfs_create_file(name, S_IRUGO | S_IWUSR, parent, h, &drvcore_hist_fops);
+}
+EXPORT_SYMBOL_GPL(drvcore_hist_debugfs);
+
+/* ---- GPIO 批量输出 ---- */
+
+/* 同一个 bank 的GPIO返回同一个值. 6.7 起 gpio_chip 要通过 gpio_device 间接访问 */
+static const void *gpio_array_bank(struct gpio_desc *desc)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+    return gpiod_to_gpio_device(desc);
+#else
+    return gpiod_to_chip(desc);
+#endif
+}
+
+/*
+ * 按GPIO控制器给输出排序(稳定排序, 同一控制器内保持原来的顺序), 统计bank数.
+ * 数量很少, 插入排序足够.
+ */
+static void gpio_array_group_banks(struct drvcore_gpio_array *a)
+{
+    const void *bank;
+    unsigned int i, j;
+
+    for (i = 0; i < a->n; i++) {
+        bank = gpio_array_bank(a->descs[i]);
+        for (j = i; j > 0 && gpio_array_bank(a->descs[a->order[j - 1]]) > bank; j--)
+            a->order[j] = a->order[j - 1];
+        a->order[j] = i;
+    }
+
+    a->nbanks = 0;
+    for (i = 0; i < a->n; i++)
+        if (!i || gpio_array_bank(a->descs[a->order[i]]) !=
+                  gpio_array_bank(a->descs[a->order[i - 1]]))
+            a->nbanks++;
+}
+
+struct drvcore_gpio_array *devm_drvcore_gpio_array_create(struct device *dev,
+                                                          struct gpio_desc **descs,
+                                                          unsigned int n)
+{
+    struct drvcore_gpio_array *a;
+    unsigned int i;
+
+    if (!n || n > DRVCORE_GPIO_ARRAY_MAX)
+        return ERR_PTR(-EINVAL);
+
+    a = devm_kzalloc(dev, sizeof(*a), GFP_KERNEL);
+    if (!a)
+        return ERR_PTR(-ENOMEM);
+    a->n = n;
+    // 有一个会睡眠整组就按会睡眠处理, 调用者据此决定在哪里输出
+    for (i = 0; i < n; i++)
+        if (gpiod_cansleep(descs[i]))
+            a->can_sleep = true;
+    a->descs = devm_kmemdup(dev, descs, n * sizeof(*descs), GFP_KERNEL);
+    a->order = devm_kcalloc(dev, n, sizeof(*a->order), GFP_KERNEL);
+    a->scratch_descs = devm_kcalloc(dev, n, sizeof(*a->scratch_descs), GFP_KERNEL);
+    a->scratch_values = devm_kcalloc(dev, n, sizeof(*a->scratch_values), GFP_KERNEL);
+    if (!a->descs || !a->order || !a->scratch_descs || !a->scratch_values)
+        return ERR_PTR(-ENOMEM);
+    gpio_array_group_banks(a);
+    return a;
+}
+EXPORT_SYMBOL_GPL(devm_drvcore_gpio_array_create);
+
+void drvcore_gpio_array_set(struct drvcore_gpio_array *a, u64 mask, u64 value)
+{
+    unsigned int i, idx, n = 0;
+
+    for (i = 0; i < a->n; i++) {
+        idx = a->order[i];
+        if (!(mask & (1ULL << idx)))
+            continue;
+        a->scratch_descs[n] = a->descs[idx];
+        a->scratch_values[n] = (value >> idx) & 1;
+        n++;
+    }
+    if (!n)
+        return;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0)
+    {
+        // 4.20 起值改成位图, 并多了 array_info 参数(不用)
+        DECLARE_BITMAP(bits, DRVCORE_GPIO_ARRAY_MAX);
+
+        bitmap_zero(bits, DRVCORE_GPIO_ARRAY_MAX);
+        for (i = 0; i < n; i++)
+            if (a->scratch_values[i])
+                __set_bit(i, bits);
+        if (a->can_sleep)
+            gpiod_set_array_value_cansleep(n, a->scratch_descs, NULL, bits);
+        else
+            gpiod_set_array_value(n, a->scratch_descs, NULL, bits);
+    }
+#else
+    if (a->can_sleep)
+        gpiod_set_array_value_cansleep(n, a->scratch_descs, a->scratch_values);
+    else
+        gpiod_set_array_value(n, a->scratch_descs, a->scratch_values);
+#endif
+}
+EXPORT_SYMBOL_GPL(drvcore_gpio_array_set);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("JIU");
+MODULE_DESCRIPTION("Shared ring buffers, per-cpu stats and GPIO batch helpers");
@@ -0,0 +1,107 @@
+/*
+ * drvcore: globalfifo, globalmem, ledstest, ledkey 共用的基础设施
+ *
+ * - drvcore_spsc: 单生产者单消费者字节环形缓冲区, 两端无锁, 可以在任意上下文使用
+ * - drvcore_mpsc: 多生产者单消费者定长记录环形缓冲区, 生产者可以在硬中断里
+ *   (这两个在 drvcore_ring.h, 用户空间也能编译)
+ * - drvcore_stats: 每CPU的一组命名计数器
+ * - drvcore_hist: 每CPU的 log2 延迟直方图
+ * 计数器和直方图都可以导出到 debugfs.
+ * - drvcore_gpio_array: 按GPIO控制器分组的一组输出, 每个bank一次寄存器写
+ *
+ * 基于GPLv2或更高版本授权
+ */
+
+#ifndef _DRVCORE_H
+#define _DRVCORE_H
+
+#include <linux/types.h>
+
+#include "drvcore_ring.h"
+
+struct device;
+struct dentry;
+struct seq_file;
+struct gpio_desc;
+
+/* drvcore_spsc 和 drvcore_mpsc 在 drvcore_ring.h 里, 是内联函数 */
+int devm_drvcore_mpsc_init(struct device *dev, struct drvcore_mpsc *r,
+                           unsigned int nslots, size_t elem_size);
+
+/*
+ * 每CPU计数器: names 给出计数器个数和 debugfs 里的名字, 调用者保证 names 比计数器
+ * 活得久(一般是静态数组). 更新在任意上下文都可以, 读的时候把各CPU加起来.
+ */
+struct drvcore_stats;
+
+struct drvcore_stats *drvcore_stats_alloc(const char * const *names, unsigned int n);
+void drvcore_stats_free(struct drvcore_stats *s);
+void drvcore_stats_add(struct drvcore_stats *s, unsigned int idx, u64 delta);
+// delta 有 n 项, 一次加到所有计数器上
+void drvcore_stats_add_all(struct drvcore_stats *s, const u64 *delta);
+void drvcore_stats_sum(struct drvcore_stats *s, u64 *sum);
+// 只读文件, 每行 "名字: 值"
+void drvcore_stats_debugfs(struct drvcore_stats *s, const char *name, struct dentry *parent);
+
+/*
+ * log2 直方图: 第 b 个桶统计 [2^(b-1), 2^b) 的样本(桶0是0), 最后一个桶收下所有更大的值.
+ * 百分位按桶的上界估计, 精度是2倍, 看数量级足够.
+ */
+#define DRVCORE_HIST_BUCKETS 32
+
+struct drvcore_hist_snap {
+    u64 buckets[DRVCORE_HIST_BUCKETS];
+    u64 count;
+    u64 sum;
+    u64 min;
+    u64 max;
+};
+
+struct drvcore_hist;
+
+struct drvcore_hist *drvcore_hist_alloc(void);
+void drvcore_hist_free(struct drvcore_hist *h);
+struct drvcore_hist *devm_drvcore_hist_alloc(struct device *dev);
+void drvcore_hist_add(struct drvcore_hist *h, u64 val);
+void drvcore_hist_snapshot(struct drvcore_hist *h, struct drvcore_hist_snap *snap);
+// 和并发的更新之间不同步, 清零瞬间的样本可能丢失或只清掉一半
+void drvcore_hist_reset(struct drvcore_hist *h);
+u64 drvcore_hist_percentile(const struct drvcore_hist_snap *snap, unsigned int permille);
+// 一行 "label: count= min= avg= max= p50= p90= p99= p999=", 然后是非空的桶
+void drvcore_hist_show(struct seq_file *s, const char *label, const struct drvcore_hist_snap *snap);
+// 读显示, 写任意内容清零
+void drvcore_hist_debugfs(struct drvcore_hist *h, const char *name, struct dentry *parent);
+
+/*
+ * 一组GPIO输出, 最多64个, 编号是创建时 descs 的顺序. 内部按GPIO控制器重新排序,
+ * 同一个控制器的GPIO在 gpiod_set_array_value() 的数组里是连续的, 每个控制器只做一次
+ * set_multiple, 即每个bank一次寄存器写. 有会睡眠的控制器(I2C扩展, gpio-sim)时
+ * can_sleep 为真, 只能在可以睡眠的上下文里输出.
+ */
+#define DRVCORE_GPIO_ARRAY_MAX 64
+
+struct drvcore_gpio_array {
+    unsigned int n;
+    unsigned int nbanks;
+    bool can_sleep;
+    struct gpio_desc **descs;   // 创建时的顺序
+    unsigned int *order;        // 按控制器分组后的编号
+    struct gpio_desc **scratch_descs;
+    int *scratch_values;
+};
+
+struct drvcore_gpio_array *devm_drvcore_gpio_array_create(struct device *dev,
+                                                          struct gpio_desc **descs,
+                                                          unsigned int n);
+/*
+ * mask 选中的输出设为 value 的对应位. 暂存数组共用, 调用者串行化.
+ * can_sleep 为假时可以在硬中断里调用, 否则调用者要能睡眠.
+ */
+void drvcore_gpio_array_set(struct drvcore_gpio_array *a, u64 mask, u64 value);
+
+static inline bool drvcore_gpio_array_can_sleep(const struct drvcore_gpio_array *a)
+{
+    return a->can_sleep;
+}
+
+#endif /* _DRVCORE_H */
@@ -0,0 +1,373 @@
+/*
+ * drvcore_compat: 板子上的 4.9 内核和开发机上较新的内核之间的接口差异
+ *
+ * 驱动按 4.9 的写法编写, 只有新旧内核签名或名字不同、无法同时编译的地方经过这里.
+ * 覆盖 drvcore, globalfifo, ledstest, ledkey, globalmem 用到的接口.
+ *
+ * 基于GPLv2或更高版本授权
+ */
+
+#ifndef _DRVCORE_COMPAT_H
+#define _DRVCORE_COMPAT_H
+
+#include <linux/version.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/hrtimer.h>
+#include <linux/seq_file.h>
+#include <linux/proc_fs.h>
+#include <linux/platform_device.h>
+#include <linux/gpio/consumer.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/dma-buf.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+#include <linux/iosys-map.h>
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 15, 0)
+#include <linux/scatterlist.h>
+#include <crypto/acompress.h>
+#else
+#include <linux/crypto.h>
+#endif
+
+/* 6.13 加入 hrtimer_setup(), 随后 hrtimer_init() 被移除 */
+static inline void drvcore_hrtimer_setup(struct hrtimer *timer,
+                                         enum hrtimer_restart (*fn)(struct hrtimer *),
+                                         clockid_t clock, enum hrtimer_mode mode)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+    hrtimer_setup(timer, fn, clock, mode);
+#else
+    hrtimer_init(timer, clock, mode);
+    timer->function = fn;
+#endif
+}
+
+/* 6.4 起 class_create() 不再带 owner 参数 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+#define drvcore_class_create(name) class_create(name)
+#else
+#define drvcore_class_create(name) class_create(THIS_MODULE, name)
+#endif
+
+/* 6.12 删除了 no_llseek, llseek 为空就是不能 seek */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+#define no_llseek NULL
+#endif
+
+/* 6.3 起 vma->vm_flags 是只读的, 要通过 vm_flags_set() 修改 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+static inline void vm_flags_set(struct vm_area_struct *vma, vm_flags_t flags)
+{
+    vma->vm_flags |= flags;
+}
+#endif
+
+/*
+ * 从子节点取GPIO: 4.12 起改名并加了 flags 和 label 参数, 5.5 起换成 devm_fwnode_gpiod_get().
+ * 和 4.9 一样不设方向(GPIOD_ASIS), 由驱动自己设置.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0)
+#define devm_get_gpiod_from_child(dev, con_id, child) \
+    devm_fwnode_gpiod_get(dev, child, con_id, GPIOD_ASIS, con_id)
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 12, 0)
+#define devm_get_gpiod_from_child(dev, con_id, child) \
+    devm_fwnode_get_gpiod_from_child(dev, con_id, child, GPIOD_ASIS, con_id)
+#endif
+
+/* 5.17 把 PDE_DATA() 改成了 pde_data() */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0)
+#define PDE_DATA(inode) pde_data(inode)
+#endif
+
+/* 5.6 起 proc 文件用 struct proc_ops. 定义一个 single_open 风格的只读 proc 文件操作 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+#define DRVCORE_PROC_SINGLE_OPS(name, open_fn)  \
+static const struct proc_ops name = {           \
+    .proc_open = open_fn,                       \
+    .proc_read = seq_read,                      \
+    .proc_lseek = seq_lseek,                    \
+    .proc_release = single_release,             \
+}
+#else
+#define DRVCORE_PROC_SINGLE_OPS(name, open_fn)  \
+static const struct file_operations name = {    \
+    .owner = THIS_MODULE,                       \
+    .open = open_fn,                            \
+    .read = seq_read,                           \
+    .llseek = seq_lseek,                        \
+    .release = single_release,                  \
+}
+#endif
+
+/*
+ * 6.11 起 platform_driver.remove 返回 void. 驱动的 remove 仍按 4.9 返回 int, 在它后面写
+ * DRVCORE_PLATFORM_REMOVE(fn); 然后 .remove = drvcore_remove_fn(fn).
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0)
+#define DRVCORE_PLATFORM_REMOVE(fn)                             \
+static void fn##_void(struct platform_device *pdev)             \
+{                                                               \
+    fn(pdev);                                                   \
+}
+#define drvcore_remove_fn(fn) fn##_void
+#else
+#define DRVCORE_PLATFORM_REMOVE(fn)
+#define drvcore_remove_fn(fn) fn
+#endif
+
+/*
+ * blk-mq. 4.13 起 ->queue_rq 返回 blk_status_t, blk_mq_end_request() 也收 blk_status_t;
+ * 4.9 上两者都是 int, BLK_MQ_RQ_QUEUE_OK 就是 0, 结束请求用负的 errno.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 13, 0)
+typedef int blk_status_t;
+#define BLK_STS_OK BLK_MQ_RQ_QUEUE_OK
+#define errno_to_blk_status(err) (err)
+#endif
+
+/* 4.17 加入 blk_queue_flag_set(), 之后 queue_flag_set_unlocked() 被移除 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 17, 0)
+#define blk_queue_flag_set(flag, q) queue_flag_set_unlocked(flag, q)
+#define blk_queue_flag_clear(flag, q) queue_flag_clear_unlocked(flag, q)
+#endif
+
+/* 6.14 起合并总是打开, 没有这个标志了 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+#define BLK_MQ_F_SHOULD_MERGE 0
+#endif
+
+/*
+ * 给 tag set 分配一个单分区的磁盘和它的队列, 物理块大小为 pbs, 非旋转设备,
+ * 不给熵池贡献. 失败返回 ERR_PTR.
+ *
+ * 4.9 上分开调 blk_mq_init_queue() 和 alloc_disk(); 5.14 起 blk_mq_alloc_disk()
+ * 一起分配; 6.9 起队列参数通过 queue_limits 在分配时给出; 6.11 起非旋转和不贡献熵
+ * 是默认值, 对应的队列标志没有了.
+ */
+static inline struct gendisk *drvcore_blk_mq_alloc_disk(struct blk_mq_tag_set *set,
+                                                        unsigned int pbs, void *queuedata)
+{
+    struct gendisk *disk;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+    struct queue_limits lim = {
+        .physical_block_size = pbs,
+    };
+
+    disk = blk_mq_alloc_disk(set, &lim, queuedata);
+    if (IS_ERR(disk))
+        return disk;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 14, 0)
+    disk = blk_mq_alloc_disk(set, queuedata);
+    if (IS_ERR(disk))
+        return disk;
+    blk_queue_physical_block_size(disk->queue, pbs);
+#else
+    struct request_queue *q;
+
+    q = blk_mq_init_queue(set);
+    if (IS_ERR(q))
+        return ERR_CAST(q);
+    disk = alloc_disk(1);
+    if (!disk) {
+        blk_cleanup_queue(q);
+        return ERR_PTR(-ENOMEM);
+    }
+    q->queuedata = queuedata;
+    disk->queue = q;
+    blk_queue_physical_block_size(q, pbs);
+#endif
+    disk->minors = 1;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0)
+    blk_queue_flag_set(QUEUE_FLAG_NONROT, disk->queue);
+    blk_queue_flag_clear(QUEUE_FLAG_ADD_RANDOM, disk->queue);
+#endif
+    return disk;
+}
+
+/* 5.15 起 add_disk() 会失败, 要检查返回值 */
+static inline int drvcore_add_disk(struct gendisk *disk)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 15, 0)
+    return add_disk(disk);
+#else
+    add_disk(disk);
+    return 0;
+#endif
+}
+
+/*
+ * 释放 drvcore_blk_mq_alloc_disk() 分配的磁盘和队列, 已经 add 的要先 del_gendisk().
+ * 6.0 起 blk_cleanup_queue() 和 blk_cleanup_disk() 都没有了, put_disk() 连队列一起释放.
+ */
+static inline void drvcore_blk_cleanup_disk(struct gendisk *disk)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+    put_disk(disk);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 14, 0)
+    blk_cleanup_disk(disk);
+#else
+    blk_cleanup_queue(disk->queue);
+    put_disk(disk);
+#endif
+}
+
+/*
+ * dma-buf. 5.11 起 vmap/vunmap 通过 struct dma_buf_map 传地址, 5.18 改名为 iosys_map.
+ * 驱动统一写 iosys_map.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0) && \
+    LINUX_VERSION_CODE < KERNEL_VERSION(5, 18, 0)
+#define iosys_map dma_buf_map
+#define iosys_map_set_vaddr dma_buf_map_set_vaddr
+#define IOSYS_MAP_INIT_VADDR DMA_BUF_MAP_INIT_VADDR
+#endif
+
+/* 6.2 起导入方调用这些要持有 dma_resv 锁, 不持锁的版本带 _unlocked 后缀 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+#define dma_buf_map_attachment_unlocked dma_buf_map_attachment
+#define dma_buf_unmap_attachment_unlocked dma_buf_unmap_attachment
+#define dma_buf_vmap_unlocked dma_buf_vmap
+#define dma_buf_vunmap_unlocked dma_buf_vunmap
+#endif
+
+/* 导入方把整个 dma-buf 映射到内核地址空间, 失败或者映射到的是 IO 内存时返回 NULL */
+static inline void *drvcore_dma_buf_vmap(struct dma_buf *dmabuf)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+    struct iosys_map map;
+
+    if (dma_buf_vmap_unlocked(dmabuf, &map))
+        return NULL;
+    if (map.is_iomem) {
+        dma_buf_vunmap_unlocked(dmabuf, &map);
+        return NULL;
+    }
+    return map.vaddr;
+#else
+    return dma_buf_vmap_unlocked(dmabuf);
+#endif
+}
+
+static inline void drvcore_dma_buf_vunmap(struct dma_buf *dmabuf, void *vaddr)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+    struct iosys_map map = IOSYS_MAP_INIT_VADDR(vaddr);
+
+    dma_buf_vunmap_unlocked(dmabuf, &map);
+#else
+    dma_buf_vunmap_unlocked(dmabuf, vaddr);
+#endif
+}
+
+/* 5.16 起 dma-buf 的符号导出在 DMA_BUF 命名空间里, 6.13 起命名空间写成字符串 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+#define DRVCORE_IMPORT_NS_DMA_BUF() MODULE_IMPORT_NS("DMA_BUF")
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+#define DRVCORE_IMPORT_NS_DMA_BUF() MODULE_IMPORT_NS(DMA_BUF)
+#else
+#define DRVCORE_IMPORT_NS_DMA_BUF()
+#endif
+
+/*
+ * 同步压缩/解压一块线性内存. 4.9 只有 crypto_comp; 4.10 加入 acomp, 新内核删除了
+ * crypto_comp. 4.15 起有 crypto_wait_req(), 从那里开始用 acomp 并等待结果, 同步的
+ * scomp 算法(lzo, lz4)由 acomp 包装. 缓冲区要在线性映射里(kmalloc 或低端内存页),
+ * 同一个 drvcore_comp 不能并发使用.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 15, 0)
+struct drvcore_comp {
+    struct crypto_acomp *tfm;
+    struct acomp_req *req;
+    struct crypto_wait wait;
+};
+
+static inline bool drvcore_comp_has(const char *alg)
+{
+    return crypto_has_acomp(alg, 0, 0);
+}
+
+static inline int drvcore_comp_alloc(struct drvcore_comp *c, const char *alg)
+{
+    c->tfm = crypto_alloc_acomp(alg, 0, 0);
+    if (IS_ERR(c->tfm))
+        return PTR_ERR(c->tfm);
+    c->req = acomp_request_alloc(c->tfm);
+    if (!c->req) {
+        crypto_free_acomp(c->tfm);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+static inline void drvcore_comp_free(struct drvcore_comp *c)
+{
+    acomp_request_free(c->req);
+    crypto_free_acomp(c->tfm);
+}
+
+static inline int drvcore_comp_run(struct drvcore_comp *c, bool compress, const void *src,
+                                   unsigned int slen, void *dst, unsigned int *dlen)
+{
+    struct scatterlist sg_src, sg_dst;
+    int ret;
+
+    sg_init_one(&sg_src, src, slen);
+    sg_init_one(&sg_dst, dst, *dlen);
+    crypto_init_wait(&c->wait);
+    acomp_request_set_params(c->req, &sg_src, &sg_dst, slen, *dlen);
+    acomp_request_set_callback(c->req, CRYPTO_TFM_REQ_MAY_SLEEP, crypto_req_done, &c->wait);
+    ret = crypto_wait_req(compress ? crypto_acomp_compress(c->req) :
+                          crypto_acomp_decompress(c->req), &c->wait);
+    if (!ret)
+        *dlen = c->req->dlen;
+    return ret;
+}
+
+static inline int drvcore_comp_compress(struct drvcore_comp *c, const void *src,
+                                        unsigned int slen, void *dst, unsigned int *dlen)
+{
+    return drvcore_comp_run(c, true, src, slen, dst, dlen);
+}
+
+static inline int drvcore_comp_decompress(struct drvcore_comp *c, const void *src,
+                                          unsigned int slen, void *dst, unsigned int *dlen)
+{
+    return drvcore_comp_run(c, false, src, slen, dst, dlen);
+}
+#else
+struct drvcore_comp {
+    struct crypto_comp *tfm;
+};
+
+static inline bool drvcore_comp_has(const char *alg)
+{
+    return crypto_has_comp(alg, 0, 0);
+}
+
+static inline int drvcore_comp_alloc(struct drvcore_comp *c, const char *alg)
+{
+    c->tfm = crypto_alloc_comp(alg, 0, 0);
+    return PTR_ERR_OR_ZERO(c->tfm);
+}
+
+static inline void drvcore_comp_free(struct drvcore_comp *c)
+{
+    crypto_free_comp(c->tfm);
+}
+
+static inline int drvcore_comp_compress(struct drvcore_comp *c, const void *src,
+                                        unsigned int slen, void *dst, unsigned int *dlen)
+{
+    return crypto_comp_compress(c->tfm, src, slen, dst, dlen);
+}
+
+static inline int drvcore_comp_decompress(struct drvcore_comp *c, const void *src,
+                                          unsigned int slen, void *dst, unsigned int *dlen)
+{
+    return crypto_comp_decompress(c->tfm, src, slen, dst, dlen);
+}
+#endif
+
+#endif /* _DRVCORE_COMPAT_H */
@@ -0,0 +1,260 @@
+/*
+ * drvcore_ring: drvcore 的两种环形缓冲区, 全部是内联函数
+ *
+ * 不依赖内核的其他部分, 在用户空间包含 drvcore_uspace.h 就能编译(C和C++都可以),
+ * 这样环形缓冲区的布局和算法可以在用户空间测试和压测, 见 uspace-test/.
+ *
+ * 基于GPLv2或更高版本授权
+ */
+
+#ifndef _DRVCORE_RING_H
+#define _DRVCORE_RING_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/cache.h>
+#include <linux/atomic.h>
+#include <linux/compiler.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#else
+#include "drvcore_uspace.h"
+#endif
+
+/*
+ * 单生产者单消费者字节环形缓冲区. head 只由生产者写, tail 只由消费者写, 各占一条
+ * cache line, 两端不共享可写的 cache line. 同一端有多个并发调用者时(比如多个写进程),
+ * 由调用者自己串行化这一端.
+ */
+struct drvcore_spsc {
+    unsigned char *buf;
+    unsigned int size;          // 2的幂
+    unsigned int head ____cacheline_aligned_in_smp;
+    unsigned int tail ____cacheline_aligned_in_smp;
+};
+
+static inline int drvcore_spsc_init(struct drvcore_spsc *r, unsigned int size)
+{
+    if (!is_power_of_2(size))
+        return -EINVAL;
+    r->buf = (unsigned char *)kzalloc(size, GFP_KERNEL);
+    if (!r->buf)
+        return -ENOMEM;
+    r->size = size;
+    r->head = 0;
+    r->tail = 0;
+    return 0;
+}
+
+static inline void drvcore_spsc_free(struct drvcore_spsc *r)
+{
+    kfree(r->buf);
+    r->buf = NULL;
+}
+
+// 两端都没有并发访问时才能调用
+static inline void drvcore_spsc_reset(struct drvcore_spsc *r)
+{
+    r->head = 0;
+    r->tail = 0;
+}
+
+static inline unsigned int drvcore_spsc_len(const struct drvcore_spsc *r)
+{
+    return smp_load_acquire(&r->head) - READ_ONCE(r->tail);
+}
+
+static inline unsigned int drvcore_spsc_space(const struct drvcore_spsc *r)
+{
+    return r->size - (READ_ONCE(r->head) - smp_load_acquire(&r->tail));
+}
+
+// 消费者一端: 丢弃现有的所有数据, 返回丢弃的字节数
+static inline unsigned int drvcore_spsc_discard(struct drvcore_spsc *r)
+{
+    unsigned int len = drvcore_spsc_len(r);
+
+    smp_store_release(&r->tail, r->tail + len);
+    return len;
+}
+
+// 返回实际放入的字节数, 可能小于 len
+static inline unsigned int drvcore_spsc_put(struct drvcore_spsc *r, const void *src,
+                                            unsigned int len)
+{
+    unsigned int head = r->head;
+    unsigned int off = head & (r->size - 1);
+    unsigned int first;
+
+    len = min_t(unsigned int, len, drvcore_spsc_space(r));
+    first = min_t(unsigned int, len, r->size - off);
+    memcpy(r->buf + off, src, first);
+    memcpy(r->buf, (const unsigned char *)src + first, len - first);
+    // 数据先于 head 对消费者可见
+    smp_store_release(&r->head, head + len);
+    return len;
+}
+
+// 拷贝开头的数据, 不取走. 只能由消费者一端调用
+static inline unsigned int drvcore_spsc_peek(struct drvcore_spsc *r, void *dst, unsigned int len)
+{
+    unsigned int off = r->tail & (r->size - 1);
+    unsigned int first;
+
+    len = min_t(unsigned int, len, drvcore_spsc_len(r));
+    first = min_t(unsigned int, len, r->size - off);
+    memcpy(dst, r->buf + off, first);
+    memcpy((unsigned char *)dst + first, r->buf, len - first);
+    return len;
+}
+
+// 返回实际取出的字节数, 可能小于 len
+static inline unsigned int drvcore_spsc_get(struct drvcore_spsc *r, void *dst, unsigned int len)
+{
+    len = drvcore_spsc_peek(r, dst, len);
+    // 读完数据才把空间还给生产者
+    smp_store_release(&r->tail, r->tail + len);
+    return len;
+}
+
+// 和用户空间之间直接拷贝, 返回字节数或 -EFAULT(出错时什么也不提交)
+static inline int drvcore_spsc_from_user(struct drvcore_spsc *r, const void __user *src,
+                                         unsigned int len)
+{
+    unsigned int head = r->head;
+    unsigned int off = head & (r->size - 1);
+    unsigned int first;
+
+    len = min_t(unsigned int, len, drvcore_spsc_space(r));
+    first = min_t(unsigned int, len, r->size - off);
+    if (copy_from_user(r->buf + off, src, first) ||
+        copy_from_user(r->buf, (const unsigned char __user *)src + first, len - first))
+        return -EFAULT;
+    smp_store_release(&r->head, head + len);
+    return len;
+}
+
+static inline int drvcore_spsc_to_user(struct drvcore_spsc *r, void __user *dst, unsigned int len)
+{
+    unsigned int tail = r->tail;
+    unsigned int off = tail & (r->size - 1);
+    unsigned int first;
+
+    len = min_t(unsigned int, len, drvcore_spsc_len(r));
+    first = min_t(unsigned int, len, r->size - off);
+    if (copy_to_user(dst, r->buf + off, first) ||
+        copy_to_user((unsigned char __user *)dst + first, r->buf, len - first))
+        return -EFAULT;
+    smp_store_release(&r->tail, tail + len);
+    return len;
+}
+
+/*
+ * 多生产者单消费者定长记录环形缓冲区. 每个槽有一个序号, 生产者用 cmpxchg 抢 head
+ * 上的位置, 写完数据再发布序号, 消费者看到序号才读. 满了丢弃新记录并计数,
+ * 生产者从不等待也不加锁, 可以在硬中断里调用. 消费者由调用者串行化.
+ */
+struct drvcore_mpsc {
+    void *slots;
+    unsigned int nslots;        // 2的幂
+    unsigned int elem_size;
+    unsigned int slot_size;
+    atomic_t overflows;
+    unsigned int head ____cacheline_aligned_in_smp;
+    unsigned int tail ____cacheline_aligned_in_smp;
+};
+
+// 每个槽是序号加数据, 数据按 u64 对齐
+#define DRVCORE_MPSC_DATA_OFFSET ALIGN(sizeof(unsigned int), sizeof(u64))
+
+static inline unsigned int *drvcore_mpsc_seq(struct drvcore_mpsc *r, unsigned int pos)
+{
+    return (unsigned int *)((char *)r->slots + (size_t)(pos & (r->nslots - 1)) * r->slot_size);
+}
+
+static inline void *drvcore_mpsc_data(struct drvcore_mpsc *r, unsigned int pos)
+{
+    return (char *)drvcore_mpsc_seq(r, pos) + DRVCORE_MPSC_DATA_OFFSET;
+}
+
+static inline int drvcore_mpsc_init(struct drvcore_mpsc *r, unsigned int nslots, size_t elem_size)
+{
+    unsigned int i;
+
+    if (!is_power_of_2(nslots) || !elem_size)
+        return -EINVAL;
+    r->elem_size = elem_size;
+    r->slot_size = DRVCORE_MPSC_DATA_OFFSET + ALIGN(elem_size, sizeof(u64));
+    r->slots = kcalloc(nslots, r->slot_size, GFP_KERNEL);
+    if (!r->slots)
+        return -ENOMEM;
+    r->nslots = nslots;
+    r->head = 0;
+    r->tail = 0;
+    atomic_set(&r->overflows, 0);
+    for (i = 0; i < nslots; i++)
+        *drvcore_mpsc_seq(r, i) = i;
+    return 0;
+}
+
+static inline void drvcore_mpsc_free(struct drvcore_mpsc *r)
+{
+    kfree(r->slots);
+    r->slots = NULL;
+}
+
+// 任意上下文(包括硬中断)都可以调用, 满了返回 false
+static inline bool drvcore_mpsc_push(struct drvcore_mpsc *r, const void *elem)
+{
+    unsigned int pos, seq, old;
+
+    pos = READ_ONCE(r->head);
+    for (;;) {
+        seq = smp_load_acquire(drvcore_mpsc_seq(r, pos));
+        if (seq == pos) {
+            old = cmpxchg(&r->head, pos, pos + 1);
+            if (old == pos)
+                break;
+            pos = old;
+        } else if ((int)(seq - pos) < 0) {
+            // 这个槽还没被读走, 缓冲区满
+            atomic_inc(&r->overflows);
+            return false;
+        } else {
+            pos = READ_ONCE(r->head);
+        }
+    }
+    memcpy(drvcore_mpsc_data(r, pos), elem, r->elem_size);
+    smp_store_release(drvcore_mpsc_seq(r, pos), pos + 1);
+    return true;
+}
+
+// 调用者串行化消费者一端
+static inline bool drvcore_mpsc_pop(struct drvcore_mpsc *r, void *elem)
+{
+    unsigned int tail = r->tail;
+
+    if (smp_load_acquire(drvcore_mpsc_seq(r, tail)) != tail + 1)
+        return false;
+    memcpy(elem, drvcore_mpsc_data(r, tail), r->elem_size);
+    smp_store_release(drvcore_mpsc_seq(r, tail), tail + r->nslots);
+    r->tail = tail + 1;
+    return true;
+}
+
+static inline bool drvcore_mpsc_empty(struct drvcore_mpsc *r)
+{
+    unsigned int tail = READ_ONCE(r->tail);
+
+    return smp_load_acquire(drvcore_mpsc_seq(r, tail)) != tail + 1;
+}
+
+static inline unsigned int drvcore_mpsc_overflows(struct drvcore_mpsc *r)
+{
+    return atomic_read(&r->overflows);
+}
+
+#endif /* _DRVCORE_RING_H */
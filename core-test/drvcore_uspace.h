@@ -0,0 +1,188 @@
+/*
+ * drvcore_uspace: 在用户空间编译驱动核心头文件用的替身
+ *
+ * drvcore_ring.h, globalfifo_core.h, globalmem_bounds.h, ledstest_cmd.h 在内核外编译时
+ * 包含这里, 把它们用到的内核接口换成 libc/pthread/GCC 原子操作:
+ * - 类型, min_t, ALIGN, is_power_of_2, 错误码
+ * - READ_ONCE/WRITE_ONCE, smp_load_acquire/smp_store_release, cmpxchg, atomic_t
+ * - kzalloc/kcalloc/kfree
+ * - copy_to_user/copy_from_user: memcpy, 用户指针为 NULL 时模拟一次 fault
+ * - mutex 和等待队列: pthread mutex 和条件变量, 等待不会被信号打断
+ * 只覆盖这几个头文件用到的部分, 也可以在C++里包含.
+ *
+ * 基于GPLv2或更高版本授权
+ */
+
+#ifndef _DRVCORE_USPACE_H
+#define _DRVCORE_USPACE_H
+
+#ifdef __KERNEL__
+#error "drvcore_uspace.h is for userspace builds only"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int32_t s32;
+typedef int64_t s64;
+
+#define __user
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define ____cacheline_aligned_in_smp __attribute__((aligned(64)))
+
+#ifndef ERESTARTSYS
+#define ERESTARTSYS 512
+#endif
+
+#define min_t(type, a, b) ((type)(a) < (type)(b) ? (type)(a) : (type)(b))
+#define ALIGN(x, a) (((x) + (a) - 1) & ~((__typeof__(x))(a) - 1))
+
+static inline bool is_power_of_2(unsigned long n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+/* ---- 内存序和原子操作 ---- */
+
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#define smp_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define cmpxchg(p, old, new) __sync_val_compare_and_swap(p, old, new)
+
+typedef struct {
+    int counter;
+} atomic_t;
+
+static inline int atomic_read(const atomic_t *v)
+{
+    return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_set(atomic_t *v, int i)
+{
+    __atomic_store_n(&v->counter, i, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_inc(atomic_t *v)
+{
+    __atomic_fetch_add(&v->counter, 1, __ATOMIC_RELAXED);
+}
+
+/* ---- 内存分配 ---- */
+
+#define GFP_KERNEL 0
+
+static inline void *kzalloc(size_t size, int flags)
+{
+    (void)flags;
+    return calloc(1, size);
+}
+
+static inline void *kcalloc(size_t n, size_t size, int flags)
+{
+    (void)flags;
+    return calloc(n, size);
+}
+
+static inline void kfree(const void *p)
+{
+    free((void *)p);
+}
+
+/* ---- 用户空间拷贝: 和内核一样返回没拷贝的字节数 ---- */
+
+static inline unsigned long copy_to_user(void __user *to, const void *from, unsigned long n)
+{
+    if (!n)
+        return 0;
+    if (!to)
+        return n;
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void __user *from, unsigned long n)
+{
+    if (!n)
+        return 0;
+    if (!from)
+        return n;
+    memcpy(to, from, n);
+    return 0;
+}
+
+/* ---- 锁和等待队列 ---- */
+
+struct mutex {
+    pthread_mutex_t lock;
+};
+
+static inline void mutex_init(struct mutex *m)
+{
+    pthread_mutex_init(&m->lock, NULL);
+}
+
+static inline void mutex_destroy(struct mutex *m)
+{
+    pthread_mutex_destroy(&m->lock);
+}
+
+static inline void mutex_lock(struct mutex *m)
+{
+    pthread_mutex_lock(&m->lock);
+}
+
+static inline int mutex_lock_interruptible(struct mutex *m)
+{
+    pthread_mutex_lock(&m->lock);
+    return 0;
+}
+
+static inline void mutex_unlock(struct mutex *m)
+{
+    pthread_mutex_unlock(&m->lock);
+}
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *wq)
+{
+    pthread_mutex_init(&wq->lock, NULL);
+    pthread_cond_init(&wq->cond, NULL);
+}
+
+/* 唤醒者改完条件后再拿 wq->lock, 所以等待者在锁里检查条件不会丢失唤醒 */
+static inline void wake_up_interruptible(wait_queue_head_t *wq)
+{
+    pthread_mutex_lock(&wq->lock);
+    pthread_cond_broadcast(&wq->cond);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+#define wait_event_interruptible(wq, condition)             \
+({                                                          \
+    pthread_mutex_lock(&(wq).lock);                         \
+    while (!(condition))                                    \
+        pthread_cond_wait(&(wq).cond, &(wq).lock);          \
+    pthread_mutex_unlock(&(wq).lock);                       \
+    0;                                                      \
+})
+
+#endif /* _DRVCORE_USPACE_H */
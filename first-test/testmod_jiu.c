@@ -1,19 +1,598 @@
 /*
 * test module
+*
+* Also a microbenchmark for the kernel primitives the other drivers are
+* built on, run on demand through debugfs:
+*
+*   echo all > /sys/kernel/debug/testmod_jiu/run    (or copy, handoff, wakeup, alloc, printk, ktime)
+*   cat /sys/kernel/debug/testmod_jiu/results
+*
+* iterations and alloc_size in the same directory tune the runs. Each
+* result line is "name variant ops ns/op min p50 p99 p999 max", times in
+* ns. ns/op is the wall time of the whole loop divided by the op count,
+* the percentiles come from timing every op individually, so they include
+* the ktime_get_ns() overhead reported by the ktime line.
 */
 
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mempool.h>
+#include <linux/mman.h>
+#include <linux/mm.h>
+#include <linux/sort.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+
+#define BENCH_MAX_RESULTS	32
+#define BENCH_MAX_ITERATIONS	1000000
+#define BENCH_PRINTK_MAX	1000	/* don't flood the log buffer */
+#define BENCH_COPY_MAX		65536
+
+struct bench_result {
+	char name[16];
+	char variant[24];
+	u64 ops;
+	u64 ns_per_op;
+	u64 min, p50, p99, p999, max;
+};
+
+static struct {
+	struct mutex lock;		/* one run at a time, protects results */
+	struct bench_result results[BENCH_MAX_RESULTS];
+	unsigned int nresults;
+	u32 iterations;
+	u32 alloc_size;
+	struct dentry *debugfs;
+} bench = {
+	.iterations = 10000,
+	.alloc_size = 256,
+};
+
+static int bench_cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* samples[] is sorted in place, total_ns is the wall time of the run */
+static void bench_record(const char *name, const char *variant, u64 *samples,
+			 u64 n, u64 total_ns)
+{
+	struct bench_result *r;
+
+	if (!n || bench.nresults >= BENCH_MAX_RESULTS)
+		return;
+	r = &bench.results[bench.nresults++];
+
+	sort(samples, n, sizeof(*samples), bench_cmp_u64, NULL);
+	strscpy(r->name, name, sizeof(r->name));
+	strscpy(r->variant, variant, sizeof(r->variant));
+	r->ops = n;
+	r->ns_per_op = div64_u64(total_ns, n);
+	r->min = samples[0];
+	r->p50 = samples[div64_u64(n * 500, 1000)];
+	r->p99 = samples[div64_u64(n * 990, 1000)];
+	r->p999 = samples[div64_u64(n * 999, 1000)];
+	r->max = samples[n - 1];
+}
+
+/* the floor under every other per-op number */
+static int bench_ktime(u64 *samples, u32 n)
+{
+	u64 start, t, i;
+
+	start = ktime_get_ns();
+	for (i = 0; i < n; i++) {
+		t = ktime_get_ns();
+		samples[i] = ktime_get_ns() - t;
+	}
+	bench_record("ktime", "get_ns", samples, n, ktime_get_ns() - start);
+	return 0;
+}
+
+/*
+ * copy_to_user/copy_from_user against an anonymous mapping in the calling
+ * process, the way read()/write() of globalfifo and globalmem see it
+ */
+static int bench_copy(u64 *samples, u32 n)
+{
+	static const unsigned int sizes[] = { 64, 256, 1024, 4096, 16384, 65536 };
+	char variant[24];
+	unsigned long uaddr;
+	char __user *ubuf;
+	u64 start, t, i;
+	unsigned int s;
+	void *kbuf;
+	int ret = 0;
+
+	kbuf = kzalloc(BENCH_COPY_MAX, GFP_KERNEL);
+	if (!kbuf)
+		return -ENOMEM;
+	uaddr = vm_mmap(NULL, 0, BENCH_COPY_MAX, PROT_READ | PROT_WRITE,
+			MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	if (IS_ERR_VALUE(uaddr)) {
+		kfree(kbuf);
+		return (int)uaddr;
+	}
+	ubuf = (char __user *)uaddr;
+
+	/* fault the pages in so the first sample isn't a page fault */
+	if (copy_to_user(ubuf, kbuf, BENCH_COPY_MAX)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+		start = ktime_get_ns();
+		for (i = 0; i < n; i++) {
+			t = ktime_get_ns();
+			if (copy_to_user(ubuf, kbuf, sizes[s])) {
+				ret = -EFAULT;
+				goto out;
+			}
+			samples[i] = ktime_get_ns() - t;
+		}
+		snprintf(variant, sizeof(variant), "to_user/%u", sizes[s]);
+		bench_record("copy", variant, samples, n, ktime_get_ns() - start);
+
+		start = ktime_get_ns();
+		for (i = 0; i < n; i++) {
+			t = ktime_get_ns();
+			if (copy_from_user(kbuf, ubuf, sizes[s])) {
+				ret = -EFAULT;
+				goto out;
+			}
+			samples[i] = ktime_get_ns() - t;
+		}
+		snprintf(variant, sizeof(variant), "from_user/%u", sizes[s]);
+		bench_record("copy", variant, samples, n, ktime_get_ns() - start);
+	}
+
+out:
+	vm_munmap(uaddr, BENCH_COPY_MAX);
+	kfree(kbuf);
+	return ret;
+}
+
+/*
+ * Handoff: a producer kthread passes timestamps to a consumer kthread
+ * through a one-entry mailbox guarded by a mutex, a spinlock, or nothing
+ * but acquire/release ordering. Each sample is the time from the producer
+ * stamping a value to the consumer taking it.
+ */
+enum handoff_mode {
+	HANDOFF_MUTEX,
+	HANDOFF_SPINLOCK,
+	HANDOFF_LOCKLESS,
+};
+
+static const char * const handoff_names[] = {
+	[HANDOFF_MUTEX] = "mutex",
+	[HANDOFF_SPINLOCK] = "spinlock",
+	[HANDOFF_LOCKLESS] = "lockless",
+};
+
+struct handoff {
+	enum handoff_mode mode;
+	u32 n;
+	u64 *samples;
+	struct mutex mutex;
+	spinlock_t spinlock;
+	u64 stamp;
+	int full;
+	struct completion done;
+};
+
+/* kthreads must stay around until kthread_stop() */
+static void bench_thread_idle(void)
+{
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+static bool handoff_put(struct handoff *h)
+{
+	bool ok = false;
+
+	switch (h->mode) {
+	case HANDOFF_MUTEX:
+		mutex_lock(&h->mutex);
+		if (!h->full) {
+			h->stamp = ktime_get_ns();
+			h->full = 1;
+			ok = true;
+		}
+		mutex_unlock(&h->mutex);
+		break;
+	case HANDOFF_SPINLOCK:
+		spin_lock(&h->spinlock);
+		if (!h->full) {
+			h->stamp = ktime_get_ns();
+			h->full = 1;
+			ok = true;
+		}
+		spin_unlock(&h->spinlock);
+		break;
+	case HANDOFF_LOCKLESS:
+		if (!smp_load_acquire(&h->full)) {
+			h->stamp = ktime_get_ns();
+			smp_store_release(&h->full, 1);
+			ok = true;
+		}
+		break;
+	}
+	return ok;
+}
+
+/* returns the stamp, 0 when the mailbox is empty */
+static u64 handoff_get(struct handoff *h)
+{
+	u64 stamp = 0;
+
+	switch (h->mode) {
+	case HANDOFF_MUTEX:
+		mutex_lock(&h->mutex);
+		if (h->full) {
+			stamp = h->stamp;
+			h->full = 0;
+		}
+		mutex_unlock(&h->mutex);
+		break;
+	case HANDOFF_SPINLOCK:
+		spin_lock(&h->spinlock);
+		if (h->full) {
+			stamp = h->stamp;
+			h->full = 0;
+		}
+		spin_unlock(&h->spinlock);
+		break;
+	case HANDOFF_LOCKLESS:
+		if (smp_load_acquire(&h->full)) {
+			stamp = h->stamp;
+			smp_store_release(&h->full, 0);
+		}
+		break;
+	}
+	return stamp;
+}
+
+/* both sides spin, cond_resched() keeps a uniprocessor from livelocking */
+static int handoff_producer(void *data)
+{
+	struct handoff *h = data;
+	u32 i;
+
+	for (i = 0; i < h->n; i++) {
+		while (!handoff_put(h)) {
+			cpu_relax();
+			cond_resched();
+		}
+	}
+	complete(&h->done);
+	bench_thread_idle();
+	return 0;
+}
+
+static int handoff_consumer(void *data)
+{
+	struct handoff *h = data;
+	u64 stamp;
+	u32 i;
+
+	for (i = 0; i < h->n; i++) {
+		while (!(stamp = handoff_get(h))) {
+			cpu_relax();
+			cond_resched();
+		}
+		h->samples[i] = ktime_get_ns() - stamp;
+	}
+	complete(&h->done);
+	bench_thread_idle();
+	return 0;
+}
+
+static int bench_handoff(u64 *samples, u32 n)
+{
+	struct task_struct *producer, *consumer;
+	struct handoff h;
+	u64 start, total;
+	int mode;
+
+	for (mode = HANDOFF_MUTEX; mode <= HANDOFF_LOCKLESS; mode++) {
+		memset(&h, 0, sizeof(h));
+		h.mode = mode;
+		h.n = n;
+		h.samples = samples;
+		mutex_init(&h.mutex);
+		spin_lock_init(&h.spinlock);
+		init_completion(&h.done);
+
+		consumer = kthread_create(handoff_consumer, &h, "bench_consumer");
+		if (IS_ERR(consumer))
+			return PTR_ERR(consumer);
+		producer = kthread_create(handoff_producer, &h, "bench_producer");
+		if (IS_ERR(producer)) {
+			/* never woken, kthread_stop() makes it exit without running */
+			kthread_stop(consumer);
+			return PTR_ERR(producer);
+		}
+
+		start = ktime_get_ns();
+		wake_up_process(consumer);
+		wake_up_process(producer);
+		wait_for_completion(&h.done);
+		wait_for_completion(&h.done);
+		total = ktime_get_ns() - start;
+
+		kthread_stop(producer);
+		kthread_stop(consumer);
+		bench_record("handoff", handoff_names[mode], samples, n, total);
+	}
+	return 0;
+}
+
+/*
+ * Wait-queue wakeup: the caller stamps and wakes a kthread sleeping in
+ * wait_event(), the sample is stamp to the sleeper running again. This is
+ * the blocking read() path of globalfifo and ledstest.
+ */
+struct wakeup {
+	wait_queue_head_t wq;
+	struct completion ack;
+	u64 *samples;
+	u32 n;
+	u64 stamp;
+	bool pending;
+};
+
+static int wakeup_sleeper(void *data)
+{
+	struct wakeup *w = data;
+	u32 i;
+
+	for (i = 0; i < w->n; i++) {
+		wait_event(w->wq, smp_load_acquire(&w->pending));
+		w->samples[i] = ktime_get_ns() - w->stamp;
+		WRITE_ONCE(w->pending, false);
+		complete(&w->ack);
+	}
+	bench_thread_idle();
+	return 0;
+}
+
+static int bench_wakeup(u64 *samples, u32 n)
+{
+	struct task_struct *sleeper;
+	struct wakeup w;
+	u64 start;
+	u32 i;
+
+	memset(&w, 0, sizeof(w));
+	init_waitqueue_head(&w.wq);
+	init_completion(&w.ack);
+	w.samples = samples;
+	w.n = n;
+
+	sleeper = kthread_run(wakeup_sleeper, &w, "bench_sleeper");
+	if (IS_ERR(sleeper))
+		return PTR_ERR(sleeper);
+
+	start = ktime_get_ns();
+	for (i = 0; i < n; i++) {
+		w.stamp = ktime_get_ns();
+		smp_store_release(&w.pending, true);
+		wake_up(&w.wq);
+		wait_for_completion(&w.ack);
+	}
+	bench_record("wakeup", "wait_event", samples, n, ktime_get_ns() - start);
+
+	kthread_stop(sleeper);
+	return 0;
+}
+
+/* one sample is an allocation plus its free */
+static int bench_alloc(u64 *samples, u32 n)
+{
+	u32 size = clamp_t(u32, bench.alloc_size, 8, BENCH_COPY_MAX);
+	struct kmem_cache *cache;
+	mempool_t *pool;
+	char variant[24];
+	u64 start, t, i;
+	void *p;
+	int ret = 0;
+
+	start = ktime_get_ns();
+	for (i = 0; i < n; i++) {
+		t = ktime_get_ns();
+		p = kmalloc(size, GFP_KERNEL);
+		if (!p)
+			return -ENOMEM;
+		kfree(p);
+		samples[i] = ktime_get_ns() - t;
+	}
+	snprintf(variant, sizeof(variant), "kmalloc/%u", size);
+	bench_record("alloc", variant, samples, n, ktime_get_ns() - start);
+
+	cache = kmem_cache_create("testmod_jiu_bench", size, 0, 0, NULL);
+	if (!cache)
+		return -ENOMEM;
+
+	start = ktime_get_ns();
+	for (i = 0; i < n; i++) {
+		t = ktime_get_ns();
+		p = kmem_cache_alloc(cache, GFP_KERNEL);
+		if (!p) {
+			ret = -ENOMEM;
+			goto out_cache;
+		}
+		kmem_cache_free(cache, p);
+		samples[i] = ktime_get_ns() - t;
+	}
+	snprintf(variant, sizeof(variant), "kmem_cache/%u", size);
+	bench_record("alloc", variant, samples, n, ktime_get_ns() - start);
+
+	pool = mempool_create_slab_pool(16, cache);
+	if (!pool) {
+		ret = -ENOMEM;
+		goto out_cache;
+	}
+
+	start = ktime_get_ns();
+	for (i = 0; i < n; i++) {
+		t = ktime_get_ns();
+		p = mempool_alloc(pool, GFP_KERNEL);
+		mempool_free(p, pool);
+		samples[i] = ktime_get_ns() - t;
+	}
+	snprintf(variant, sizeof(variant), "mempool/%u", size);
+	bench_record("alloc", variant, samples, n, ktime_get_ns() - start);
+
+	mempool_destroy(pool);
+out_cache:
+	kmem_cache_destroy(cache);
+	return ret;
+}
+
+/* KERN_DEBUG keeps the console quiet, the cost of the log buffer remains */
+static int bench_printk(u64 *samples, u32 n)
+{
+	u64 start, t, i;
+
+	n = min_t(u32, n, BENCH_PRINTK_MAX);
+	start = ktime_get_ns();
+	for (i = 0; i < n; i++) {
+		t = ktime_get_ns();
+		printk(KERN_DEBUG "testmod_jiu: printk bench %llu\n", i);
+		samples[i] = ktime_get_ns() - t;
+	}
+	bench_record("printk", "debug", samples, n, ktime_get_ns() - start);
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	int (*run)(u64 *samples, u32 n);
+} benches[] = {
+	{ "ktime", bench_ktime },
+	{ "copy", bench_copy },
+	{ "handoff", bench_handoff },
+	{ "wakeup", bench_wakeup },
+	{ "alloc", bench_alloc },
+	{ "printk", bench_printk },
+};
+
+static ssize_t bench_run_write(struct file *file, const char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	char cmd[16], *name;
+	bool all, found = false;
+	u64 *samples;
+	u32 n;
+	int i, ret = 0;
+
+	if (count >= sizeof(cmd))
+		return -EINVAL;
+	if (copy_from_user(cmd, buf, count))
+		return -EFAULT;
+	cmd[count] = '\0';
+	name = strim(cmd);
+	all = !strcmp(name, "all");
+
+	n = clamp_t(u32, bench.iterations, 1, BENCH_MAX_ITERATIONS);
+	samples = vmalloc(n * sizeof(*samples));
+	if (!samples)
+		return -ENOMEM;
+
+	mutex_lock(&bench.lock);
+	bench.nresults = 0;
+	for (i = 0; i < ARRAY_SIZE(benches); i++) {
+		if (!all && strcmp(name, benches[i].name))
+			continue;
+		found = true;
+		ret = benches[i].run(samples, n);
+		if (ret)
+			break;
+	}
+	mutex_unlock(&bench.lock);
+
+	vfree(samples);
+	if (!found)
+		return -EINVAL;
+	return ret ? ret : count;
+}
+
+static const struct file_operations bench_run_fops = {
+	.owner = THIS_MODULE,
+	.write = bench_run_write,
+	.llseek = noop_llseek,
+};
+
+static int bench_results_show(struct seq_file *s, void *unused)
+{
+	struct bench_result *r;
+	unsigned int i;
+
+	mutex_lock(&bench.lock);
+	seq_puts(s, "name\tvariant\tops\tns/op\tmin\tp50\tp99\tp999\tmax\n");
+	for (i = 0; i < bench.nresults; i++) {
+		r = &bench.results[i];
+		seq_printf(s, "%s\t%s\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n",
+			   r->name, r->variant, r->ops, r->ns_per_op, r->min,
+			   r->p50, r->p99, r->p999, r->max);
+	}
+	mutex_unlock(&bench.lock);
+	return 0;
+}
+
+static int bench_results_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, bench_results_show, NULL);
+}
+
+static const struct file_operations bench_results_fops = {
+	.owner = THIS_MODULE,
+	.open = bench_results_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
 
 static int __init test_jiu_init(void)
 {
+	mutex_init(&bench.lock);
+
+	/* the benchmark needs debugfs, plain loading still works without it */
+	bench.debugfs = debugfs_create_dir("testmod_jiu", NULL);
+	if (!IS_ERR_OR_NULL(bench.debugfs)) {
+		debugfs_create_file("run", S_IWUSR, bench.debugfs, NULL, &bench_run_fops);
+		debugfs_create_file("results", S_IRUGO, bench.debugfs, NULL, &bench_results_fops);
+		debugfs_create_u32("iterations", S_IRUGO | S_IWUSR, bench.debugfs, &bench.iterations);
+		debugfs_create_u32("alloc_size", S_IRUGO | S_IWUSR, bench.debugfs, &bench.alloc_size);
+	}
+
 	printk(KERN_INFO "Test module successfully initialized!\n");
 	return 0;
 }
 
 static void __exit test_jiu_exit(void)
 {
+	debugfs_remove_recursive(bench.debugfs);
 	printk(KERN_INFO "Test module successfully exited!\n");
 }
 
@@ -22,4 +601,3 @@ module_exit(test_jiu_exit);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("JIU");
-
@@ -1,5 +1,5 @@
 /*
- * a simple char device driver : globalmem without mutex
+ * a simple char/block device driver : globalmem with rw_semaphore
  *
  * Copyright (C) 2014 Barry Song (baohua@kernel.org)
  *
@@ -12,42 +12,1379 @@
 #include <linux/cdev.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
+#include <linux/rwsem.h>
+#include <linux/poll.h>
+#include <linux/crc32.h>
+#include <linux/crc32c.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/anon_inodes.h>
+#include <linux/file.h>
+#include <linux/device.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 18, 0)
+#include <linux/genhd.h>
+#endif
+#include <linux/crypto.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sched.h>
+
+#include "globalmem.h"
+#include "drvcore.h"
+#include "drvcore_compat.h"
+#include "globalmem_bounds.h"
+
+#define CREATE_TRACE_POINTS
+#include "globalmem_trace.h"
 
 #define GLOBALMEM_SIZE 0x1000
-#define MEM_CLEAR 0x1
 #define GLOBALMEM_MAJOR 230
 
-static int globalmem_major = GLOBALMEM_MAJOR;
-module_param(globalmem_major, int, S_IRUGO);
+/* granularity of the change tracking reported by GLOBALMEM_IOC_DIRTY */
+#define GLOBALMEM_BLOCK_SHIFT 8
+#define GLOBALMEM_BLOCK_SIZE (1 << GLOBALMEM_BLOCK_SHIFT)
+
+static int globalmem_major = GLOBALMEM_MAJOR;
+module_param(globalmem_major, int, S_IRUGO);
+
+static unsigned long globalmem_size = GLOBALMEM_SIZE;
+module_param(globalmem_size, ulong, S_IRUGO);
+MODULE_PARM_DESC(globalmem_size, "size of the shared memory in bytes, rounded up to pages");
+
+static bool globalmem_blkdev;
+module_param(globalmem_blkdev, bool, S_IRUGO);
+MODULE_PARM_DESC(globalmem_blkdev, "also expose the memory as block device /dev/globalmem0");
+
+#define GLOBALMEM_BLK_QUEUE_DEPTH 128
+
+static int globalmem_blk_major;
+
+static char *globalmem_compress = "";
+module_param(globalmem_compress, charp, S_IRUGO);
+MODULE_PARM_DESC(globalmem_compress, "compress cold pages with this crypto algorithm (lzo, lz4), empty to disable");
+
+static unsigned int globalmem_cold_ms = 10000;
+module_param(globalmem_cold_ms, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(globalmem_cold_ms, "idle time in ms after which a page counts as cold");
+
+/* compressed copies larger than this are not worth keeping */
+#define GLOBALMEM_Z_MAX_LEN (PAGE_SIZE * 3 / 4)
+
+/*
+ * a compressed page: data/len hold the compressed bytes, or data is NULL
+ * and every word of the page equals fill
+ */
+struct globalmem_zslot {
+    void *data;
+    unsigned int len;
+    unsigned long fill;
+};
+
+/*
+ * read()/write()/llseek() counters, kept per device and per open file. The
+ * device copy is a drvcore per-cpu counter set, which takes the struct as an
+ * array of u64 in the order of globalmem_stat_names.
+ */
+struct globalmem_stats {
+    u64 reads;
+    u64 read_bytes;
+    u64 writes;
+    u64 write_bytes;
+    u64 faults;		/* pages decompressed or copied on write on their behalf */
+    u64 seeks;
+};
+
+static const char * const globalmem_stat_names[] = {
+    "Reads", "Read bytes", "Writes", "Write bytes", "Faults", "Seeks",
+};
+
+/*
+ * The memory is an array of individually allocated pages rather than one
+ * buffer, so that snapshots can share pages with the live device and only
+ * pages written after a snapshot need a copy.
+ */
+struct globalmem_dev {
+    struct cdev cdev;
+    struct class *class;
+    struct device *device;
+    struct rw_semaphore sem;		/* data and metadata, readers share it */
+    unsigned long size;
+    unsigned long nr_pages;
+    struct page **pages;		/* NULL while the page is compressed */
+    unsigned long *cow;			/* pages still shared with a snapshot */
+    struct list_head snapshots;		/* oldest first */
+    unsigned int nr_snapshots;
+    unsigned int nr_exports;		/* live dma-bufs, pin the page layout */
+    unsigned long snap_pages;		/* pages only referenced by snapshots */
+    unsigned long cow_copies;
+    u64 gen;				/* bumped by every write-type operation */
+    unsigned long nr_blocks;
+    u64 *block_gen;			/* generation of the last write per block */
+    wait_queue_head_t wait;		/* woken when gen changes */
+    struct fasync_struct *async_queue;
+    struct blk_mq_tag_set tag_set;	/* block personality, globalmem_blkdev=1 */
+    struct gendisk *disk;		/* owns the request queue */
+    struct globalmem_zslot *zslots;	/* cold page compression, NULL if off */
+    unsigned long *accessed;		/* pages touched in the current period */
+    struct mutex zlock;			/* page <-> zslot transitions and zstats */
+    struct drvcore_comp comp;
+    void *zbuf;				/* compression scratch buffer */
+    struct delayed_work zwork;
+    unsigned long zpages;		/* compressed pages, same-filled included */
+    unsigned long zsame;		/* same-filled pages */
+    unsigned long zbytes;		/* bytes held by compressed data */
+    unsigned long zdecomp;		/* decompressions */
+    u64 zdecomp_ns;			/* total decompression time */
+    u64 zdecomp_max_ns;
+    struct drvcore_stats *stats;
+    struct list_head files;		/* open globalmem_files, for debugfs */
+    spinlock_t files_lock;
+    struct dentry *debugfs;
+};
+
+struct globalmem_snap {
+    struct globalmem_dev *dev;
+    struct list_head list;
+    unsigned long size;
+    struct page **pages;		/* one reference held on each */
+    u64 gen;
+};
+
+/* per open file state */
+struct globalmem_file {
+    struct globalmem_dev *dev;
+    u64 seen_gen;	/* generation this fd last collected with GLOBALMEM_IOC_DIRTY */
+    struct list_head list;
+    pid_t pid;		/* opener, the fd may be passed on later */
+    char comm[TASK_COMM_LEN];
+    spinlock_t lock;	/* stats */
+    struct globalmem_stats stats;
+};
+
+struct globalmem_dev *globalmem_devp;
+
+static inline void *globalmem_addr(struct globalmem_dev *dev, u64 offset)
+{
+    return page_address(dev->pages[offset >> PAGE_SHIFT]) + offset_in_page(offset);
+}
+
+/* bytes of [offset, offset + len) that lie in the page containing offset */
+static inline size_t globalmem_chunk(u64 offset, u64 len)
+{
+    return min_t(u64, len, PAGE_SIZE - offset_in_page(offset));
+}
+
+/* the parameter is writable at runtime, keep the scanner from spinning */
+static unsigned long globalmem_cold_delay(void)
+{
+    return msecs_to_jiffies(max_t(unsigned int, globalmem_cold_ms, 100));
+}
+
+/* a page whose words are all equal is stored as that one word */
+static bool globalmem_same_filled(const void *ptr, unsigned long *fill)
+{
+    const unsigned long *word = ptr;
+    unsigned int pos;
+
+    for (pos = 1; pos < PAGE_SIZE / sizeof(*word); pos++)
+        if (word[pos] != word[0])
+            return false;
+    *fill = word[0];
+    return true;
+}
+
+/* called with dev->sem held for writing and dev->zlock */
+static void globalmem_compress_page(struct globalmem_dev *dev, unsigned long i)
+{
+    struct globalmem_zslot *slot = &dev->zslots[i];
+    void *src = page_address(dev->pages[i]);
+    unsigned int dlen = 2 * PAGE_SIZE;
+
+    if (globalmem_same_filled(src, &slot->fill)) {
+        slot->data = NULL;
+        slot->len = 0;
+        dev->zsame++;
+    } else {
+        if (drvcore_comp_compress(&dev->comp, src, PAGE_SIZE, dev->zbuf, &dlen) ||
+            dlen > GLOBALMEM_Z_MAX_LEN)
+            return;
+        slot->data = kmemdup(dev->zbuf, dlen, GFP_KERNEL);
+        if (!slot->data)
+            return;
+        slot->len = dlen;
+        dev->zbytes += dlen;
+    }
+
+    dev->zpages++;
+    put_page(dev->pages[i]);
+    dev->pages[i] = NULL;
+}
+
+/* called with dev->sem held (shared is enough) and dev->zlock */
+static int globalmem_decompress_page(struct globalmem_dev *dev, unsigned long i, gfp_t gfp)
+{
+    struct globalmem_zslot *slot = &dev->zslots[i];
+    unsigned int dlen = PAGE_SIZE;
+    struct page *page;
+    unsigned long *word;
+    unsigned int pos;
+    ktime_t start;
+    u64 ns;
+
+    page = alloc_page(gfp);
+    if (!page)
+        return -ENOMEM;
+
+    start = ktime_get();
+    if (!slot->data) {
+        word = page_address(page);
+        for (pos = 0; pos < PAGE_SIZE / sizeof(*word); pos++)
+            word[pos] = slot->fill;
+        dev->zsame--;
+    } else {
+        if (drvcore_comp_decompress(&dev->comp, slot->data, slot->len,
+                                    page_address(page), &dlen) || dlen != PAGE_SIZE) {
+            __free_page(page);
+            return -EIO;
+        }
+        kfree(slot->data);
+        slot->data = NULL;
+        dev->zbytes -= slot->len;
+    }
+    ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+    dev->zpages--;
+    dev->zdecomp++;
+    dev->zdecomp_ns += ns;
+    if (ns > dev->zdecomp_max_ns)
+        dev->zdecomp_max_ns = ns;
+
+    /* pairs with the acquire in globalmem_fault_in() */
+    smp_store_release(&dev->pages[i], page);
+    return 0;
+}
+
+/*
+ * called with dev->sem held before the pages of [offset, offset + len) are
+ * touched: marks them accessed and brings compressed ones back, counting
+ * them in *faults
+ */
+static int globalmem_fault_in(struct globalmem_dev *dev, u64 offset, u64 len, gfp_t gfp,
+                              unsigned long *faults)
+{
+    unsigned long first, last, i;
+    int ret = 0;
+
+    if (!dev->zslots || !len)
+        return 0;
+
+    first = offset >> PAGE_SHIFT;
+    last = (offset + len - 1) >> PAGE_SHIFT;
+    for (i = first; i <= last; i++) {
+        if (!test_bit(i, dev->accessed))
+            set_bit(i, dev->accessed);
+        if (smp_load_acquire(&dev->pages[i]))
+            continue;
+
+        mutex_lock(&dev->zlock);
+        if (!dev->pages[i]) {
+            ret = globalmem_decompress_page(dev, i, gfp);
+            if (!ret)
+                (*faults)++;
+        }
+        mutex_unlock(&dev->zlock);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+/*
+ * Runs every globalmem_cold_ms. A page whose accessed bit is still clear
+ * has not been touched for a whole period and gets compressed; pages
+ * shared with a snapshot are skipped, compressing them would free nothing,
+ * and nothing is compressed while a dma-buf export maps the pages.
+ */
+static void globalmem_zwork(struct work_struct *work)
+{
+    struct globalmem_dev *dev = container_of(to_delayed_work(work),
+                                             struct globalmem_dev, zwork);
+    unsigned long i;
+
+    for (i = 0; i < dev->nr_pages; i++) {
+        if (test_and_clear_bit(i, dev->accessed))
+            continue;
+
+        down_write(&dev->sem);
+        /* recheck: accessors set the bit before using the page */
+        if (dev->pages[i] && !dev->nr_exports &&
+            !test_bit(i, dev->accessed) && !test_bit(i, dev->cow)) {
+            mutex_lock(&dev->zlock);
+            globalmem_compress_page(dev, i);
+            mutex_unlock(&dev->zlock);
+        }
+        up_write(&dev->sem);
+        cond_resched();
+    }
+
+    schedule_delayed_work(&dev->zwork, globalmem_cold_delay());
+}
+
+/*
+ * called with dev->sem held for writing before [offset, offset + len) is
+ * modified: pages still shared with a snapshot are replaced by a private
+ * copy, the snapshot keeps the original. Copies are counted in *faults.
+ */
+static int globalmem_cow(struct globalmem_dev *dev, u64 offset, u64 len, gfp_t gfp,
+                         unsigned long *faults)
+{
+    unsigned long first, last, i;
+    struct page *page;
+
+    if (!len || !dev->nr_snapshots)
+        return 0;
+
+    first = offset >> PAGE_SHIFT;
+    last = (offset + len - 1) >> PAGE_SHIFT;
+    for (i = first; i <= last; i++) {
+        if (!test_bit(i, dev->cow))
+            continue;
+
+        page = alloc_page(gfp);
+        if (!page)
+            return -ENOMEM;
+        copy_page(page_address(page), page_address(dev->pages[i]));
+
+        put_page(dev->pages[i]);
+        dev->pages[i] = page;
+        __clear_bit(i, dev->cow);
+        dev->snap_pages++;
+        dev->cow_copies++;
+        (*faults)++;
+    }
+    return 0;
+}
+
+/*
+ * make [offset, offset + len) addressable, and private to the device for
+ * writes; *faults is increased by the pages that had to be materialized
+ */
+static int __globalmem_prepare(struct globalmem_dev *dev, u64 offset, u64 len, bool write,
+                               gfp_t gfp, unsigned long *faults)
+{
+    int ret;
+
+    ret = globalmem_fault_in(dev, offset, len, gfp, faults);
+    if (ret || !write)
+        return ret;
+    return globalmem_cow(dev, offset, len, gfp, faults);
+}
+
+static int globalmem_prepare(struct globalmem_dev *dev, u64 offset, u64 len, bool write,
+                             gfp_t gfp)
+{
+    unsigned long faults = 0;
+
+    return __globalmem_prepare(dev, offset, len, write, gfp, &faults);
+}
+
+/* called with dev->sem held for writing after [offset, offset + len) was modified */
+static void globalmem_mark_dirty(struct globalmem_dev *dev, u64 offset, u64 len)
+{
+    unsigned int first, last, i;
+
+    if (!len)
+        return;
+
+    dev->gen++;
+    first = offset >> GLOBALMEM_BLOCK_SHIFT;
+    last = (offset + len - 1) >> GLOBALMEM_BLOCK_SHIFT;
+    for (i = first; i <= last; i++)
+        dev->block_gen[i] = dev->gen;
+}
+
+/* called after dev->sem is dropped so woken readers don't bounce on it */
+static void globalmem_notify(struct globalmem_dev *dev)
+{
+    wake_up_interruptible(&dev->wait);
+    kill_fasync(&dev->async_queue, SIGIO, POLL_IN);
+}
+
+static int globalmem_fasync(int fd, struct file *filp, int mode)
+{
+    struct globalmem_file *gf = filp->private_data;
+
+    return fasync_helper(fd, filp, mode, &gf->dev->async_queue);
+}
+
+static int globalmem_open(struct inode *inode, struct file *filp)
+{
+    struct globalmem_file *gf;
+    struct globalmem_dev *dev = globalmem_devp;
+
+    gf = kzalloc(sizeof(*gf), GFP_KERNEL);
+    if (!gf)
+        return -ENOMEM;
+
+    gf->dev = dev;
+    gf->pid = task_tgid_nr(current);
+    get_task_comm(gf->comm, current);
+    spin_lock_init(&gf->lock);
+    down_read(&dev->sem);
+    gf->seen_gen = dev->gen;
+    up_read(&dev->sem);
+
+    spin_lock(&dev->files_lock);
+    list_add_tail(&gf->list, &dev->files);
+    spin_unlock(&dev->files_lock);
+
+    filp->private_data = gf;
+    return 0;
+}
+
+static int globalmem_release(struct inode *inode, struct file *filp)
+{
+    struct globalmem_file *gf = filp->private_data;
+
+    globalmem_fasync(-1, filp, 0);
+    spin_lock(&gf->dev->files_lock);
+    list_del(&gf->list);
+    spin_unlock(&gf->dev->files_lock);
+    kfree(gf);
+    return 0;
+}
+
+static void globalmem_stats_add(struct globalmem_stats *s, const struct globalmem_stats *d)
+{
+    s->reads += d->reads;
+    s->read_bytes += d->read_bytes;
+    s->writes += d->writes;
+    s->write_bytes += d->write_bytes;
+    s->faults += d->faults;
+    s->seeks += d->seeks;
+}
+
+/* fold one operation into the device's per-cpu counters and the fd's own */
+static void globalmem_account(struct globalmem_file *gf, const struct globalmem_stats *d)
+{
+    BUILD_BUG_ON(sizeof(*d) != ARRAY_SIZE(globalmem_stat_names) * sizeof(u64));
+    drvcore_stats_add_all(gf->dev->stats, (const u64 *)d);
+
+    spin_lock(&gf->lock);
+    globalmem_stats_add(&gf->stats, d);
+    spin_unlock(&gf->lock);
+}
+
+/* reject ranges that leave the device, without overflowing on offset + len */
+static int globalmem_check_range(struct globalmem_dev *dev, u64 offset, u64 len)
+{
+    return globalmem_range_ok(dev->size, offset, len) ? 0 : -EINVAL;
+}
+
+/*
+ * page-wise accessors, all called with dev->sem held (for writing when they
+ * modify) and a range that passed globalmem_check_range(), after
+ * globalmem_prepare() for that range
+ */
+static unsigned long globalmem_copy_to_user(struct globalmem_dev *dev, char __user *buf,
+                                            u64 offset, u64 len)
+{
+    size_t n;
+
+    while (len) {
+        n = globalmem_chunk(offset, len);
+        if (copy_to_user(buf, globalmem_addr(dev, offset), n))
+            return len;
+        buf += n;
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static unsigned long globalmem_copy_from_user(struct globalmem_dev *dev, u64 offset,
+                                              const char __user *buf, u64 len)
+{
+    size_t n;
+
+    while (len) {
+        n = globalmem_chunk(offset, len);
+        if (copy_from_user(globalmem_addr(dev, offset), buf, n))
+            return len;
+        buf += n;
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void globalmem_copy_out(struct globalmem_dev *dev, void *buf, u64 offset, u64 len)
+{
+    size_t n;
+
+    while (len) {
+        n = globalmem_chunk(offset, len);
+        memcpy(buf, globalmem_addr(dev, offset), n);
+        buf += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+static void globalmem_copy_in(struct globalmem_dev *dev, u64 offset, const void *buf, u64 len)
+{
+    size_t n;
+
+    while (len) {
+        n = globalmem_chunk(offset, len);
+        memcpy(globalmem_addr(dev, offset), buf, n);
+        buf += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+static void globalmem_memset(struct globalmem_dev *dev, u64 offset, int value, u64 len)
+{
+    size_t n;
+
+    while (len) {
+        n = globalmem_chunk(offset, len);
+        memset(globalmem_addr(dev, offset), value, n);
+        offset += n;
+        len -= n;
+    }
+}
+
+/*
+ * overlapping ranges are handled like memmove: copy front to back when
+ * moving down and back to front when moving up, each step bounded by the
+ * page boundaries of both source and destination.
+ */
+static void globalmem_memmove(struct globalmem_dev *dev, u64 dst, u64 src, u64 len)
+{
+    size_t n;
+
+    if (dst <= src) {
+        while (len) {
+            n = min(globalmem_chunk(src, len), globalmem_chunk(dst, len));
+            memmove(globalmem_addr(dev, dst), globalmem_addr(dev, src), n);
+            dst += n;
+            src += n;
+            len -= n;
+        }
+        return;
+    }
+
+    dst += len;
+    src += len;
+    while (len) {
+        /* bytes before dst/src that stay within their pages */
+        n = min_t(u64, len, min(offset_in_page(dst - 1), offset_in_page(src - 1)) + 1);
+        dst -= n;
+        src -= n;
+        len -= n;
+        memmove(globalmem_addr(dev, dst), globalmem_addr(dev, src), n);
+    }
+}
+
+static int globalmem_ioc_fill(struct globalmem_dev *dev, void __user *argp)
+{
+    struct globalmem_fill fill;
+    int ret;
+
+    if (copy_from_user(&fill, argp, sizeof(fill)))
+        return -EFAULT;
+    if (globalmem_check_range(dev, fill.offset, fill.len))
+        return -EINVAL;
+
+    down_write(&dev->sem);
+    ret = globalmem_prepare(dev, fill.offset, fill.len, true, GFP_KERNEL);
+    if (ret) {
+        up_write(&dev->sem);
+        return ret;
+    }
+    globalmem_memset(dev, fill.offset, fill.value, fill.len);
+    globalmem_mark_dirty(dev, fill.offset, fill.len);
+    up_write(&dev->sem);
+
+    globalmem_notify(dev);
+    return 0;
+}
+
+static int globalmem_ioc_move(struct globalmem_dev *dev, void __user *argp)
+{
+    struct globalmem_move move;
+    int ret;
+
+    if (copy_from_user(&move, argp, sizeof(move)))
+        return -EFAULT;
+    if (globalmem_check_range(dev, move.src, move.len) ||
+        globalmem_check_range(dev, move.dst, move.len))
+        return -EINVAL;
+
+    down_write(&dev->sem);
+    ret = globalmem_prepare(dev, move.src, move.len, false, GFP_KERNEL);
+    if (!ret)
+        ret = globalmem_prepare(dev, move.dst, move.len, true, GFP_KERNEL);
+    if (ret) {
+        up_write(&dev->sem);
+        return ret;
+    }
+    globalmem_memmove(dev, move.dst, move.src, move.len);
+    globalmem_mark_dirty(dev, move.dst, move.len);
+    up_write(&dev->sem);
+
+    globalmem_notify(dev);
+    return 0;
+}
+
+static int globalmem_ioc_cas(struct globalmem_dev *dev, void __user *argp)
+{
+    struct globalmem_cas cas;
+    void *word;
+    int ret = 0;
+
+    if (copy_from_user(&cas, argp, sizeof(cas)))
+        return -EFAULT;
+    if (cas.width != 4 && cas.width != 8)
+        return -EINVAL;
+    if (globalmem_check_range(dev, cas.offset, cas.width) ||
+        !IS_ALIGNED(cas.offset, cas.width))
+        return -EINVAL;
+
+    /*
+     * the rwsem orders us against read/write/fill/move, cmpxchg keeps the
+     * word update itself a single atomic store. A word never straddles a
+     * page since it is naturally aligned. Compare first so that a failing
+     * CAS doesn't copy a snapshot page for nothing.
+     */
+    down_write(&dev->sem);
+    ret = globalmem_prepare(dev, cas.offset, cas.width, false, GFP_KERNEL);
+    if (ret)
+        goto out;
+    word = globalmem_addr(dev, cas.offset);
+    if (cas.width == 4)
+        cas.old = READ_ONCE(*(u32 *)word);
+    else
+        cas.old = READ_ONCE(*(u64 *)word);
+    cas.swapped = 0;
+
+    if (cas.old == (cas.width == 4 ? (u32)cas.expected : cas.expected)) {
+        ret = globalmem_prepare(dev, cas.offset, cas.width, true, GFP_KERNEL);
+        if (ret)
+            goto out;
+        word = globalmem_addr(dev, cas.offset);
+
+        if (cas.width == 4) {
+            cas.old = cmpxchg((u32 *)word, (u32)cas.expected, (u32)cas.desired);
+            cas.swapped = (u32)cas.old == (u32)cas.expected;
+        } else {
+            cas.old = cmpxchg64((u64 *)word, cas.expected, cas.desired);
+            cas.swapped = cas.old == cas.expected;
+        }
+        if (cas.swapped)
+            globalmem_mark_dirty(dev, cas.offset, cas.width);
+    }
+out:
+    up_write(&dev->sem);
+    if (ret)
+        return ret;
+
+    if (cas.swapped)
+        globalmem_notify(dev);
+    if (copy_to_user(argp, &cas, sizeof(cas)))
+        return -EFAULT;
+    return 0;
+}
+
+/*
+ * crc32_le and crc32c both dispatch to the arch accelerated implementation
+ * when one is registered (ARMv8 CRC / PMULL, NEON), so nothing here is
+ * open coded.
+ */
+static int globalmem_ioc_csum(struct globalmem_dev *dev, void __user *argp)
+{
+    struct globalmem_csum csum;
+    u64 offset, len;
+    size_t n;
+    u32 crc;
+    int ret;
+
+    if (copy_from_user(&csum, argp, sizeof(csum)))
+        return -EFAULT;
+    if (globalmem_check_range(dev, csum.offset, csum.len))
+        return -EINVAL;
+    if (csum.type != GLOBALMEM_CSUM_CRC32 && csum.type != GLOBALMEM_CSUM_CRC32C)
+        return -EINVAL;
+
+    /*
+     * crc32_le()/crc32c() are the raw register update, invert around them
+     * like zlib does. They chain, so feeding them page by page gives the
+     * same result.
+     */
+    crc = ~csum.seed;
+    offset = csum.offset;
+    len = csum.len;
+    down_read(&dev->sem);
+    ret = globalmem_prepare(dev, offset, len, false, GFP_KERNEL);
+    if (ret) {
+        up_read(&dev->sem);
+        return ret;
+    }
+    while (len) {
+        n = globalmem_chunk(offset, len);
+        if (csum.type == GLOBALMEM_CSUM_CRC32)
+            crc = crc32_le(crc, globalmem_addr(dev, offset), n);
+        else
+            crc = crc32c(crc, globalmem_addr(dev, offset), n);
+        offset += n;
+        len -= n;
+    }
+    up_read(&dev->sem);
+    csum.result = ~crc;
+
+    if (copy_to_user(argp, &csum, sizeof(csum)))
+        return -EFAULT;
+    return 0;
+}
+
+static int globalmem_ioc_dirty(struct globalmem_file *gf, void __user *argp)
+{
+    struct globalmem_dev *dev = gf->dev;
+    struct globalmem_dirty dirty;
+    unsigned long nwords = DIV_ROUND_UP(dev->nr_blocks, 64);
+    u64 *bits;
+    unsigned long i;
+    int ret = 0;
+
+    if (copy_from_user(&dirty, argp, sizeof(dirty)))
+        return -EFAULT;
+
+    if (dirty.nbits < dev->nr_blocks) {
+        /* tell the caller how big the buffer has to be */
+        dirty.nbits = dev->nr_blocks;
+        dirty.block_size = GLOBALMEM_BLOCK_SIZE;
+        if (copy_to_user(argp, &dirty, sizeof(dirty)))
+            return -EFAULT;
+        return -ENOSPC;
+    }
+
+    bits = vzalloc(nwords * sizeof(*bits));
+    if (!bits)
+        return -ENOMEM;
+
+    down_write(&dev->sem);
+    for (i = 0; i < dev->nr_blocks; i++)
+        if (dev->block_gen[i] > gf->seen_gen)
+            bits[i / 64] |= 1ULL << (i % 64);
+    dirty.since = gf->seen_gen;
+    dirty.gen = dev->gen;
+    gf->seen_gen = dev->gen;
+    up_write(&dev->sem);
+
+    dirty.nbits = dev->nr_blocks;
+    dirty.block_size = GLOBALMEM_BLOCK_SIZE;
+    if (copy_to_user(u64_to_user_ptr(dirty.bitmap), bits, nwords * sizeof(*bits)) ||
+        copy_to_user(argp, &dirty, sizeof(dirty)))
+        ret = -EFAULT;
+
+    vfree(bits);
+    return ret;
+}
+
+/* pages of a snapshot also held by its neighbour don't count as its own */
+static bool globalmem_snap_shares(struct globalmem_snap *snap, struct list_head *pos,
+                                  unsigned long i)
+{
+    struct globalmem_snap *other;
+
+    if (pos == &snap->dev->snapshots)
+        return false;
+    other = list_entry(pos, struct globalmem_snap, list);
+    return other->pages[i] == snap->pages[i];
+}
+
+static void globalmem_snap_put(struct globalmem_snap *snap)
+{
+    struct globalmem_dev *dev = snap->dev;
+    struct globalmem_snap *other;
+    unsigned long i;
+
+    down_write(&dev->sem);
+    /*
+     * a page is shared by a contiguous run of snapshots, so checking the
+     * neighbours is enough to know whether this was its last owner
+     */
+    for (i = 0; i < dev->nr_pages; i++) {
+        if (snap->pages[i] != dev->pages[i] &&
+            !globalmem_snap_shares(snap, snap->list.prev, i) &&
+            !globalmem_snap_shares(snap, snap->list.next, i))
+            dev->snap_pages--;
+        put_page(snap->pages[i]);
+    }
+    list_del(&snap->list);
+    dev->nr_snapshots--;
+
+    /* pages no other snapshot holds can be written in place again */
+    bitmap_zero(dev->cow, dev->nr_pages);
+    list_for_each_entry(other, &dev->snapshots, list)
+        for (i = 0; i < dev->nr_pages; i++)
+            if (other->pages[i] == dev->pages[i])
+                __set_bit(i, dev->cow);
+    up_write(&dev->sem);
+
+    vfree(snap->pages);
+    kfree(snap);
+}
+
+static int globalmem_snap_release(struct inode *inode, struct file *filp)
+{
+    globalmem_snap_put(filp->private_data);
+    return 0;
+}
+
+/* the snapshot never changes, so reads need no locking at all */
+static ssize_t globalmem_snap_read(struct file *filp, char __user *buf, size_t size, loff_t *ppos)
+{
+    struct globalmem_snap *snap = filp->private_data;
+    loff_t p = *ppos;
+    size_t count, done = 0, n;
+
+    /* a negative or past-the-end position reads nothing, even on 32-bit */
+    count = globalmem_clamp(snap->size, p, size);
+
+    while (done < count) {
+        n = globalmem_chunk(p, count - done);
+        if (copy_to_user(buf + done, page_address(snap->pages[p >> PAGE_SHIFT]) +
+                         offset_in_page(p), n))
+            break;
+        done += n;
+        p += n;
+    }
+
+    if (count && !done)
+        return -EFAULT;
+    *ppos = p;
+    return done;
+}
+
+static loff_t globalmem_snap_llseek(struct file *filp, loff_t offset, int orig)
+{
+    struct globalmem_snap *snap = filp->private_data;
+
+    return fixed_size_llseek(filp, offset, orig, snap->size);
+}
+
+static const struct file_operations globalmem_snap_fops = {
+    .owner = THIS_MODULE,
+    .llseek = globalmem_snap_llseek,
+    .read = globalmem_snap_read,
+    .release = globalmem_snap_release,
+};
+
+static int globalmem_ioc_snapshot(struct globalmem_dev *dev, void __user *argp)
+{
+    struct globalmem_snapshot req;
+    struct globalmem_snap *snap;
+    struct file *file;
+    unsigned long i;
+    int fd, ret;
+
+    snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+    if (!snap)
+        return -ENOMEM;
+    snap->pages = vzalloc(dev->nr_pages * sizeof(*snap->pages));
+    if (!snap->pages) {
+        kfree(snap);
+        return -ENOMEM;
+    }
+    snap->dev = dev;
+    snap->size = dev->size;
+
+    fd = get_unused_fd_flags(O_CLOEXEC);
+    if (fd < 0) {
+        ret = fd;
+        goto fail_fd;
+    }
+
+    /* taking the snapshot is just a reference on every page */
+    down_write(&dev->sem);
+    ret = dev->nr_exports ? -EBUSY : globalmem_prepare(dev, 0, dev->size, false, GFP_KERNEL);
+    if (ret) {
+        up_write(&dev->sem);
+        put_unused_fd(fd);
+        goto fail_fd;
+    }
+    for (i = 0; i < dev->nr_pages; i++) {
+        get_page(dev->pages[i]);
+        snap->pages[i] = dev->pages[i];
+    }
+    bitmap_fill(dev->cow, dev->nr_pages);
+    snap->gen = dev->gen;
+    list_add_tail(&snap->list, &dev->snapshots);
+    dev->nr_snapshots++;
+    up_write(&dev->sem);
+
+    file = anon_inode_getfile("[globalmem-snapshot]", &globalmem_snap_fops, snap, O_RDONLY);
+    if (IS_ERR(file)) {
+        ret = PTR_ERR(file);
+        globalmem_snap_put(snap);
+        put_unused_fd(fd);
+        return ret;
+    }
+    file->f_mode |= FMODE_LSEEK | FMODE_PREAD;
+
+    req.fd = fd;
+    req.pad = 0;
+    req.gen = snap->gen;
+    if (copy_to_user(argp, &req, sizeof(req))) {
+        fput(file);	/* drops the snapshot through ->release */
+        put_unused_fd(fd);
+        return -EFAULT;
+    }
+
+    fd_install(fd, file);
+    return 0;
+
+fail_fd:
+    vfree(snap->pages);
+    kfree(snap);
+    return ret;
+}
+
+/*
+ * dma-buf export. The exporter holds its own reference on every page, and
+ * while it exists the device neither compresses nor copies-on-write, so
+ * the exported pages stay the device's live memory.
+ */
+struct globalmem_export {
+    struct globalmem_dev *dev;
+    unsigned long nr_pages;
+    struct page **pages;
+    struct mutex lock;			/* attachments and vmap */
+    struct list_head attachments;
+    void *vaddr;
+    unsigned int vmap_count;
+};
+
+struct globalmem_attachment {
+    struct list_head list;
+    struct device *dev;
+    struct sg_table sgt;
+    enum dma_data_direction dir;	/* DMA_NONE while not mapped */
+};
+
+/* CPU or device writes through the dma-buf count as a write to everything */
+static void globalmem_export_dirty(struct globalmem_export *exp)
+{
+    struct globalmem_dev *dev = exp->dev;
+
+    down_write(&dev->sem);
+    globalmem_mark_dirty(dev, 0, dev->size);
+    up_write(&dev->sem);
+    globalmem_notify(dev);
+}
+
+/* 4.19 dropped the device argument, it is in attach->dev on every version */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 19, 0)
+static int globalmem_dmabuf_attach(struct dma_buf *dmabuf, struct dma_buf_attachment *attach)
+#else
+static int globalmem_dmabuf_attach(struct dma_buf *dmabuf, struct device *dev,
+                                   struct dma_buf_attachment *attach)
+#endif
+{
+    struct globalmem_export *exp = dmabuf->priv;
+    struct globalmem_attachment *ga;
+    int ret;
+
+    ga = kzalloc(sizeof(*ga), GFP_KERNEL);
+    if (!ga)
+        return -ENOMEM;
+
+    ret = sg_alloc_table_from_pages(&ga->sgt, exp->pages, exp->nr_pages, 0,
+                                    exp->nr_pages << PAGE_SHIFT, GFP_KERNEL);
+    if (ret) {
+        kfree(ga);
+        return ret;
+    }
+    ga->dev = attach->dev;
+    ga->dir = DMA_NONE;
+    attach->priv = ga;
+
+    mutex_lock(&exp->lock);
+    list_add(&ga->list, &exp->attachments);
+    mutex_unlock(&exp->lock);
+    return 0;
+}
+
+static void globalmem_dmabuf_detach(struct dma_buf *dmabuf, struct dma_buf_attachment *attach)
+{
+    struct globalmem_export *exp = dmabuf->priv;
+    struct globalmem_attachment *ga = attach->priv;
+
+    mutex_lock(&exp->lock);
+    list_del(&ga->list);
+    mutex_unlock(&exp->lock);
+
+    if (ga->dir != DMA_NONE)
+        dma_unmap_sg(ga->dev, ga->sgt.sgl, ga->sgt.orig_nents, ga->dir);
+    sg_free_table(&ga->sgt);
+    kfree(ga);
+}
+
+static struct sg_table *globalmem_dmabuf_map(struct dma_buf_attachment *attach,
+                                             enum dma_data_direction dir)
+{
+    struct globalmem_export *exp = attach->dmabuf->priv;
+    struct globalmem_attachment *ga = attach->priv;
+    int nents;
+
+    mutex_lock(&exp->lock);
+    if (ga->dir != DMA_NONE) {
+        mutex_unlock(&exp->lock);
+        return ERR_PTR(-EBUSY);
+    }
+    nents = dma_map_sg(ga->dev, ga->sgt.sgl, ga->sgt.orig_nents, dir);
+    if (!nents) {
+        mutex_unlock(&exp->lock);
+        return ERR_PTR(-ENOMEM);
+    }
+    ga->sgt.nents = nents;
+    ga->dir = dir;
+    mutex_unlock(&exp->lock);
+
+    return &ga->sgt;
+}
+
+static void globalmem_dmabuf_unmap(struct dma_buf_attachment *attach, struct sg_table *sgt,
+                                   enum dma_data_direction dir)
+{
+    struct globalmem_export *exp = attach->dmabuf->priv;
+    struct globalmem_attachment *ga = attach->priv;
+
+    mutex_lock(&exp->lock);
+    dma_unmap_sg(ga->dev, sgt->sgl, sgt->orig_nents, dir);
+    ga->dir = DMA_NONE;
+    mutex_unlock(&exp->lock);
+
+    /* the device may have written while it had the mapping */
+    if (dir != DMA_TO_DEVICE)
+        globalmem_export_dirty(exp);
+}
+
+static void globalmem_export_free(struct globalmem_export *exp)
+{
+    struct globalmem_dev *dev = exp->dev;
+    unsigned long i;
+
+    if (exp->vaddr)
+        vunmap(exp->vaddr);
+    for (i = 0; i < exp->nr_pages; i++)
+        put_page(exp->pages[i]);
 
-struct globalmem_dev {
-    struct cdev cdev;
-    unsigned char mem[GLOBALMEM_SIZE];
-};
+    down_write(&dev->sem);
+    dev->nr_exports--;
+    up_write(&dev->sem);
 
-struct globalmem_dev *globalmem_devp;
+    vfree(exp->pages);
+    kfree(exp);
+}
 
-static int globalmem_open(struct inode *inode, struct file *filp)
+static void globalmem_dmabuf_release(struct dma_buf *dmabuf)
 {
-    filp->private_data = globalmem_devp;
+    globalmem_export_free(dmabuf->priv);
+}
+
+/* hand the pages to the CPU for every attachment that currently maps them */
+static int globalmem_dmabuf_begin_cpu_access(struct dma_buf *dmabuf, enum dma_data_direction dir)
+{
+    struct globalmem_export *exp = dmabuf->priv;
+    struct globalmem_attachment *ga;
+
+    mutex_lock(&exp->lock);
+    list_for_each_entry(ga, &exp->attachments, list)
+        if (ga->dir != DMA_NONE)
+            dma_sync_sg_for_cpu(ga->dev, ga->sgt.sgl, ga->sgt.orig_nents, ga->dir);
+    mutex_unlock(&exp->lock);
     return 0;
 }
 
-static int globalmem_release(struct inode *inode, struct file *filp)
+static int globalmem_dmabuf_end_cpu_access(struct dma_buf *dmabuf, enum dma_data_direction dir)
+{
+    struct globalmem_export *exp = dmabuf->priv;
+    struct globalmem_attachment *ga;
+
+    mutex_lock(&exp->lock);
+    list_for_each_entry(ga, &exp->attachments, list)
+        if (ga->dir != DMA_NONE)
+            dma_sync_sg_for_device(ga->dev, ga->sgt.sgl, ga->sgt.orig_nents, ga->dir);
+    mutex_unlock(&exp->lock);
+
+    if (dir != DMA_FROM_DEVICE)
+        globalmem_export_dirty(exp);
+    return 0;
+}
+
+/*
+ * page-wise CPU access, which 4.x dma_buf_export() insists on. 4.12 renamed
+ * the ops to map/map_atomic, 4.19 dropped map_atomic and 5.6 map.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 6, 0)
+static void *globalmem_dmabuf_kmap(struct dma_buf *dmabuf, unsigned long pgnum)
+{
+    struct globalmem_export *exp = dmabuf->priv;
+
+    return kmap(exp->pages[pgnum]);
+}
+
+static void globalmem_dmabuf_kunmap(struct dma_buf *dmabuf, unsigned long pgnum, void *vaddr)
+{
+    struct globalmem_export *exp = dmabuf->priv;
+
+    kunmap(exp->pages[pgnum]);
+}
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 19, 0)
+static void *globalmem_dmabuf_kmap_atomic(struct dma_buf *dmabuf, unsigned long pgnum)
+{
+    struct globalmem_export *exp = dmabuf->priv;
+
+    return kmap_atomic(exp->pages[pgnum]);
+}
+
+static void globalmem_dmabuf_kunmap_atomic(struct dma_buf *dmabuf, unsigned long pgnum,
+                                           void *vaddr)
+{
+    kunmap_atomic(vaddr);
+}
+#endif
+
+static int globalmem_dmabuf_mmap(struct dma_buf *dmabuf, struct vm_area_struct *vma)
+{
+    struct globalmem_export *exp = dmabuf->priv;
+    unsigned long addr = vma->vm_start;
+    unsigned long i = vma->vm_pgoff;
+    int ret;
+
+    if (vma->vm_pgoff > exp->nr_pages || vma_pages(vma) > exp->nr_pages - vma->vm_pgoff)
+        return -EINVAL;
+
+    for (; addr < vma->vm_end; addr += PAGE_SIZE, i++) {
+        ret = vm_insert_page(vma, addr, exp->pages[i]);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+static void *globalmem_export_vmap(struct globalmem_export *exp)
+{
+    void *vaddr;
+
+    mutex_lock(&exp->lock);
+    if (!exp->vaddr)
+        exp->vaddr = vmap(exp->pages, exp->nr_pages, VM_MAP, PAGE_KERNEL);
+    if (exp->vaddr)
+        exp->vmap_count++;
+    vaddr = exp->vaddr;
+    mutex_unlock(&exp->lock);
+
+    return vaddr;
+}
+
+static void globalmem_export_vunmap(struct globalmem_export *exp)
+{
+    mutex_lock(&exp->lock);
+    if (!--exp->vmap_count) {
+        vunmap(exp->vaddr);
+        exp->vaddr = NULL;
+    }
+    mutex_unlock(&exp->lock);
+}
+
+/* 5.11 passes the mapping in a struct dma_buf_map, iosys_map since 5.18 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+static int globalmem_dmabuf_vmap(struct dma_buf *dmabuf, struct iosys_map *map)
+{
+    void *vaddr = globalmem_export_vmap(dmabuf->priv);
+
+    if (!vaddr)
+        return -ENOMEM;
+    iosys_map_set_vaddr(map, vaddr);
+    return 0;
+}
+
+static void globalmem_dmabuf_vunmap(struct dma_buf *dmabuf, struct iosys_map *map)
+{
+    globalmem_export_vunmap(dmabuf->priv);
+}
+#else
+static void *globalmem_dmabuf_vmap(struct dma_buf *dmabuf)
+{
+    return globalmem_export_vmap(dmabuf->priv);
+}
+
+static void globalmem_dmabuf_vunmap(struct dma_buf *dmabuf, void *vaddr)
 {
+    globalmem_export_vunmap(dmabuf->priv);
+}
+#endif
+
+static const struct dma_buf_ops globalmem_dmabuf_ops = {
+    .attach = globalmem_dmabuf_attach,
+    .detach = globalmem_dmabuf_detach,
+    .map_dma_buf = globalmem_dmabuf_map,
+    .unmap_dma_buf = globalmem_dmabuf_unmap,
+    .release = globalmem_dmabuf_release,
+    .begin_cpu_access = globalmem_dmabuf_begin_cpu_access,
+    .end_cpu_access = globalmem_dmabuf_end_cpu_access,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 12, 0)
+    .kmap = globalmem_dmabuf_kmap,
+    .kunmap = globalmem_dmabuf_kunmap,
+    .kmap_atomic = globalmem_dmabuf_kmap_atomic,
+    .kunmap_atomic = globalmem_dmabuf_kunmap_atomic,
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(4, 19, 0)
+    .map = globalmem_dmabuf_kmap,
+    .unmap = globalmem_dmabuf_kunmap,
+    .map_atomic = globalmem_dmabuf_kmap_atomic,
+    .unmap_atomic = globalmem_dmabuf_kunmap_atomic,
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(5, 6, 0)
+    .map = globalmem_dmabuf_kmap,
+    .unmap = globalmem_dmabuf_kunmap,
+#endif
+    .mmap = globalmem_dmabuf_mmap,
+    .vmap = globalmem_dmabuf_vmap,
+    .vunmap = globalmem_dmabuf_vunmap,
+};
+
+static int globalmem_ioc_export(struct globalmem_dev *dev, void __user *argp)
+{
+    DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+    struct globalmem_dmabuf req;
+    struct globalmem_export *exp;
+    struct dma_buf *dmabuf;
+    unsigned long i;
+    int ret;
+
+    if (copy_from_user(&req, argp, sizeof(req)))
+        return -EFAULT;
+    if (req.flags & ~(O_CLOEXEC | O_ACCMODE))
+        return -EINVAL;
+
+    exp = kzalloc(sizeof(*exp), GFP_KERNEL);
+    if (!exp)
+        return -ENOMEM;
+    exp->pages = vzalloc(dev->nr_pages * sizeof(*exp->pages));
+    if (!exp->pages) {
+        kfree(exp);
+        return -ENOMEM;
+    }
+    exp->dev = dev;
+    exp->nr_pages = dev->nr_pages;
+    mutex_init(&exp->lock);
+    INIT_LIST_HEAD(&exp->attachments);
+
+    down_write(&dev->sem);
+    ret = dev->nr_snapshots ? -EBUSY : globalmem_prepare(dev, 0, dev->size, false, GFP_KERNEL);
+    if (ret) {
+        up_write(&dev->sem);
+        goto fail;
+    }
+    for (i = 0; i < dev->nr_pages; i++) {
+        get_page(dev->pages[i]);
+        exp->pages[i] = dev->pages[i];
+    }
+    dev->nr_exports++;
+    up_write(&dev->sem);
+
+    exp_info.ops = &globalmem_dmabuf_ops;
+    exp_info.size = dev->size;
+    exp_info.flags = O_RDWR;
+    exp_info.priv = exp;
+    dmabuf = dma_buf_export(&exp_info);
+    if (IS_ERR(dmabuf)) {
+        globalmem_export_free(exp);
+        return PTR_ERR(dmabuf);
+    }
+
+    /*
+     * like the snapshot fd: only install it once the caller has its number,
+     * dma_buf_fd() would leave a live fd behind if copy_to_user() faulted
+     */
+    req.fd = get_unused_fd_flags(req.flags);
+    if (req.fd < 0) {
+        dma_buf_put(dmabuf);	/* frees exp through ->release */
+        return req.fd;
+    }
+
+    if (copy_to_user(argp, &req, sizeof(req))) {
+        put_unused_fd(req.fd);
+        dma_buf_put(dmabuf);
+        return -EFAULT;
+    }
+
+    fd_install(req.fd, dmabuf->file);	/* the fd owns the dma-buf reference */
     return 0;
+
+fail:
+    vfree(exp->pages);
+    kfree(exp);
+    return ret;
 }
 
 static long globalmem_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
-    struct globalmem_dev *dev = filp->private_data;
+    struct globalmem_file *gf = filp->private_data;
+    struct globalmem_dev *dev = gf->dev;
+    void __user *argp = (void __user *)arg;
+    int ret;
 
     switch (cmd) {
     case MEM_CLEAR:
-        memset(dev->mem, 0, GLOBALMEM_SIZE);
+        down_write(&dev->sem);
+        ret = globalmem_prepare(dev, 0, dev->size, true, GFP_KERNEL);
+        if (ret) {
+            up_write(&dev->sem);
+            return ret;
+        }
+        globalmem_memset(dev, 0, 0, dev->size);
+        globalmem_mark_dirty(dev, 0, dev->size);
+        up_write(&dev->sem);
+        globalmem_notify(dev);
         printk(KERN_INFO "globalmem is set to zero\n");
         break;
 
+    case GLOBALMEM_IOC_FILL:
+        return globalmem_ioc_fill(dev, argp);
+
+    case GLOBALMEM_IOC_MOVE:
+        return globalmem_ioc_move(dev, argp);
+
+    case GLOBALMEM_IOC_CAS:
+        return globalmem_ioc_cas(dev, argp);
+
+    case GLOBALMEM_IOC_CSUM:
+        return globalmem_ioc_csum(dev, argp);
+
+    case GLOBALMEM_IOC_DIRTY:
+        return globalmem_ioc_dirty(gf, argp);
+
+    case GLOBALMEM_IOC_SNAPSHOT:
+        return globalmem_ioc_snapshot(dev, argp);
+
+    case GLOBALMEM_IOC_EXPORT:
+        return globalmem_ioc_export(dev, argp);
+
     default:
         return -EINVAL;
     }
@@ -57,97 +1394,488 @@ static long globalmem_ioctl(struct file *filp, unsigned int cmd, unsigned long a
 
 static ssize_t globalmem_read(struct file *filp, char __user *buf, size_t size, loff_t *ppos)	//读函数
 {
-    unsigned long p = *ppos;	//读的位置相对于文件开头的漂移
-    unsigned int count = size;
+    loff_t p = *ppos;	//读的位置相对于文件开头的漂移
+    size_t count;
     int ret = 0;
-    struct globalmem_dev *dev = filp->private_data;
+    struct globalmem_file *gf = filp->private_data;
+    struct globalmem_dev *dev = gf->dev;
+    struct globalmem_stats d = { .reads = 1 };
+    unsigned long faults = 0;
+    u64 start = trace_globalmem_read_enabled() ? ktime_get_ns() : 0;
 
-    if (p >= GLOBALMEM_SIZE)	//该漂移大于或等于GLOBALMEM_SIZE,表示文件已经到了末尾
-        return 0;
-    if (count > GLOBALMEM_SIZE - p)
-        count = GLOBALMEM_SIZE - p;
+    count = globalmem_clamp(dev->size, p, size);
+    if (!count)	//该漂移大于或等于设备大小,表示文件已经到了末尾
+        goto account;
 
-    if (copy_to_user(buf, dev->mem + p, count)) {
+    down_read(&dev->sem);
+    ret = __globalmem_prepare(dev, p, count, false, GFP_KERNEL, &faults);
+    if (ret)
+        goto out;
+    if (globalmem_copy_to_user(dev, buf, p, count)) {
         ret = -EFAULT;
     } else {
         *ppos += count;
         ret = count;
-
-        printk(KERN_INFO "read %u bytes(s) from %lu\n", count, p);
     }
+out:
+    up_read(&dev->sem);
 
+account:
+    d.read_bytes = ret > 0 ? ret : 0;
+    d.faults = faults;
+    globalmem_account(gf, &d);
+    trace_globalmem_read(p, size, ret, start ? ktime_get_ns() - start : 0);
     return ret;
 }
 
 static ssize_t globalmem_write(struct file *filp, const char __user *buf, size_t size, loff_t *ppos)	//写函数
 {
-    unsigned long p = *ppos;
-    unsigned int count = size;
+    loff_t p = *ppos;
+    size_t count;
     int ret = 0;
-    struct globalmem_dev *dev = filp->private_data;
+    struct globalmem_file *gf = filp->private_data;
+    struct globalmem_dev *dev = gf->dev;
+    struct globalmem_stats d = { .writes = 1 };
+    unsigned long faults = 0;
+    u64 start = trace_globalmem_write_enabled() ? ktime_get_ns() : 0;
 
-    if (p >= GLOBALMEM_SIZE)
-        return 0;
-    if (count > GLOBALMEM_SIZE - p)
-        count = GLOBALMEM_SIZE - p;
+    count = globalmem_clamp(dev->size, p, size);
+    if (!count)
+        goto account;
 
-    if (copy_from_user(dev->mem + p, buf, count)) {
-        return -EFAULT;
+    down_write(&dev->sem);
+    ret = __globalmem_prepare(dev, p, count, true, GFP_KERNEL, &faults);
+    if (ret)
+        goto out;
+    if (globalmem_copy_from_user(dev, p, buf, count)) {
+        ret = -EFAULT;
     } else {
         *ppos += count;
         ret = count;
-
-        printk(KERN_INFO "written %u bytes(s) from %lu\n", count, p);
+        globalmem_mark_dirty(dev, p, count);
     }
+out:
+    up_write(&dev->sem);
 
+    if (ret > 0)
+        globalmem_notify(dev);
+account:
+    d.write_bytes = ret > 0 ? ret : 0;
+    d.faults = faults;
+    globalmem_account(gf, &d);
+    trace_globalmem_write(p, size, ret, start ? ktime_get_ns() - start : 0);
     return ret;
 }
 
 static loff_t globalmem_llseek(struct file *filp, loff_t offset, int orig)
 {
-    loff_t ret = 0;
-    switch (orig) {
-    case 0:	//从文件开头位置seek
-        if (offset < 0) {
-            ret = -EINVAL;
-            break;
-        }
-        if ((unsigned int)offset > GLOBALMEM_SIZE) {
-            ret = -EINVAL;
-            break;
-        }
-        filp->f_pos = (unsigned int)offset;
-        ret = filp->f_pos;
-        break;
-    case 1:	//从文件当前位置开始seek
-        if ((filp->f_pos + offset) > GLOBALMEM_SIZE) {
-            ret = -EINVAL;
-            break;
-        }
-        if ((filp->f_pos + offset) < 0) {
-            ret = -EINVAL;
-            break;
-        }
-        filp->f_pos += offset;
-        ret = filp->f_pos;
-        break;
-    default:
-        ret = -EINVAL;
-        break;
+    struct globalmem_file *gf = filp->private_data;
+    unsigned long size = gf->dev->size;
+    loff_t ret;
+
+    ret = globalmem_seek(size, filp->f_pos, offset, orig);	//orig: 0 从文件开头, 1 从当前位置
+    if (ret >= 0) {
+        struct globalmem_stats d = { .seeks = 1 };
+
+        filp->f_pos = ret;
+        globalmem_account(gf, &d);
     }
     return ret;
 }
 
+/* readable once something was written after this fd's last dirty query */
+static unsigned int globalmem_poll(struct file *filp, poll_table *wait)
+{
+    struct globalmem_file *gf = filp->private_data;
+    struct globalmem_dev *dev = gf->dev;
+    unsigned int mask = POLLOUT | POLLWRNORM;
+
+    poll_wait(filp, &dev->wait, wait);
+
+    down_read(&dev->sem);
+    if (dev->gen != gf->seen_gen)
+        mask |= POLLIN | POLLRDNORM;
+    up_read(&dev->sem);
+
+    return mask;
+}
+
 static const struct file_operations globalmem_fops = {
     .owner = THIS_MODULE,
     .llseek = globalmem_llseek,
     .read = globalmem_read,
     .write = globalmem_write,
     .unlocked_ioctl = globalmem_ioctl,
+    .poll = globalmem_poll,
+    .fasync = globalmem_fasync,
     .open = globalmem_open,
     .release = globalmem_release,
 };
 
+/*
+ * Block device personality. Requests are served synchronously from
+ * ->queue_rq on the submitting CPU; with one hardware context per CPU
+ * there is no shared submission lock, and reads only take dev->sem
+ * shared, so concurrent readers scale across cores.
+ */
+static int globalmem_blk_rw(struct globalmem_dev *dev, struct request *rq)
+{
+    bool write = rq_data_dir(rq) == WRITE;
+    u64 start = (u64)blk_rq_pos(rq) << 9;
+    u64 len = blk_rq_bytes(rq);
+    u64 pos = start;
+    struct req_iterator iter;
+    struct bio_vec bvec;
+    void *buf;
+    int ret;
+
+    if (globalmem_check_range(dev, start, len))
+        return -EIO;
+
+    if (write) {
+        down_write(&dev->sem);
+        ret = globalmem_prepare(dev, start, len, true, GFP_NOIO);
+        if (ret) {
+            up_write(&dev->sem);
+            return ret;
+        }
+    } else {
+        down_read(&dev->sem);
+        ret = globalmem_prepare(dev, start, len, false, GFP_NOIO);
+        if (ret) {
+            up_read(&dev->sem);
+            return ret;
+        }
+    }
+
+    rq_for_each_segment(bvec, rq, iter) {
+        buf = kmap_atomic(bvec.bv_page);
+        if (write) {
+            globalmem_copy_in(dev, pos, buf + bvec.bv_offset, bvec.bv_len);
+        } else {
+            globalmem_copy_out(dev, buf + bvec.bv_offset, pos, bvec.bv_len);
+            flush_dcache_page(bvec.bv_page);
+        }
+        kunmap_atomic(buf);
+        pos += bvec.bv_len;
+    }
+
+    if (write) {
+        globalmem_mark_dirty(dev, start, len);
+        up_write(&dev->sem);
+        globalmem_notify(dev);
+    } else {
+        up_read(&dev->sem);
+    }
+    return 0;
+}
+
+static blk_status_t globalmem_queue_rq(struct blk_mq_hw_ctx *hctx,
+                                       const struct blk_mq_queue_data *bd)
+{
+    struct globalmem_dev *dev = hctx->queue->queuedata;
+    struct request *rq = bd->rq;
+    int err;
+
+    blk_mq_start_request(rq);
+
+    switch (req_op(rq)) {
+    case REQ_OP_READ:
+    case REQ_OP_WRITE:
+        err = globalmem_blk_rw(dev, rq);
+        break;
+    default:
+        err = -EIO;
+        break;
+    }
+
+    blk_mq_end_request(rq, errno_to_blk_status(err));
+    return BLK_STS_OK;
+}
+
+static struct blk_mq_ops globalmem_mq_ops = {
+    .queue_rq = globalmem_queue_rq,
+};
+
+static const struct block_device_operations globalmem_bdev_ops = {
+    .owner = THIS_MODULE,
+};
+
+static int globalmem_blk_init(struct globalmem_dev *dev)
+{
+    int ret;
+
+    globalmem_blk_major = register_blkdev(0, "globalmem");
+    if (globalmem_blk_major < 0)
+        return globalmem_blk_major;
+
+    dev->tag_set.ops = &globalmem_mq_ops;
+    dev->tag_set.nr_hw_queues = nr_cpu_ids;
+    dev->tag_set.queue_depth = GLOBALMEM_BLK_QUEUE_DEPTH;
+    dev->tag_set.numa_node = NUMA_NO_NODE;
+    /* down_write() and GFP_NOIO page copies may sleep */
+    dev->tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_BLOCKING;
+    dev->tag_set.driver_data = dev;
+    ret = blk_mq_alloc_tag_set(&dev->tag_set);
+    if (ret)
+        goto fail_tag_set;
+
+    /* non-rotational, no entropy contribution, see drvcore_compat.h */
+    dev->disk = drvcore_blk_mq_alloc_disk(&dev->tag_set, PAGE_SIZE, dev);
+    if (IS_ERR(dev->disk)) {
+        ret = PTR_ERR(dev->disk);
+        goto fail_disk;
+    }
+    dev->disk->major = globalmem_blk_major;
+    dev->disk->first_minor = 0;
+    dev->disk->fops = &globalmem_bdev_ops;
+    dev->disk->private_data = dev;
+    snprintf(dev->disk->disk_name, DISK_NAME_LEN, "globalmem0");
+    set_capacity(dev->disk, dev->size >> 9);
+    ret = drvcore_add_disk(dev->disk);
+    if (ret)
+        goto fail_add;
+    return 0;
+
+fail_add:
+    drvcore_blk_cleanup_disk(dev->disk);
+fail_disk:
+    dev->disk = NULL;
+    blk_mq_free_tag_set(&dev->tag_set);
+fail_tag_set:
+    unregister_blkdev(globalmem_blk_major, "globalmem");
+    return ret;
+}
+
+static void globalmem_blk_exit(struct globalmem_dev *dev)
+{
+    if (!dev->disk)
+        return;
+
+    del_gendisk(dev->disk);
+    drvcore_blk_cleanup_disk(dev->disk);
+    blk_mq_free_tag_set(&dev->tag_set);
+    unregister_blkdev(globalmem_blk_major, "globalmem");
+}
+
+static ssize_t snapshots_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+    struct globalmem_dev *dev = dev_get_drvdata(d);
+    unsigned int n;
+
+    down_read(&dev->sem);
+    n = dev->nr_snapshots;
+    up_read(&dev->sem);
+    return sprintf(buf, "%u\n", n);
+}
+
+/* memory held only because of snapshots, i.e. their copy-on-write overhead */
+static ssize_t snapshot_bytes_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+    struct globalmem_dev *dev = dev_get_drvdata(d);
+    unsigned long pages;
+
+    down_read(&dev->sem);
+    pages = dev->snap_pages;
+    up_read(&dev->sem);
+    return sprintf(buf, "%lu\n", pages << PAGE_SHIFT);
+}
+
+static ssize_t cow_copies_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+    struct globalmem_dev *dev = dev_get_drvdata(d);
+    unsigned long copies;
+
+    down_read(&dev->sem);
+    copies = dev->cow_copies;
+    up_read(&dev->sem);
+    return sprintf(buf, "%lu\n", copies);
+}
+
+static ssize_t compression_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+    struct globalmem_dev *dev = dev_get_drvdata(d);
+    unsigned long zpages, zsame, zdecomp;
+    u64 orig, stored, ratio, avg_ns, max_ns;
+    u32 frac;
+
+    if (!dev->zslots)
+        return sprintf(buf, "disabled\n");
+
+    mutex_lock(&dev->zlock);
+    zpages = dev->zpages;
+    zsame = dev->zsame;
+    stored = dev->zbytes + zsame * sizeof(unsigned long);
+    zdecomp = dev->zdecomp;
+    avg_ns = zdecomp ? div64_u64(dev->zdecomp_ns, zdecomp) : 0;
+    max_ns = dev->zdecomp_max_ns;
+    mutex_unlock(&dev->zlock);
+
+    orig = (u64)zpages << PAGE_SHIFT;
+    ratio = stored ? div64_u64(orig * 100, stored) : 0;
+    frac = do_div(ratio, 100);
+
+    return sprintf(buf, "Algorithm: %s\n"
+                   "Cold ms: %u\n"
+                   "Compressed pages: %lu\n"
+                   "Same-filled pages: %lu\n"
+                   "Original bytes: %llu\n"
+                   "Stored bytes: %llu\n"
+                   "Ratio: %llu.%02u\n"
+                   "Decompressions: %lu\n"
+                   "Decompress avg ns: %llu\n"
+                   "Decompress max ns: %llu\n",
+                   globalmem_compress, globalmem_cold_ms, zpages, zsame,
+                   orig, stored, ratio, frac,
+                   zdecomp, avg_ns, max_ns);
+}
+
+static DEVICE_ATTR_RO(snapshots);
+static DEVICE_ATTR_RO(snapshot_bytes);
+static DEVICE_ATTR_RO(cow_copies);
+static DEVICE_ATTR_RO(compression);
+
+static struct attribute *globalmem_attrs[] = {
+    &dev_attr_snapshots.attr,
+    &dev_attr_snapshot_bytes.attr,
+    &dev_attr_cow_copies.attr,
+    &dev_attr_compression.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(globalmem);
+
+/* debugfs: /sys/kernel/debug/globalmem/{stats,files}, stats comes from drvcore */
+
+/* one line per open file, in open order */
+static int globalmem_files_show(struct seq_file *s, void *unused)
+{
+    struct globalmem_dev *dev = s->private;
+    struct globalmem_file *gf;
+    struct globalmem_stats st;
+
+    seq_puts(s, "pid\tcomm\treads\tread_bytes\twrites\twrite_bytes\tfaults\tseeks\n");
+    spin_lock(&dev->files_lock);
+    list_for_each_entry(gf, &dev->files, list) {
+        spin_lock(&gf->lock);
+        st = gf->stats;
+        spin_unlock(&gf->lock);
+        seq_printf(s, "%d\t%s\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n", gf->pid, gf->comm,
+                   st.reads, st.read_bytes, st.writes, st.write_bytes, st.faults, st.seeks);
+    }
+    spin_unlock(&dev->files_lock);
+    return 0;
+}
+
+static int globalmem_files_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, globalmem_files_show, inode->i_private);
+}
+
+static const struct file_operations globalmem_files_fops = {
+    .owner = THIS_MODULE,
+    .open = globalmem_files_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+/* debugfs is optional, the device works without it */
+static void globalmem_debugfs_init(struct globalmem_dev *dev)
+{
+    dev->debugfs = debugfs_create_dir("globalmem", NULL);
+    if (IS_ERR_OR_NULL(dev->debugfs))
+        return;
+    drvcore_stats_debugfs(dev->stats, "stats", dev->debugfs);
+    debugfs_create_file("files", S_IRUGO, dev->debugfs, dev, &globalmem_files_fops);
+}
+
+static int globalmem_zinit(struct globalmem_dev *dev)
+{
+    int ret;
+
+    mutex_init(&dev->zlock);
+    INIT_DELAYED_WORK(&dev->zwork, globalmem_zwork);
+
+    if (!drvcore_comp_has(globalmem_compress)) {
+        printk(KERN_ERR "globalmem: compressor %s not available\n", globalmem_compress);
+        return -ENOENT;
+    }
+    ret = drvcore_comp_alloc(&dev->comp, globalmem_compress);
+    if (ret)
+        return ret;
+
+    /* some compressors may expand incompressible input, give them room */
+    dev->zbuf = kmalloc(2 * PAGE_SIZE, GFP_KERNEL);
+    dev->accessed = vzalloc(BITS_TO_LONGS(dev->nr_pages) * sizeof(long));
+    dev->zslots = vzalloc(dev->nr_pages * sizeof(*dev->zslots));
+    if (!dev->zbuf || !dev->accessed || !dev->zslots) {
+        vfree(dev->zslots);
+        dev->zslots = NULL;
+        vfree(dev->accessed);
+        kfree(dev->zbuf);
+        drvcore_comp_free(&dev->comp);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+/* before globalmem_free_pages(), compressed pages have no struct page */
+static void globalmem_zexit(struct globalmem_dev *dev)
+{
+    unsigned long i;
+
+    if (!dev->zslots)
+        return;
+
+    cancel_delayed_work_sync(&dev->zwork);
+    for (i = 0; i < dev->nr_pages; i++)
+        kfree(dev->zslots[i].data);
+    vfree(dev->zslots);
+    vfree(dev->accessed);
+    kfree(dev->zbuf);
+    drvcore_comp_free(&dev->comp);
+}
+
+static void globalmem_free_pages(struct globalmem_dev *dev)
+{
+    unsigned long i;
+
+    for (i = 0; dev->pages && i < dev->nr_pages; i++)
+        if (dev->pages[i])
+            put_page(dev->pages[i]);
+    vfree(dev->pages);
+    vfree(dev->cow);
+    vfree(dev->block_gen);
+}
+
+static int globalmem_alloc_pages(struct globalmem_dev *dev)
+{
+    unsigned long i;
+
+    dev->size = PAGE_ALIGN(globalmem_size);
+    if (!dev->size)
+        return -EINVAL;
+    dev->nr_pages = dev->size >> PAGE_SHIFT;
+    dev->nr_blocks = dev->size >> GLOBALMEM_BLOCK_SHIFT;
+
+    dev->pages = vzalloc(dev->nr_pages * sizeof(*dev->pages));
+    dev->cow = vzalloc(BITS_TO_LONGS(dev->nr_pages) * sizeof(long));
+    dev->block_gen = vzalloc(dev->nr_blocks * sizeof(*dev->block_gen));
+    if (!dev->pages || !dev->cow || !dev->block_gen)
+        goto fail;
+
+    for (i = 0; i < dev->nr_pages; i++) {
+        dev->pages[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+        if (!dev->pages[i])
+            goto fail;
+    }
+    return 0;
+
+fail:
+    globalmem_free_pages(dev);
+    return -ENOMEM;
+}
+
 static void globalmem_setup_cdev(struct globalmem_dev *dev, int index)
 {
     int err, devno = MKDEV(globalmem_major, index);
@@ -179,9 +1907,70 @@ static int __init globalmem_init(void)
         goto fail_malloc;
     }
 
+    ret = globalmem_alloc_pages(globalmem_devp);
+    if (ret)
+        goto fail_pages;
+
+    globalmem_devp->stats = drvcore_stats_alloc(globalmem_stat_names,
+                                                ARRAY_SIZE(globalmem_stat_names));
+    if (!globalmem_devp->stats) {
+        ret = -ENOMEM;
+        goto fail_stats;
+    }
+
+    init_rwsem(&globalmem_devp->sem);
+    INIT_LIST_HEAD(&globalmem_devp->snapshots);
+    init_waitqueue_head(&globalmem_devp->wait);
+    INIT_LIST_HEAD(&globalmem_devp->files);
+    spin_lock_init(&globalmem_devp->files_lock);
+
+    if (globalmem_compress[0]) {
+        ret = globalmem_zinit(globalmem_devp);
+        if (ret)
+            goto fail_zinit;
+    }
+
     globalmem_setup_cdev(globalmem_devp, 0);
+
+    /* sysfs: /sys/class/globalmem/globalmem/{snapshots,snapshot_bytes,cow_copies} */
+    globalmem_devp->class = drvcore_class_create("globalmem");
+    if (IS_ERR(globalmem_devp->class)) {
+        ret = PTR_ERR(globalmem_devp->class);
+        goto fail_class;
+    }
+    globalmem_devp->device = device_create_with_groups(globalmem_devp->class, NULL, devno,
+                                                       globalmem_devp, globalmem_groups,
+                                                       "globalmem");
+    if (IS_ERR(globalmem_devp->device)) {
+        ret = PTR_ERR(globalmem_devp->device);
+        goto fail_device;
+    }
+
+    if (globalmem_blkdev) {
+        ret = globalmem_blk_init(globalmem_devp);
+        if (ret)
+            goto fail_blk;
+    }
+
+    globalmem_debugfs_init(globalmem_devp);
+
+    if (globalmem_devp->zslots)
+        schedule_delayed_work(&globalmem_devp->zwork, globalmem_cold_delay());
     return 0;
 
+    fail_blk:
+    device_destroy(globalmem_devp->class, devno);
+    fail_device:
+    class_destroy(globalmem_devp->class);
+    fail_class:
+    cdev_del(&globalmem_devp->cdev);
+    globalmem_zexit(globalmem_devp);
+    fail_zinit:
+    drvcore_stats_free(globalmem_devp->stats);
+    fail_stats:
+    globalmem_free_pages(globalmem_devp);
+    fail_pages:
+    kfree(globalmem_devp);
     fail_malloc:
     unregister_chrdev_region(devno, 1);
     return ret;
@@ -190,7 +1979,14 @@ module_init(globalmem_init);
 
 static void __exit globalmem_exit(void)
 {
+    debugfs_remove_recursive(globalmem_devp->debugfs);
+    globalmem_blk_exit(globalmem_devp);
+    device_destroy(globalmem_devp->class, MKDEV(globalmem_major, 0));
+    class_destroy(globalmem_devp->class);
     cdev_del(&globalmem_devp->cdev);
+    globalmem_zexit(globalmem_devp);
+    drvcore_stats_free(globalmem_devp->stats);
+    globalmem_free_pages(globalmem_devp);
     kfree(globalmem_devp);
     unregister_chrdev_region(MKDEV(globalmem_major, 0), 1);
 }
@@ -198,3 +1994,4 @@ module_exit(globalmem_exit);
 
 MODULE_LICENSE("GPL v2");
 MODULE_AUTHOR("JIU");
+DRVCORE_IMPORT_NS_DMA_BUF();
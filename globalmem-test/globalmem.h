@@ -0,0 +1,127 @@
+/*
+ * globalmem ioctl interface, shared by the driver and userspace tools
+ *
+ * Licensed under GPLv2 or later.
+ */
+
+#ifndef _GLOBALMEM_H
+#define _GLOBALMEM_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define MEM_CLEAR 0x1	/* legacy command, kept for existing users */
+
+#define GLOBALMEM_IOC_MAGIC 'g'
+
+/* set [offset, offset + len) to value */
+struct globalmem_fill {
+    __u64 offset;
+    __u64 len;
+    __u8 value;
+    __u8 pad[7];
+};
+
+/* memmove inside the device, ranges may overlap */
+struct globalmem_move {
+    __u64 dst;
+    __u64 src;
+    __u64 len;
+};
+
+/*
+ * compare-and-swap on a naturally aligned 32 or 64 bit word. old always
+ * returns the value found at offset, swapped tells whether desired was stored.
+ */
+struct globalmem_cas {
+    __u64 offset;
+    __u64 expected;
+    __u64 desired;
+    __u64 old;
+    __u32 width;	/* 4 or 8 */
+    __u32 swapped;
+};
+
+/*
+ * Both CRCs use the usual pre/post inversion, so CRC32 matches zlib's
+ * crc32(seed, buf, len) and CRC32C matches iSCSI/ext4. seed is 0 for a new
+ * checksum or the previous result to continue one.
+ */
+#define GLOBALMEM_CSUM_CRC32	0	/* crc32_le, as used by zlib/ethernet */
+#define GLOBALMEM_CSUM_CRC32C	1	/* Castagnoli, via the crypto API */
+
+struct globalmem_csum {
+    __u64 offset;
+    __u64 len;
+    __u32 type;
+    __u32 seed;
+    __u32 result;
+    __u32 pad;
+};
+
+/*
+ * blocks written since this fd last asked. Every write-type operation bumps
+ * the device generation; the ioctl returns the blocks modified after the
+ * fd's last seen generation as a bitmap of __u64 words (bit n of word n / 64
+ * is block n) and then advances the fd to the current generation.
+ */
+struct globalmem_dirty {
+    __u64 bitmap;	/* in: user pointer to the bitmap buffer */
+    __u32 nbits;	/* in: buffer capacity in bits, out: number of blocks */
+    __u32 block_size;	/* out: bytes per block */
+    __u64 since;	/* out: generation the bitmap is relative to */
+    __u64 gen;		/* out: current generation */
+};
+
+/*
+ * open a read-only, seekable fd holding a point-in-time copy of the device.
+ * Pages written after the snapshot are copied on write, so the snapshot
+ * stays consistent while writers carry on.
+ */
+struct globalmem_snapshot {
+    __s32 fd;		/* out: snapshot fd, O_CLOEXEC */
+    __u32 pad;
+    __u64 gen;		/* out: device generation captured */
+};
+
+/*
+ * export the device memory as a dma-buf. While any export is alive the
+ * pages stay resident (no cold page compression) and snapshots are
+ * refused, since a copy-on-write would detach the exported pages from
+ * the device; GLOBALMEM_IOC_SNAPSHOT fails with EBUSY, and so does the
+ * export while snapshots are open.
+ */
+struct globalmem_dmabuf {
+    __u32 flags;	/* in: O_CLOEXEC and/or O_RDWR for the new fd */
+    __s32 fd;		/* out: dma-buf fd */
+};
+
+#define GLOBALMEM_IOC_FILL	_IOW(GLOBALMEM_IOC_MAGIC, 1, struct globalmem_fill)
+#define GLOBALMEM_IOC_MOVE	_IOW(GLOBALMEM_IOC_MAGIC, 2, struct globalmem_move)
+#define GLOBALMEM_IOC_CAS	_IOWR(GLOBALMEM_IOC_MAGIC, 3, struct globalmem_cas)
+#define GLOBALMEM_IOC_CSUM	_IOWR(GLOBALMEM_IOC_MAGIC, 4, struct globalmem_csum)
+#define GLOBALMEM_IOC_DIRTY	_IOWR(GLOBALMEM_IOC_MAGIC, 5, struct globalmem_dirty)
+#define GLOBALMEM_IOC_SNAPSHOT	_IOR(GLOBALMEM_IOC_MAGIC, 6, struct globalmem_snapshot)
+#define GLOBALMEM_IOC_EXPORT	_IOWR(GLOBALMEM_IOC_MAGIC, 7, struct globalmem_dmabuf)
+
+/*
+ * globalmem_importer test module (/dev/globalmem_importer): imports a
+ * dma-buf fd, attaches and maps it, and checksums it through a kernel
+ * vmap, optionally filling it with value first.
+ */
+#define GLOBALMEM_IMPORT_FILL	0x1
+
+struct globalmem_import {
+    __s32 fd;		/* in: dma-buf fd */
+    __u32 flags;	/* in: GLOBALMEM_IMPORT_* */
+    __u32 seed;		/* in: seed, as for GLOBALMEM_CSUM_CRC32 */
+    __u8 value;		/* in: fill value for GLOBALMEM_IMPORT_FILL */
+    __u8 pad[3];
+    __u64 size;		/* out: dma-buf size */
+    __u32 crc;		/* out: GLOBALMEM_CSUM_CRC32 of the whole buffer */
+    __u32 nents;	/* out: mapped scatterlist entries */
+};
+
+#define GLOBALMEM_IMPORT_IOC_CHECK	_IOWR('G', 1, struct globalmem_import)
+
+#endif /* _GLOBALMEM_H */
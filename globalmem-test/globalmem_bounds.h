@@ -0,0 +1,64 @@
+/*
+ * globalmem_bounds: position and range arithmetic for globalmem
+ *
+ * read()/write() clamping, llseek() and the ioctl range check, kept free of
+ * kernel dependencies so uspace-test/ can fuzz them against wide arithmetic.
+ * Positions are s64 (loff_t in the kernel), sizes are u64.
+ *
+ * Licensed under GPLv2 or later.
+ */
+
+#ifndef _GLOBALMEM_BOUNDS_H
+#define _GLOBALMEM_BOUNDS_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#else
+#include "drvcore_uspace.h"
+#endif
+
+/* bytes of [pos, pos + count) that lie inside the device, 0 at or past the end */
+static inline size_t globalmem_clamp(u64 size, s64 pos, size_t count)
+{
+    if (pos < 0 || (u64)pos >= size)
+        return 0;
+    return min_t(u64, count, size - pos);
+}
+
+/*
+ * new file position for llseek(), or -EINVAL. whence is 0 (from the start)
+ * or 1 (from the current position); the result must stay within [0, size].
+ * Compares against the distance left instead of adding first, so a huge
+ * offset cannot overflow the signed sum.
+ */
+static inline s64 globalmem_seek(u64 size, s64 pos, s64 offset, int whence)
+{
+    s64 base;
+
+    switch (whence) {
+    case 0:
+        base = 0;
+        break;
+    case 1:
+        base = pos;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    if (base < 0 || (u64)base > size)
+        return -EINVAL;
+    if (offset < -base || (offset > 0 && (u64)offset > size - base))
+        return -EINVAL;
+    return base + offset;
+}
+
+/* reject ranges that leave the device, without overflowing on offset + len */
+static inline int globalmem_range_ok(u64 size, u64 offset, u64 len)
+{
+    return offset <= size && len <= size - offset;
+}
+
+#endif /* _GLOBALMEM_BOUNDS_H */
@@ -0,0 +1,148 @@
+/*
+ * globalmem_importer : dma-buf importer used to test globalmem exports
+ *
+ * Userspace exports globalmem with GLOBALMEM_IOC_EXPORT and passes the fd
+ * to GLOBALMEM_IMPORT_IOC_CHECK on /dev/globalmem_importer. The module
+ * attaches to and maps the buffer like a DMA capable driver would, then
+ * checksums it through dma_buf_vmap() so the result can be compared with
+ * GLOBALMEM_IOC_CSUM on the exporter.
+ *
+ * Licensed under GPLv2 or later.
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/miscdevice.h>
+#include <linux/uaccess.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+#include <linux/crc32.h>
+
+#include "globalmem.h"
+#include "drvcore_compat.h"
+
+static struct miscdevice importer_miscdev;
+
+static int importer_check(struct globalmem_import *req)
+{
+    struct device *dev = importer_miscdev.this_device;
+    enum dma_data_direction dir;
+    struct dma_buf_attachment *attach;
+    struct dma_buf *dmabuf;
+    struct sg_table *sgt;
+    void *vaddr;
+    int ret;
+
+    dir = (req->flags & GLOBALMEM_IMPORT_FILL) ? DMA_BIDIRECTIONAL : DMA_FROM_DEVICE;
+
+    dmabuf = dma_buf_get(req->fd);
+    if (IS_ERR(dmabuf))
+        return PTR_ERR(dmabuf);
+
+    attach = dma_buf_attach(dmabuf, dev);
+    if (IS_ERR(attach)) {
+        ret = PTR_ERR(attach);
+        goto fail_attach;
+    }
+
+    sgt = dma_buf_map_attachment_unlocked(attach, dir);
+    if (IS_ERR(sgt)) {
+        ret = PTR_ERR(sgt);
+        goto fail_map;
+    }
+    req->nents = sgt->nents;
+
+    ret = dma_buf_begin_cpu_access(dmabuf, dir);
+    if (ret)
+        goto fail_access;
+
+    vaddr = drvcore_dma_buf_vmap(dmabuf);
+    if (!vaddr) {
+        ret = -ENOMEM;
+        dma_buf_end_cpu_access(dmabuf, dir);
+        goto fail_access;
+    }
+
+    if (req->flags & GLOBALMEM_IMPORT_FILL)
+        memset(vaddr, req->value, dmabuf->size);
+    req->size = dmabuf->size;
+    req->crc = ~crc32_le(~req->seed, vaddr, dmabuf->size);
+
+    drvcore_dma_buf_vunmap(dmabuf, vaddr);
+    ret = dma_buf_end_cpu_access(dmabuf, dir);
+
+fail_access:
+    dma_buf_unmap_attachment_unlocked(attach, sgt, dir);
+fail_map:
+    dma_buf_detach(dmabuf, attach);
+fail_attach:
+    dma_buf_put(dmabuf);
+    return ret;
+}
+
+static long importer_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    void __user *argp = (void __user *)arg;
+    struct globalmem_import req;
+    int ret;
+
+    switch (cmd) {
+    case GLOBALMEM_IMPORT_IOC_CHECK:
+        if (copy_from_user(&req, argp, sizeof(req)))
+            return -EFAULT;
+        if (req.flags & ~GLOBALMEM_IMPORT_FILL)
+            return -EINVAL;
+
+        ret = importer_check(&req);
+        if (ret)
+            return ret;
+
+        if (copy_to_user(argp, &req, sizeof(req)))
+            return -EFAULT;
+        return 0;
+
+    default:
+        return -EINVAL;
+    }
+}
+
+static const struct file_operations importer_fops = {
+    .owner = THIS_MODULE,
+    .unlocked_ioctl = importer_ioctl,
+};
+
+static struct miscdevice importer_miscdev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "globalmem_importer",
+    .fops = &importer_fops,
+};
+
+static int __init importer_init(void)
+{
+    int ret;
+
+    ret = misc_register(&importer_miscdev);
+    if (ret)
+        return ret;
+
+    /* the misc device stands in for a DMA master, give it a mask */
+    ret = dma_coerce_mask_and_coherent(importer_miscdev.this_device, DMA_BIT_MASK(32));
+    if (ret) {
+        misc_deregister(&importer_miscdev);
+        return ret;
+    }
+    return 0;
+}
+module_init(importer_init);
+
+static void __exit importer_exit(void)
+{
+    misc_deregister(&importer_miscdev);
+}
+module_exit(importer_exit);
+
+MODULE_LICENSE("GPL v2");
+MODULE_AUTHOR("JIU");
+MODULE_DESCRIPTION("dma-buf importer for testing globalmem exports");
+DRVCORE_IMPORT_NS_DMA_BUF();
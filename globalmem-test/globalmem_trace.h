@@ -0,0 +1,63 @@
+/*
+ * globalmem tracepoints
+ *
+ *   echo 1 > /sys/kernel/debug/tracing/events/globalmem/enable
+ *   cat /sys/kernel/debug/tracing/trace_pipe
+ *
+ * Licensed under GPLv2 or later.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM globalmem
+
+#if !defined(_GLOBALMEM_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _GLOBALMEM_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* ret is the byte count or a negative errno, latency covers lock wait and copy */
+DECLARE_EVENT_CLASS(globalmem_rw,
+
+    TP_PROTO(u64 offset, size_t size, ssize_t ret, u64 latency_ns),
+
+    TP_ARGS(offset, size, ret, latency_ns),
+
+    TP_STRUCT__entry(
+        __field(u64, offset)
+        __field(size_t, size)
+        __field(ssize_t, ret)
+        __field(u64, latency_ns)
+        __field(pid_t, pid)
+    ),
+
+    TP_fast_assign(
+        __entry->offset = offset;
+        __entry->size = size;
+        __entry->ret = ret;
+        __entry->latency_ns = latency_ns;
+        __entry->pid = current->pid;
+    ),
+
+    TP_printk("pid=%d offset=%llu size=%zu ret=%zd latency=%lluns",
+              __entry->pid, __entry->offset, __entry->size, __entry->ret,
+              __entry->latency_ns)
+);
+
+DEFINE_EVENT(globalmem_rw, globalmem_read,
+    TP_PROTO(u64 offset, size_t size, ssize_t ret, u64 latency_ns),
+    TP_ARGS(offset, size, ret, latency_ns)
+);
+
+DEFINE_EVENT(globalmem_rw, globalmem_write,
+    TP_PROTO(u64 offset, size_t size, ssize_t ret, u64 latency_ns),
+    TP_ARGS(offset, size, ret, latency_ns)
+);
+
+#endif /* _GLOBALMEM_TRACE_H */
+
+/* the header is not under include/trace/events, tell define_trace.h where it is */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE globalmem_trace
+#include <trace/define_trace.h>
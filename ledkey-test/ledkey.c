@@ -1,91 +1,1244 @@
 #include <linux/module.h>
 #include <linux/init.h>
-#include <linux/gpio.h>
+#include <linux/gpio/consumer.h>
 #include <linux/interrupt.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/uaccess.h>
+#include <linux/mutex.h>
+#include <linux/atomic.h>
+#include <linux/platform_device.h>
+#include <linux/of_device.h>
+#include <linux/property.h>
+#include <linux/slab.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include <linux/kref.h>
+#include <linux/workqueue.h>
+
+#include "drvcore.h"
+#include "drvcore_compat.h"
+#include "ledkey.h"
 
 #define DRIVER_NAME "ledkey_press_hold"
 
-// GPIO定义
-#define LED1_GPIO 3    // GPIO1_IO03 (低电平点亮)
-#define LED2_GPIO 5    // GPIO1_IO05 (低电平点亮)
-#define KEY1_GPIO 129  // GPIO5_IO01
-#define KEY2_GPIO 18   // GPIO1_IO18
+#define LEDKEY_RING_SIZE 256  // 必须是2的幂
+
+static unsigned int debounce_us = 10000;
+module_param(debounce_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(debounce_us, "debounce window in microseconds");
+
+static unsigned int storm_threshold = 500;
+module_param(storm_threshold, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(storm_threshold, "edges per second that count as an interrupt storm, 0 disables");
+
+static unsigned int poll_ms = 20;
+module_param(poll_ms, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(poll_ms, "key sampling period while an interrupt storm is being ridden out");
+
+static unsigned int quiet_ms = 1000;
+module_param(quiet_ms, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(quiet_ms, "stable time after which a polled key goes back to interrupts");
+
+static unsigned int long_ms = 800;
+module_param(long_ms, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(long_ms, "hold time that makes a press a long press");
+
+static unsigned int double_ms = 300;
+module_param(double_ms, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(double_ms, "max gap between the clicks of a double click, 0 disables double clicks");
+
+static unsigned int repeat_ms = 200;
+module_param(repeat_ms, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(repeat_ms, "repeat period after a long press, 0 disables repeat");
+
+// 中断频率按这个长度的窗口统计
+#define STORM_WINDOW_NS (NSEC_PER_SEC / 10)
+
+/*
+ * 设备树: 每个子节点是一对按键/LED, 按子节点顺序编号(事件里的 key).
+ * 有效电平由 GPIO 标志决定, 按下的按键使对应LED点亮.
+ *
+ *     ledkey {
+ *         compatible = "ledkey";
+ *         key1 {
+ *             label = "KEY1";
+ *             key-gpios = <&gpio5 1 GPIO_ACTIVE_LOW>;
+ *             led-gpios = <&gpio1 3 GPIO_ACTIVE_LOW>;
+ *         };
+ *         key2 {
+ *             label = "KEY2";
+ *             key-gpios = <&gpio1 18 GPIO_ACTIVE_LOW>;
+ *             led-gpios = <&gpio1 5 GPIO_ACTIVE_LOW>;
+ *         };
+ *     };
+ */
+static const struct of_device_id ledkey_of_match[] = {
+    { .compatible = "ledkey" },
+    {},
+};
+MODULE_DEVICE_TABLE(of, ledkey_of_match);
+
+struct ledkey_dev;
+
+/*
+ * 每个打开的文件一个读者, 有自己的订阅和事件队列, 一个读者取走事件不影响别的读者.
+ * 队列是多生产者(各按键的硬中断和定时器, 可能在不同CPU上), 单消费者(读者用
+ * read_lock 串行化), 用 drvcore 的 mpsc 环形缓冲区. 满了就丢弃新事件并计数,
+ * 生产者从不等待.
+ */
+struct ledkey_client {
+    struct ledkey_dev *ldev;
+    struct list_head node;      // ldev->clients 上, 由 ldev->clients_lock 保护
+    u32 events;                 // LEDKEY_EV_*, 决定哪些事件进这个读者的队列
+    struct drvcore_mpsc queue;
+    struct mutex read_lock;
+    struct fasync_struct *async_queue;
+};
+
+/*
+ * 每对按键/LED的状态, 作为中断的 dev_id, 中断处理不需要查找. 消抖采用"前沿立即
+ * 生效": 空闲时的第一个边沿在硬中断里直接更新LED, 然后开一个 debounce_us 的窗口,
+ * 窗口内的抖动只计数不处理; 窗口结束时再采样一次, 电平变了就再生效一次并重新开
+ * 窗口. 所以一串抖动最多合并成一次状态变化, 而LED的响应延迟只有一次中断.
+ *
+ * 中断风暴保护: 硬中断里统计每个按键的中断频率, 超过 storm_threshold 就关掉这个
+ * 按键的中断, 改用同一个 hrtimer 每 poll_ms 采样一次; 连续 quiet_ms 电平不变后
+ * 重新打开中断(类似 NAPI 的中断/轮询切换).
+ *
+ * 按键生效时执行它的规则(struct ledkey_rule), 脉冲和闪烁用 act_timer 计时.
+ * 同时喂给手势状态机, 长按/双击/连发的超时用 gesture_timer.
+ *
+ * 按键线在会睡眠的控制器上(I2C扩展芯片, gpio-sim)时硬中断和定时器不能读它:
+ * 中断只用线程处理, 线程里读线后做和硬中断同样的事; 定时器到期记下 sample_timer,
+ * 采样和唤醒读者交给 key->work. LED 在会睡眠的控制器上时由 ldev->led_work 写出去.
+ */
+enum key_gesture_state {
+    GESTURE_IDLE,
+    GESTURE_PRESSED,            // 第一次按下, 等 long_ms 或松开
+    GESTURE_HELD,               // 已报告 LONG, 按住连发
+    GESTURE_WAIT_SECOND,        // 短按松开, 等 double_ms 内的第二次按下
+    GESTURE_SECOND,             // 已报告 DOUBLE, 等松开
+};
+
+struct ledkey_key {
+    struct ledkey_dev *ldev;
+    unsigned int index;
+    const char *name;
+    struct gpio_desc *key_gpio;
+    struct gpio_desc *led_gpio;
+    int irq;
+    bool sleeps;                // 按键线会睡眠, 只在中断线程里读
+    spinlock_t lock;            // 硬中断和 hrtimer 回调可能在不同CPU上
+    struct hrtimer timer;
+    bool sample_timer;          // sleeps: 定时器到期, key->work 采样并决定是否续上
+    struct work_struct work;    // sleeps: 定时器的后半部分, 也代替 irq_wake_thread 唤醒读者
+    bool debouncing;            // 定时器在用: 消抖窗口或轮询
+    bool polling;               // 中断已关, 定时器轮询中
+    int pressed;                // 已生效的按键状态
+    int reported;               // 线程里最后报告过的状态
+    unsigned long bounces;      // 窗口内被吞掉的边沿
+    u64 window_start;           // 中断频率统计窗口的开始时间
+    unsigned int window_irqs;
+    unsigned int quiet_polls;   // 轮询时电平连续不变的次数
+    unsigned long storms;       // 进入轮询的次数
+    unsigned long mode_switches;    // 中断<->轮询切换次数
+    struct ledkey_rule rule;    // 由 lock 保护
+    struct hrtimer act_timer;   // PULSE 熄灭, BLINK 翻转
+    bool act_running;           // act_timer 的动作还有效, 规则改掉或松开后清零
+    enum key_gesture_state gesture;
+    struct hrtimer gesture_timer;
+    u64 edge_ns;                // 最近一次生效的边沿的时间, 给中断线程算延迟
+    u64 action_ns;              // 最近一次执行完规则(写完LED)的时间
+    struct drvcore_hist *lat_led;       // 硬中断入口 -> LED 写完
+    struct drvcore_hist *lat_thread;    // 边沿 -> 中断线程开始执行
+};
+
+/*
+ * 打开的文件在解绑之后还可能读/poll/ioctl, 所以这个结构不用 devm 分配, 而是引用计数:
+ * probe 持有一个(由 devm 动作释放), 每个打开的文件持有一个. gone 置位之后文件操作
+ * 不再碰按键和LED, 它们的 GPIO/中断已经随设备释放.
+ */
+struct ledkey_dev {
+    struct kref ref;
+    struct device *dev;
+    struct mutex lock;          // 保护 gone, ioctl 在它里面改规则
+    bool gone;                  // 设备已经解绑
+    struct miscdevice miscdev;
+    spinlock_t clients_lock;    // 在 key->lock 里面取
+    struct list_head clients;
+    wait_queue_head_t wait;     // 所有读者共用
+    atomic_t overflows;         // 所有读者的队列丢弃的事件数
+    spinlock_t led_lock;        // 多个按键可能驱动同一个LED, 在 key->lock 里面取
+    u64 led_state;              // 第 n 位是第 n 个LED的当前值
+    struct drvcore_gpio_array *leds;    // 按控制器分组的LED输出, 由 led_lock 保护
+    u64 led_dirty;              // LED 会睡眠时还没写出去的LED, 由 led_lock 保护
+    struct work_struct led_work;        // 把 led_dirty 写出去, 工作项不会并发执行
+    struct dentry *debugfs;
+    unsigned int nkeys;
+    struct ledkey_key keys[];
+};
+
+/*
+ * 把 mask 选中的LED设为 value(toggle 时翻转), 只写电平真正变化的GPIO, 每个bank一次写.
+ * LED 会睡眠时只记下变化, 由 led_work 写出去.
+ */
+static void leds_update(struct ledkey_dev *ldev, u64 mask, u64 value, bool toggle)
+{
+    unsigned long flags;
+    bool queue = false;
+    u64 old;
+
+    spin_lock_irqsave(&ldev->led_lock, flags);
+    old = ldev->led_state;
+    if (toggle)
+        ldev->led_state ^= mask;
+    else
+        ldev->led_state = (old & ~mask) | (value & mask);
+    if (!drvcore_gpio_array_can_sleep(ldev->leds)) {
+        drvcore_gpio_array_set(ldev->leds, old ^ ldev->led_state, ldev->led_state);
+    } else if (old != ldev->led_state) {
+        ldev->led_dirty |= old ^ ldev->led_state;
+        queue = true;
+    }
+    spin_unlock_irqrestore(&ldev->led_lock, flags);
+
+    if (queue)
+        schedule_work(&ldev->led_work);
+}
+
+static void leds_work(struct work_struct *work)
+{
+    struct ledkey_dev *ldev = container_of(work, struct ledkey_dev, led_work);
+    u64 mask, state;
+
+    spin_lock_irq(&ldev->led_lock);
+    mask = ldev->led_dirty;
+    state = ldev->led_state;
+    ldev->led_dirty = 0;
+    spin_unlock_irq(&ldev->led_lock);
+
+    if (mask)
+        drvcore_gpio_array_set(ldev->leds, mask, state);
+}
+
+static ktime_t key_act_period(struct ledkey_key *key)
+{
+    return ns_to_ktime((u64)key->rule.period_us * NSEC_PER_USEC);
+}
+
+// 按键状态生效后执行规则. 调用者持有 key->lock
+static void key_action(struct ledkey_key *key, int pressed)
+{
+    struct ledkey_dev *ldev = key->ldev;
+    u64 leds = key->rule.leds;
+
+    switch (key->rule.action) {
+    case LEDKEY_ACT_MOMENTARY:
+        leds_update(ldev, leds, pressed ? leds : 0, false);
+        break;
+    case LEDKEY_ACT_TOGGLE:
+        if (pressed)
+            leds_update(ldev, leds, 0, true);
+        break;
+    case LEDKEY_ACT_PULSE:
+        if (!pressed)
+            break;
+        leds_update(ldev, leds, leds, false);
+        key->act_running = true;
+        hrtimer_start(&key->act_timer, key_act_period(key), HRTIMER_MODE_REL);
+        break;
+    case LEDKEY_ACT_BLINK:
+        key->act_running = pressed;
+        leds_update(ldev, leds, pressed ? leds : 0, false);
+        if (pressed)
+            hrtimer_start(&key->act_timer, key_act_period(key), HRTIMER_MODE_REL);
+        else
+            hrtimer_try_to_cancel(&key->act_timer);
+        break;
+    }
+}
+
+/*
+ * 脉冲结束或闪烁翻转. 规则被替换或按键已松开时 act_running 为假, 什么也不做;
+ * 等锁期间又被 hrtimer_start 重新排队(比如脉冲里又按了一次)时, 这次到期作废.
+ */
+static enum hrtimer_restart key_act_timer(struct hrtimer *timer)
+{
+    struct ledkey_key *key = container_of(timer, struct ledkey_key, act_timer);
+    enum hrtimer_restart ret = HRTIMER_NORESTART;
+
+    spin_lock(&key->lock);
+    if (key->act_running && !hrtimer_is_queued(timer)) {
+        if (key->rule.action == LEDKEY_ACT_BLINK) {
+            leds_update(key->ldev, key->rule.leds, 0, true);
+            hrtimer_forward_now(timer, key_act_period(key));
+            ret = HRTIMER_RESTART;
+        } else {
+            leds_update(key->ldev, key->rule.leds, 0, false);
+            key->act_running = false;
+        }
+    }
+    spin_unlock(&key->lock);
+    return ret;
+}
+
+// 把事件放进订阅了 type 的每个读者的队列, 返回是否有读者订阅
+static bool key_report(struct ledkey_key *key, u64 now, u32 type, u32 state)
+{
+    struct ledkey_dev *ldev = key->ldev;
+    struct ledkey_client *client;
+    struct ledkey_event ev;
+    unsigned long flags;
+    bool reported = false;
+
+    ev.timestamp_ns = now;
+    ev.key = key->index;
+    ev.state = state;
+
+    spin_lock_irqsave(&ldev->clients_lock, flags);
+    list_for_each_entry(client, &ldev->clients, node) {
+        if (!(READ_ONCE(client->events) & type))
+            continue;
+        if (!drvcore_mpsc_push(&client->queue, &ev))
+            atomic_inc(&ldev->overflows);
+        reported = true;
+    }
+    spin_unlock_irqrestore(&ldev->clients_lock, flags);
+    return reported;
+}
+
+// 唤醒有事件可读的读者, band 是给 SIGIO 的 POLL_IN/POLL_HUP
+static void ledkey_notify(struct ledkey_dev *ldev, int band)
+{
+    struct ledkey_client *client;
+    bool wake = false;
+
+    spin_lock_irq(&ldev->clients_lock);
+    list_for_each_entry(client, &ldev->clients, node) {
+        if (band == POLL_IN && drvcore_mpsc_empty(&client->queue))
+            continue;
+        kill_fasync(&client->async_queue, SIGIO, band);
+        wake = true;
+    }
+    spin_unlock_irq(&ldev->clients_lock);
+
+    if (wake)
+        wake_up_interruptible(&ldev->wait);
+}
+
+/*
+ * 定时器里产生了事件, 让读者知道. 会睡眠的按键的中断线程每次运行都当作一次中断,
+ * 不能借它, 改用 key->work.
+ */
+static void key_wake(struct ledkey_key *key)
+{
+    if (key->sleeps)
+        schedule_work(&key->work);
+    else
+        irq_wake_thread(key->irq, key);
+}
+
+static void key_gesture_arm(struct ledkey_key *key, unsigned int ms)
+{
+    hrtimer_start(&key->gesture_timer, ms_to_ktime(ms), HRTIMER_MODE_REL);
+}
+
+/*
+ * 手势状态机的按下/松开输入, 调用者持有 key->lock. 超时转移在 key_gesture_timer 里.
+ * 这里报告的手势随边沿一起由中断线程通知读者.
+ */
+static void key_gesture_edge(struct ledkey_key *key, int pressed, u64 now)
+{
+    switch (key->gesture) {
+    case GESTURE_IDLE:
+        if (pressed) {
+            key->gesture = GESTURE_PRESSED;
+            key_gesture_arm(key, long_ms);
+        }
+        break;
+    case GESTURE_PRESSED:
+        if (pressed)
+            break;
+        if (double_ms) {
+            key->gesture = GESTURE_WAIT_SECOND;
+            key_gesture_arm(key, double_ms);
+        } else {
+            key->gesture = GESTURE_IDLE;
+            hrtimer_try_to_cancel(&key->gesture_timer);
+            key_report(key, now, LEDKEY_EV_GESTURE, LEDKEY_STATE_SHORT);
+        }
+        break;
+    case GESTURE_WAIT_SECOND:
+        if (!pressed)
+            break;
+        key->gesture = GESTURE_SECOND;
+        hrtimer_try_to_cancel(&key->gesture_timer);
+        key_report(key, now, LEDKEY_EV_GESTURE, LEDKEY_STATE_DOUBLE);
+        break;
+    case GESTURE_HELD:
+    case GESTURE_SECOND:
+        if (!pressed) {
+            key->gesture = GESTURE_IDLE;
+            hrtimer_try_to_cancel(&key->gesture_timer);
+        }
+        break;
+    }
+}
+
+/*
+ * 手势超时: 按住到 long_ms 报告 LONG, 之后连发 REPEAT; 等第二次按下超时报告 SHORT.
+ * 和 act_timer 一样, 等锁期间被重新排队或状态已经转走的到期直接作废.
+ */
+static enum hrtimer_restart key_gesture_timer(struct hrtimer *timer)
+{
+    struct ledkey_key *key = container_of(timer, struct ledkey_key, gesture_timer);
+    enum hrtimer_restart ret = HRTIMER_NORESTART;
+    u64 now = ktime_get_ns();
+    bool reported = false;
+
+    spin_lock(&key->lock);
+    if (hrtimer_is_queued(timer))
+        goto out;
+
+    switch (key->gesture) {
+    case GESTURE_PRESSED:
+        key->gesture = GESTURE_HELD;
+        reported = key_report(key, now, LEDKEY_EV_GESTURE, LEDKEY_STATE_LONG);
+        if (repeat_ms) {
+            hrtimer_forward_now(timer, ms_to_ktime(repeat_ms));
+            ret = HRTIMER_RESTART;
+        }
+        break;
+    case GESTURE_HELD:
+        reported = key_report(key, now, LEDKEY_EV_GESTURE, LEDKEY_STATE_REPEAT);
+        if (repeat_ms) {
+            hrtimer_forward_now(timer, ms_to_ktime(repeat_ms));
+            ret = HRTIMER_RESTART;
+        }
+        break;
+    case GESTURE_WAIT_SECOND:
+        key->gesture = GESTURE_IDLE;
+        reported = key_report(key, now, LEDKEY_EV_GESTURE, LEDKEY_STATE_SHORT);
+        break;
+    default:
+        break;
+    }
+out:
+    spin_unlock(&key->lock);
+
+    if (reported)
+        key_wake(key);
+    return ret;
+}
+
+/*
+ * 用读到的按键电平 pressed 更新状态, 变化时执行按键规则, 记录边沿事件并推进手势状态机.
+ * 调用者持有 key->lock, now 是中断入口或定时器到期的时间.
+ */
+static bool key_sample(struct ledkey_key *key, int pressed, u64 now)
+{
+    if (pressed == key->pressed)
+        return false;
+    key->pressed = pressed;
+    key_action(key, pressed);
+    key->edge_ns = now;
+    key->action_ns = ktime_get_ns();
 
-static int key1_irq, key2_irq;
+    key_report(key, now, LEDKEY_EV_EDGE, pressed);
+    key_gesture_edge(key, pressed, now);
+    return true;
+}
+
+static ktime_t key_poll_period(void)
+{
+    return ms_to_ktime(max(poll_ms, 1U));
+}
 
-// 中断处理函数
-static irqreturn_t key_isr(int irq, void *dev_id)
+static ktime_t key_debounce_period(void)
 {
-    if (irq == key1_irq) {
-        int key_state = gpio_get_value(KEY1_GPIO);
-        gpio_set_value(LED1_GPIO, key_state); // 按键按下(0)时输出0点亮LED
-        printk(KERN_INFO "KEY1 %s, LED1 %s\n",
-               key_state ? "released" : "pressed",
-               key_state ? "OFF" : "ON");
+    return ns_to_ktime((u64)debounce_us * NSEC_PER_USEC);
+}
+
+// 统计当前窗口里的中断数, 超过阈值返回 true. 调用者持有 key->lock
+static bool key_storm(struct ledkey_key *key, u64 now)
+{
+    if (!storm_threshold)
+        return false;
+    if (now - key->window_start >= STORM_WINDOW_NS) {
+        key->window_start = now;
+        key->window_irqs = 0;
     }
-    else if (irq == key2_irq) {
-        int key_state = gpio_get_value(KEY2_GPIO);
-        gpio_set_value(LED2_GPIO, key_state);
-        printk(KERN_INFO "KEY2 %s, LED2 %s\n",
-               key_state ? "released" : "pressed",
-               key_state ? "OFF" : "ON");
+    return ++key->window_irqs > max(storm_threshold / 10, 1U);
+}
+
+/*
+ * 一次按键中断: 统计频率, 风暴时转入轮询; 消抖窗口里只计数; 否则用读到的电平
+ * pressed 做前沿采样并开窗口. 调用者持有 key->lock, 返回状态是否变了.
+ */
+static bool key_irq_edge(struct ledkey_key *key, int pressed, u64 now)
+{
+    bool changed = false;
+
+    if (key_storm(key, now)) {
+        // 在自己的处理函数里只能用 nosync; 定时器在用的话它到期后会转入轮询
+        disable_irq_nosync(key->irq);
+        key->polling = true;
+        key->quiet_polls = 0;
+        key->storms++;
+        key->mode_switches++;
+        if (!key->debouncing) {
+            key->debouncing = true;
+            hrtimer_start(&key->timer, key_poll_period(), HRTIMER_MODE_REL);
+        }
+    } else if (key->debouncing) {
+        key->bounces++;
+    } else {
+        changed = key_sample(key, pressed, now);
+        if (changed)
+            drvcore_hist_add(key->lat_led, key->action_ns - now);
+        key->debouncing = true;
+        hrtimer_start(&key->timer, key_debounce_period(), HRTIMER_MODE_REL);
+    }
+    return changed;
+}
+
+// 硬中断上半部: 只做采样, 开窗口, 把报告推给线程
+static irqreturn_t key_hardirq(int irq, void *dev_id)
+{
+    struct ledkey_key *key = dev_id;
+    u64 now = ktime_get_ns();
+    int pressed = gpiod_get_value(key->key_gpio);
+    bool changed;
+
+    spin_lock(&key->lock);
+    changed = key_irq_edge(key, pressed, now);
+    spin_unlock(&key->lock);
+
+    return changed ? IRQ_WAKE_THREAD : IRQ_HANDLED;
+}
+
+/*
+ * 消抖窗口结束: 电平还在变就再生效一次并续一个窗口, 否则回到空闲.
+ * 轮询模式: 按 poll_ms 采样, 稳定够 quiet_ms 后重新打开中断(*enable 置位).
+ * 返回定时器是否要续上, 间隔在 *next. 调用者持有 key->lock.
+ */
+static bool key_debounce_expire(struct ledkey_key *key, int pressed, u64 now,
+                                bool *changed, bool *enable, ktime_t *next)
+{
+    *changed = key_sample(key, pressed, now);
+    if (key->polling) {
+        key->quiet_polls = *changed ? 0 : key->quiet_polls + 1;
+        if (key->quiet_polls * max(poll_ms, 1U) >= quiet_ms) {
+            key->polling = false;
+            key->debouncing = false;
+            key->mode_switches++;
+            key->window_start = now;
+            key->window_irqs = 0;
+            *enable = true;
+            return false;
+        }
+        *next = key_poll_period();
+        return true;
+    }
+    if (*changed) {
+        *next = key_debounce_period();
+        return true;
+    }
+    key->debouncing = false;
+    return false;
+}
+
+static enum hrtimer_restart key_debounce_timer(struct hrtimer *timer)
+{
+    struct ledkey_key *key = container_of(timer, struct ledkey_key, timer);
+    enum hrtimer_restart ret = HRTIMER_NORESTART;
+    u64 now = ktime_get_ns();
+    bool changed = false, enable = false;
+    ktime_t next;
+
+    spin_lock(&key->lock);
+    if (key->sleeps) {
+        // 读线会睡眠, 采样和续定时器都在 key->work 里
+        key->sample_timer = true;
+    } else if (key_debounce_expire(key, gpiod_get_value(key->key_gpio), now,
+                                   &changed, &enable, &next)) {
+        hrtimer_forward_now(timer, next);
+        ret = HRTIMER_RESTART;
     }
+    spin_unlock(&key->lock);
+
+    if (enable)
+        enable_irq(key->irq);
+    if (key->sleeps)
+        schedule_work(&key->work);
+    else if (changed)
+        irq_wake_thread(key->irq, key);
+    return ret;
+}
+
+// 中断线程: 慢的事情放在这里, 不占硬中断时间. 事件已经在硬中断里入队, 这里通知读者
+static irqreturn_t key_thread(int irq, void *dev_id)
+{
+    struct ledkey_key *key = dev_id;
+    u64 now = ktime_get_ns();
+    bool changed;
+    int pressed;
+
+    // 只订阅手势的读者在大部分边沿收不到事件, 不要白白唤醒它们
+    ledkey_notify(key->ldev, POLL_IN);
+
+    spin_lock_irq(&key->lock);
+    pressed = key->pressed;
+    changed = pressed != key->reported;
+    key->reported = pressed;
+    if (changed)
+        drvcore_hist_add(key->lat_thread, now - key->edge_ns);
+    spin_unlock_irq(&key->lock);
+
+    if (changed)
+        dev_dbg(key->ldev->dev, "%s %s, bounces %lu\n", key->name,
+                pressed ? "pressed" : "released", key->bounces);
     return IRQ_HANDLED;
 }
 
-static int __init ledkey_init(void)
+/*
+ * 按键线会睡眠时的中断处理, 只有线程(嵌套在 I2C 扩展芯片中断线程里时也只调用它):
+ * 读线, 然后做硬中断和中断线程的事. IRQF_ONESHOT 让中断在这里返回前保持屏蔽.
+ */
+static irqreturn_t key_sleep_irq(int irq, void *dev_id)
+{
+    struct ledkey_key *key = dev_id;
+    u64 now = ktime_get_ns();
+    int pressed = gpiod_get_value_cansleep(key->key_gpio);
+
+    spin_lock_irq(&key->lock);
+    key_irq_edge(key, pressed, now);
+    spin_unlock_irq(&key->lock);
+
+    return key_thread(irq, dev_id);
+}
+
+/*
+ * 按键线会睡眠时定时器的后半部分: 到期时采样(先读线再拿锁), 决定是否续上定时器,
+ * 然后唤醒读者. 设备解绑中(gone)不再采样, 否则 remove 取消的定时器会被这里重新启动.
+ */
+static void key_work(struct work_struct *work)
 {
+    struct ledkey_key *key = container_of(work, struct ledkey_key, work);
+    bool sample, changed, enable = false;
+    ktime_t next;
+    int pressed;
+    u64 now;
+
+    spin_lock_irq(&key->lock);
+    sample = key->sample_timer && !READ_ONCE(key->ldev->gone);
+    key->sample_timer = false;
+    spin_unlock_irq(&key->lock);
+
+    // 定时器停着, 读线期间不会有新的 sample_timer
+    if (sample) {
+        pressed = gpiod_get_value_cansleep(key->key_gpio);
+        now = ktime_get_ns();
+        spin_lock_irq(&key->lock);
+        if (key_debounce_expire(key, pressed, now, &changed, &enable, &next))
+            hrtimer_start(&key->timer, next, HRTIMER_MODE_REL);
+        spin_unlock_irq(&key->lock);
+    }
+
+    if (enable)
+        enable_irq(key->irq);
+    key_thread(key->irq, key);
+}
+
+static int ledkey_fasync(int fd, struct file *file, int mode)
+{
+    struct ledkey_client *client = file->private_data;
+
+    return fasync_helper(fd, file, mode, &client->async_queue);
+}
+
+static void ledkey_free(struct kref *ref)
+{
+    struct ledkey_dev *ldev = container_of(ref, struct ledkey_dev, ref);
+
+    kfree(ldev);
+}
+
+static void ledkey_put(void *data)
+{
+    struct ledkey_dev *ldev = data;
+
+    kref_put(&ldev->ref, ledkey_free);
+}
+
+/*
+ * misc_open 持有 misc_mtx 调用这里, misc_deregister 之后不会再有新的打开.
+ * 新读者默认只订阅原始边沿, 只收到打开之后的事件.
+ */
+static int ledkey_open(struct inode *inode, struct file *file)
+{
+    struct ledkey_dev *ldev = container_of(file->private_data, struct ledkey_dev, miscdev);
+    struct ledkey_client *client;
     int ret;
-    
-    printk(KERN_INFO "Initializing %s (Press-to-light)\n", DRIVER_NAME);
-    
-    // 初始化LED GPIO（默认熄灭）
-    gpio_request(LED1_GPIO, "LED1");
-    gpio_direction_output(LED1_GPIO, 1); // 初始高电平=熄灭
-    
-    gpio_request(LED2_GPIO, "LED2");
-    gpio_direction_output(LED2_GPIO, 1);
-    
-    // 初始化按键GPIO
-    gpio_request(KEY1_GPIO, "KEY1");
-    gpio_direction_input(KEY1_GPIO);
-    
-    gpio_request(KEY2_GPIO, "KEY2");
-    gpio_direction_input(KEY2_GPIO);
-    
-    // 申请中断（双边沿触发）
-    key1_irq = gpio_to_irq(KEY1_GPIO);
-    ret = request_irq(key1_irq, key_isr, 
-                     IRQF_TRIGGER_FALLING | IRQF_TRIGGER_RISING,
-                     "key1_irq", NULL);
-    
-    key2_irq = gpio_to_irq(KEY2_GPIO);
-    ret = request_irq(key2_irq, key_isr,
-                     IRQF_TRIGGER_FALLING | IRQF_TRIGGER_RISING,
-                     "key2_irq", NULL);
-    
-    printk(KERN_INFO "%s ready: Hold keys to light LEDs\n", DRIVER_NAME);
+
+    client = kzalloc(sizeof(*client), GFP_KERNEL);
+    if (!client)
+        return -ENOMEM;
+    ret = drvcore_mpsc_init(&client->queue, LEDKEY_RING_SIZE, sizeof(struct ledkey_event));
+    if (ret) {
+        kfree(client);
+        return ret;
+    }
+    client->ldev = ldev;
+    client->events = LEDKEY_EV_EDGE;
+    mutex_init(&client->read_lock);
+
+    kref_get(&ldev->ref);
+    spin_lock_irq(&ldev->clients_lock);
+    list_add_tail(&client->node, &ldev->clients);
+    spin_unlock_irq(&ldev->clients_lock);
+    file->private_data = client;
+    return 0;
+}
+
+static int ledkey_release(struct inode *inode, struct file *file)
+{
+    struct ledkey_client *client = file->private_data;
+    struct ledkey_dev *ldev = client->ldev;
+
+    ledkey_fasync(-1, file, 0);
+    // 摘下之后生产者不会再碰这个队列
+    spin_lock_irq(&ldev->clients_lock);
+    list_del(&client->node);
+    spin_unlock_irq(&ldev->clients_lock);
+    drvcore_mpsc_free(&client->queue);
+    kfree(client);
+    ledkey_put(ldev);
     return 0;
 }
 
-static void __exit ledkey_exit(void)
+// 读事件: 尽量多地返回整条记录, 没有事件时等待. 设备解绑后读完剩下的事件返回 -ENODEV
+static ssize_t ledkey_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+    struct ledkey_client *client = file->private_data;
+    struct ledkey_dev *ldev = client->ldev;
+    struct ledkey_event evs[16];
+    size_t n, max, done = 0;
+    int ret = 0;
+
+    if (count < sizeof(evs[0]))
+        return -EINVAL;
+
+    for (;;) {
+        if (mutex_lock_interruptible(&client->read_lock))
+            return -ERESTARTSYS;
+        if (!drvcore_mpsc_empty(&client->queue))
+            break;
+        mutex_unlock(&client->read_lock);
+
+        if (READ_ONCE(ldev->gone))
+            return -ENODEV;
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        ret = wait_event_interruptible(ldev->wait, !drvcore_mpsc_empty(&client->queue) ||
+                                       READ_ONCE(ldev->gone));
+        if (ret)
+            return ret;
+    }
+
+    while (count - done >= sizeof(evs[0])) {
+        max = min(ARRAY_SIZE(evs), (count - done) / sizeof(evs[0]));
+        for (n = 0; n < max && drvcore_mpsc_pop(&client->queue, &evs[n]); n++)
+            ;
+        if (!n)
+            break;
+        if (copy_to_user(buf + done, evs, n * sizeof(evs[0]))) {
+            ret = -EFAULT;
+            break;
+        }
+        done += n * sizeof(evs[0]);
+    }
+    mutex_unlock(&client->read_lock);
+    return done ? done : ret;
+}
+
+static int ledkey_check_rule(struct ledkey_dev *ldev, const struct ledkey_rule *rule)
+{
+    if (rule->key >= ldev->nkeys || rule->pad)
+        return -EINVAL;
+    if (ldev->nkeys < 64 && (rule->leds >> ldev->nkeys))
+        return -EINVAL;
+
+    switch (rule->action) {
+    case LEDKEY_ACT_MOMENTARY:
+    case LEDKEY_ACT_TOGGLE:
+        return 0;
+    case LEDKEY_ACT_PULSE:
+    case LEDKEY_ACT_BLINK:
+        if (rule->period_us < LEDKEY_MIN_PERIOD_US || rule->period_us > LEDKEY_MAX_PERIOD_US)
+            return -EINVAL;
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
+/*
+ * 替换规则: 旧规则驱动的LED熄灭, 正在进行的脉冲/闪烁作废. 新规则是 MOMENTARY
+ * 并且按键正按着时马上生效, 其它动作等下一次按下.
+ */
+static void ledkey_set_rule(struct ledkey_dev *ldev, const struct ledkey_rule *rule)
+{
+    struct ledkey_key *key = &ldev->keys[rule->key];
+
+    spin_lock_irq(&key->lock);
+    key->act_running = false;
+    hrtimer_try_to_cancel(&key->act_timer);
+    leds_update(ldev, key->rule.leds, 0, false);
+    key->rule = *rule;
+    if (rule->action == LEDKEY_ACT_MOMENTARY && key->pressed)
+        key_action(key, 1);
+    spin_unlock_irq(&key->lock);
+}
+
+static long ledkey_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct ledkey_client *client = file->private_data;
+    struct ledkey_dev *ldev = client->ldev;
+    void __user *argp = (void __user *)arg;
+    struct ledkey_rule rule;
+    struct ledkey_key *key;
+    u32 events;
+    int ret;
+
+    switch (cmd) {
+    case LEDKEY_IOC_SET_RULE:
+        if (copy_from_user(&rule, argp, sizeof(rule)))
+            return -EFAULT;
+        ret = ledkey_check_rule(ldev, &rule);
+        if (ret)
+            return ret;
+        // 改规则会写LED, 启动定时器, 解绑之后不能再做
+        mutex_lock(&ldev->lock);
+        if (ldev->gone)
+            ret = -ENODEV;
+        else
+            ledkey_set_rule(ldev, &rule);
+        mutex_unlock(&ldev->lock);
+        return ret;
+
+    case LEDKEY_IOC_GET_RULE:
+        if (copy_from_user(&rule, argp, sizeof(rule)))
+            return -EFAULT;
+        if (rule.key >= ldev->nkeys)
+            return -EINVAL;
+        key = &ldev->keys[rule.key];
+        spin_lock_irq(&key->lock);
+        rule = key->rule;
+        spin_unlock_irq(&key->lock);
+        if (copy_to_user(argp, &rule, sizeof(rule)))
+            return -EFAULT;
+        return 0;
+
+    case LEDKEY_IOC_SET_EVENTS:
+        if (get_user(events, (u32 __user *)argp))
+            return -EFAULT;
+        if (events & ~(LEDKEY_EV_EDGE | LEDKEY_EV_GESTURE))
+            return -EINVAL;
+        // 只影响这个文件, 已经在队列里的事件照常读出
+        WRITE_ONCE(client->events, events);
+        return 0;
+
+    default:
+        return -ENOTTY;
+    }
+}
+
+static unsigned int ledkey_poll(struct file *file, poll_table *wait)
+{
+    struct ledkey_client *client = file->private_data;
+    struct ledkey_dev *ldev = client->ldev;
+    unsigned int mask = 0;
+
+    poll_wait(file, &ldev->wait, wait);
+    if (!drvcore_mpsc_empty(&client->queue))
+        mask |= POLLIN | POLLRDNORM;
+    if (READ_ONCE(ldev->gone))
+        mask |= POLLHUP | POLLERR;
+    return mask;
+}
+
+static const struct file_operations ledkey_fops = {
+    .owner = THIS_MODULE,
+    .open = ledkey_open,
+    .read = ledkey_read,
+    .poll = ledkey_poll,
+    .unlocked_ioctl = ledkey_ioctl,
+    .fasync = ledkey_fasync,
+    .release = ledkey_release,
+    .llseek = no_llseek,
+};
+
+// misc 核心把 miscdevice 设为它的 drvdata
+static ssize_t overflows_show(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    free_irq(key1_irq, NULL);
-    free_irq(key2_irq, NULL);
-    
-    gpio_set_value(LED1_GPIO, 1); // 退出时熄灭LED
-    gpio_set_value(LED2_GPIO, 1);
-    
-    gpio_free(LED1_GPIO);
-    gpio_free(LED2_GPIO);
-    gpio_free(KEY1_GPIO);
-    gpio_free(KEY2_GPIO);
-    
-    printk(KERN_INFO "%s removed\n", DRIVER_NAME);
+    struct ledkey_dev *ldev = container_of(dev_get_drvdata(dev), struct ledkey_dev, miscdev);
+
+    return sprintf(buf, "%u\n", atomic_read(&ldev->overflows));
 }
+static DEVICE_ATTR_RO(overflows);
+
+// 每个按键一行: 模式, 风暴次数, 切换次数, 被消抖吞掉的边沿
+static ssize_t key_stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ledkey_dev *ldev = container_of(dev_get_drvdata(dev), struct ledkey_dev, miscdev);
+    struct ledkey_key *key;
+    ssize_t count = 0;
+    unsigned int i;
+
+    for (i = 0; i < ldev->nkeys; i++) {
+        key = &ldev->keys[i];
+        spin_lock_irq(&key->lock);
+        count += scnprintf(buf + count, PAGE_SIZE - count,
+                           "%s: mode=%s storms=%lu switches=%lu bounces=%lu\n",
+                           key->name, key->polling ? "poll" : "irq", key->storms,
+                           key->mode_switches, key->bounces);
+        spin_unlock_irq(&key->lock);
+    }
+    return count;
+}
+static DEVICE_ATTR_RO(key_stats);
+
+static const char * const ledkey_action_names[] = {
+    [LEDKEY_ACT_MOMENTARY] = "momentary",
+    [LEDKEY_ACT_TOGGLE] = "toggle",
+    [LEDKEY_ACT_PULSE] = "pulse",
+    [LEDKEY_ACT_BLINK] = "blink",
+};
+
+// 每个按键一行当前规则, 修改用 LEDKEY_IOC_SET_RULE
+static ssize_t rules_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ledkey_dev *ldev = container_of(dev_get_drvdata(dev), struct ledkey_dev, miscdev);
+    struct ledkey_rule rule;
+    ssize_t count = 0;
+    unsigned int i;
+
+    for (i = 0; i < ldev->nkeys; i++) {
+        spin_lock_irq(&ldev->keys[i].lock);
+        rule = ldev->keys[i].rule;
+        spin_unlock_irq(&ldev->keys[i].lock);
+        count += scnprintf(buf + count, PAGE_SIZE - count, "%s: %s leds=0x%llx period_us=%u\n",
+                           ldev->keys[i].name, ledkey_action_names[rule.action],
+                           (unsigned long long)rule.leds, rule.period_us);
+    }
+    return count;
+}
+static DEVICE_ATTR_RO(rules);
+
+static struct attribute *ledkey_attrs[] = {
+    &dev_attr_overflows.attr,
+    &dev_attr_key_stats.attr,
+    &dev_attr_rules.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(ledkey);
+
+/*
+ * debugfs: /sys/kernel/debug/ledkey/latency, 每个按键两行:
+ * led 是硬中断入口到LED写完(消抖/轮询定时器里的边沿不算; LED 会睡眠时是到写LED
+ * 的工作排上队; 按键线会睡眠时从中断线程开始算),
+ * thread 是边沿到中断线程开始执行. 写任意内容清零.
+ */
+static int ledkey_latency_show(struct seq_file *s, void *unused)
+{
+    struct ledkey_dev *ldev = s->private;
+    struct drvcore_hist_snap *snap;
+    struct ledkey_key *key;
+    char label[48];
+    unsigned int i;
+
+    snap = kmalloc(sizeof(*snap), GFP_KERNEL);
+    if (!snap)
+        return -ENOMEM;
+
+    for (i = 0; i < ldev->nkeys; i++) {
+        key = &ldev->keys[i];
+        drvcore_hist_snapshot(key->lat_led, snap);
+        snprintf(label, sizeof(label), "%s led", key->name);
+        drvcore_hist_show(s, label, snap);
+        drvcore_hist_snapshot(key->lat_thread, snap);
+        snprintf(label, sizeof(label), "%s thread", key->name);
+        drvcore_hist_show(s, label, snap);
+    }
+
+    kfree(snap);
+    return 0;
+}
+
+static int ledkey_latency_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, ledkey_latency_show, inode->i_private);
+}
+
+static ssize_t ledkey_latency_write(struct file *file, const char __user *buf,
+                                    size_t count, loff_t *ppos)
+{
+    struct ledkey_dev *ldev = ((struct seq_file *)file->private_data)->private;
+    struct ledkey_key *key;
+    unsigned int i;
+
+    for (i = 0; i < ldev->nkeys; i++) {
+        key = &ldev->keys[i];
+        drvcore_hist_reset(key->lat_led);
+        drvcore_hist_reset(key->lat_thread);
+    }
+    return count;
+}
+
+static const struct file_operations ledkey_latency_fops = {
+    .owner = THIS_MODULE,
+    .open = ledkey_latency_open,
+    .read = seq_read,
+    .write = ledkey_latency_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+// debugfs 是可选的, 没有它设备照常工作(第二个 ledkey 设备也没有)
+static void ledkey_debugfs_init(struct ledkey_dev *ldev)
+{
+    ldev->debugfs = debugfs_create_dir("ledkey", NULL);
+    if (IS_ERR_OR_NULL(ldev->debugfs))
+        return;
+    debugfs_create_file("latency", S_IRUGO | S_IWUSR, ldev->debugfs, ldev,
+                        &ledkey_latency_fops);
+}
+
+// 从一个子节点初始化一对按键/LED, GPIO 由 devm 管理, 出错时自动释放
+static int ledkey_init_key(struct ledkey_dev *ldev, struct ledkey_key *key,
+                           struct fwnode_handle *child)
+{
+    struct device *dev = ldev->dev;
+    int ret;
+
+    key->ldev = ldev;
+    spin_lock_init(&key->lock);
+    drvcore_hrtimer_setup(&key->timer, key_debounce_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    drvcore_hrtimer_setup(&key->act_timer, key_act_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    drvcore_hrtimer_setup(&key->gesture_timer, key_gesture_timer, CLOCK_MONOTONIC,
+                          HRTIMER_MODE_REL);
+    key->rule.key = key->index;
+    key->rule.action = LEDKEY_ACT_MOMENTARY;
+    key->rule.leds = 1ULL << key->index;
+
+    if (fwnode_property_read_string(child, "label", &key->name))
+        key->name = devm_kasprintf(dev, GFP_KERNEL, "KEY%u", key->index + 1);
+    if (!key->name)
+        return -ENOMEM;
+
+    key->lat_led = devm_drvcore_hist_alloc(dev);
+    key->lat_thread = devm_drvcore_hist_alloc(dev);
+    if (!key->lat_led || !key->lat_thread)
+        return -ENOMEM;
+
+    key->led_gpio = devm_get_gpiod_from_child(dev, "led", child);
+    if (IS_ERR(key->led_gpio)) {
+        ret = PTR_ERR(key->led_gpio);
+        if (ret != -EPROBE_DEFER)
+            dev_err(dev, "%s: failed to get led-gpios: %d\n", key->name, ret);
+        return ret;
+    }
+    // 初始熄灭
+    ret = gpiod_direction_output(key->led_gpio, 0);
+    if (ret)
+        return ret;
+
+    key->key_gpio = devm_get_gpiod_from_child(dev, "key", child);
+    if (IS_ERR(key->key_gpio)) {
+        ret = PTR_ERR(key->key_gpio);
+        if (ret != -EPROBE_DEFER)
+            dev_err(dev, "%s: failed to get key-gpios: %d\n", key->name, ret);
+        return ret;
+    }
+    ret = gpiod_direction_input(key->key_gpio);
+    if (ret)
+        return ret;
+    key->sleeps = gpiod_cansleep(key->key_gpio);
+    INIT_WORK(&key->work, key_work);
+
+    key->irq = gpiod_to_irq(key->key_gpio);
+    if (key->irq < 0) {
+        dev_err(dev, "%s: no irq for key gpio: %d\n", key->name, key->irq);
+        return key->irq;
+    }
+    return 0;
+}
+
+// 中断处理要用 ldev->leds, 所以所有按键初始化完、LED组建好之后才申请中断
+static int ledkey_request_irq(struct ledkey_key *key)
+{
+    struct device *dev = key->ldev->dev;
+    int ret;
+
+    // 申请中断（双边沿触发）, dev_id 是这一对按键/LED自己的上下文
+    if (key->sleeps)
+        ret = devm_request_threaded_irq(dev, key->irq, NULL, key_sleep_irq,
+                                        IRQF_TRIGGER_FALLING | IRQF_TRIGGER_RISING |
+                                        IRQF_ONESHOT, key->name, key);
+    else
+        ret = devm_request_threaded_irq(dev, key->irq, key_hardirq, key_thread,
+                                        IRQF_TRIGGER_FALLING | IRQF_TRIGGER_RISING,
+                                        key->name, key);
+    if (ret)
+        dev_err(dev, "%s: request irq %d failed: %d\n", key->name, key->irq, ret);
+    return ret;
+}
+
+static int ledkey_probe(struct platform_device *pdev)
+{
+    struct device *dev = &pdev->dev;
+    struct fwnode_handle *child;
+    struct ledkey_dev *ldev;
+    struct gpio_desc **led_gpios;
+    unsigned int nkeys, i = 0;
+    int ret;
+
+    nkeys = device_get_child_node_count(dev);
+    if (!nkeys) {
+        dev_err(dev, "no key/led pairs in device tree\n");
+        return -ENODEV;
+    }
+    if (nkeys > LEDKEY_MAX_KEYS) {
+        dev_err(dev, "too many key/led pairs: %u, max %u\n", nkeys, LEDKEY_MAX_KEYS);
+        return -EINVAL;
+    }
+
+    // 打开的文件可能比设备活得久, 见 struct ledkey_dev
+    ldev = kzalloc(sizeof(*ldev) + nkeys * sizeof(ldev->keys[0]), GFP_KERNEL);
+    if (!ldev)
+        return -ENOMEM;
+    kref_init(&ldev->ref);
+    ret = devm_add_action_or_reset(dev, ledkey_put, ldev);
+    if (ret)
+        return ret;
+    ldev->dev = dev;
+    ldev->nkeys = nkeys;
+    mutex_init(&ldev->lock);
+    spin_lock_init(&ldev->led_lock);
+    INIT_WORK(&ldev->led_work, leds_work);
+    spin_lock_init(&ldev->clients_lock);
+    INIT_LIST_HEAD(&ldev->clients);
+    init_waitqueue_head(&ldev->wait);
+    platform_set_drvdata(pdev, ldev);
+
+    device_for_each_child_node(dev, child) {
+        ldev->keys[i].index = i;
+        ret = ledkey_init_key(ldev, &ldev->keys[i], child);
+        if (ret) {
+            fwnode_handle_put(child);
+            return ret;
+        }
+        i++;
+    }
+
+    // 组建时会拷贝一份描述符, 临时数组用完就释放
+    led_gpios = kcalloc(nkeys, sizeof(*led_gpios), GFP_KERNEL);
+    if (!led_gpios)
+        return -ENOMEM;
+    for (i = 0; i < nkeys; i++)
+        led_gpios[i] = ldev->keys[i].led_gpio;
+    ldev->leds = devm_drvcore_gpio_array_create(dev, led_gpios, nkeys);
+    kfree(led_gpios);
+    if (IS_ERR(ldev->leds)) {
+        dev_err(dev, "failed to set up led gpio array: %ld\n", PTR_ERR(ldev->leds));
+        return PTR_ERR(ldev->leds);
+    }
+
+    for (i = 0; i < nkeys; i++) {
+        ret = ledkey_request_irq(&ldev->keys[i]);
+        if (ret)
+            goto fail_keys;
+    }
+
+    // 事件设备 /dev/ledkey
+    ldev->miscdev.minor = MISC_DYNAMIC_MINOR;
+    ldev->miscdev.name = "ledkey";
+    ldev->miscdev.fops = &ledkey_fops;
+    ldev->miscdev.parent = dev;
+    ldev->miscdev.groups = ledkey_groups;
+    ret = misc_register(&ldev->miscdev);
+    if (ret) {
+        dev_err(dev, "misc_register failed: %d\n", ret);
+        goto fail_keys;
+    }
+
+    ledkey_debugfs_init(ldev);
+    dev_info(dev, "%s ready: %u key/LED pairs\n", DRIVER_NAME, nkeys);
+    return 0;
+
+fail_keys:
+    // 已经申请的中断可能已经触发过, 定时器和工作项要在 devm 释放GPIO前停掉
+    ldev->gone = true;
+    while (i-- > 0) {
+        disable_irq(ldev->keys[i].irq);
+        hrtimer_cancel(&ldev->keys[i].timer);
+        hrtimer_cancel(&ldev->keys[i].act_timer);
+        hrtimer_cancel(&ldev->keys[i].gesture_timer);
+        cancel_work_sync(&ldev->keys[i].work);
+    }
+    cancel_work_sync(&ldev->led_work);
+    return ret;
+}
+
+static int ledkey_remove(struct platform_device *pdev)
+{
+    struct ledkey_dev *ldev = platform_get_drvdata(pdev);
+    unsigned int i;
+
+    debugfs_remove_recursive(ldev->debugfs);
+    // 先不让新的文件打开, 再让已经打开的文件不再碰硬件, 在等事件的读者返回 -ENODEV
+    misc_deregister(&ldev->miscdev);
+    mutex_lock(&ldev->lock);
+    ldev->gone = true;
+    mutex_unlock(&ldev->lock);
+    ledkey_notify(ldev, POLL_HUP);
+
+    // 中断由 devm 在之后释放, 先关掉它们, 再停掉定时器
+    for (i = 0; i < ldev->nkeys; i++) {
+        disable_irq(ldev->keys[i].irq);
+        hrtimer_cancel(&ldev->keys[i].timer);
+        hrtimer_cancel(&ldev->keys[i].act_timer);
+        hrtimer_cancel(&ldev->keys[i].gesture_timer);
+        cancel_work_sync(&ldev->keys[i].work);
+    }
+    cancel_work_sync(&ldev->led_work);
+    // 退出时熄灭LED
+    for (i = 0; i < ldev->nkeys; i++)
+        gpiod_set_value_cansleep(ldev->keys[i].led_gpio, 0);
+    // ldev 本身由 probe 注册的 devm 动作放掉引用, 最后一个文件关闭时才释放
+    return 0;
+}
+DRVCORE_PLATFORM_REMOVE(ledkey_remove);
+
+static struct platform_driver ledkey_driver = {
+    .driver = {
+        .name = "ledkey",
+        .owner = THIS_MODULE,
+        .of_match_table = of_match_ptr(ledkey_of_match),
+    },
+    .probe = ledkey_probe,
+    .remove = drvcore_remove_fn(ledkey_remove),
+};
 
-module_init(ledkey_init);
-module_exit(ledkey_exit);
+module_platform_driver(ledkey_driver);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("JIU");
@@ -0,0 +1,76 @@
+/*
+ * /dev/ledkey 事件格式, 驱动和用户空间程序共用
+ */
+
+#ifndef _LEDKEY_H
+#define _LEDKEY_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * read() 返回整数个 struct ledkey_event, 缓冲区放不下一个时返回 EINVAL.
+ * 没有事件时阻塞, O_NONBLOCK 时返回 EAGAIN; 支持 poll 和 fasync (SIGIO).
+ * 每个打开的文件有自己的事件队列, 收到打开之后的全部(订阅的)事件.
+ * 读者来不及读时新事件被丢弃, 所有读者的丢弃数在 /sys/class/misc/ledkey/overflows.
+ */
+struct ledkey_event {
+    __u64 timestamp_ns;     /* CLOCK_MONOTONIC, 在中断入口(或定时器)采样 */
+    __u32 key;              /* 按键编号, 从0开始 */
+    __u32 state;            /* LEDKEY_STATE_* */
+};
+
+/* 原始边沿 */
+#define LEDKEY_STATE_RELEASED   0
+#define LEDKEY_STATE_PRESSED    1
+/*
+ * 手势, 由内核里的状态机识别, 阈值是模块参数 long_ms, double_ms, repeat_ms:
+ * SHORT 按下不到 long_ms 就松开, 并且 double_ms 内没有第二次按下;
+ * DOUBLE 松开后 double_ms 内再次按下(在第二次按下时报告);
+ * LONG 按住到 long_ms; 之后每 repeat_ms 报告一次 REPEAT, 直到松开.
+ */
+#define LEDKEY_STATE_SHORT      2
+#define LEDKEY_STATE_LONG       3
+#define LEDKEY_STATE_DOUBLE     4
+#define LEDKEY_STATE_REPEAT     5
+
+/*
+ * 读者收到哪些事件, 每个打开的文件用 LEDKEY_IOC_SET_EVENTS 各自设置, 默认只有原始边沿.
+ * 只要手势时应用每个手势只被唤醒一次, 而不是每个边沿一次.
+ */
+#define LEDKEY_EV_EDGE          0x1
+#define LEDKEY_EV_GESTURE       0x2
+
+/*
+ * 按键动作规则: 每个按键对应一条规则, 在中断/定时器里直接驱动LED, 不经过用户空间.
+ * LED 按设备树子节点顺序编号(和按键编号相同), leds 的第 n 位选中第 n 个LED,
+ * 一个按键可以驱动多个LED, 多个按键也可以驱动同一个LED. 默认规则是每个按键
+ * MOMENTARY 驱动自己那一对的LED.
+ */
+#define LEDKEY_MAX_KEYS         64
+
+#define LEDKEY_ACT_MOMENTARY    0   /* LED 跟随按键: 按下亮, 松开灭 */
+#define LEDKEY_ACT_TOGGLE       1   /* 每次按下翻转 */
+#define LEDKEY_ACT_PULSE        2   /* 按下后亮 period_us, 期间再按重新计时 */
+#define LEDKEY_ACT_BLINK        3   /* 按住时每 period_us 翻转一次, 松开熄灭 */
+
+#define LEDKEY_MIN_PERIOD_US    1000
+#define LEDKEY_MAX_PERIOD_US    10000000
+
+struct ledkey_rule {
+    __u32 key;
+    __u32 action;               /* LEDKEY_ACT_* */
+    __u64 leds;                 /* 0 表示按键不驱动任何LED */
+    __u32 period_us;            /* PULSE/BLINK 用, LEDKEY_MIN_PERIOD_US..LEDKEY_MAX_PERIOD_US */
+    __u32 pad;
+};
+
+#define LEDKEY_IOC_MAGIC        'k'
+/* 替换一个按键的规则, 旧规则驱动的LED先熄灭 */
+#define LEDKEY_IOC_SET_RULE     _IOW(LEDKEY_IOC_MAGIC, 1, struct ledkey_rule)
+/* 读取 key 指定的按键的规则 */
+#define LEDKEY_IOC_GET_RULE     _IOWR(LEDKEY_IOC_MAGIC, 2, struct ledkey_rule)
+/* LEDKEY_EV_* 的组合, 只对发出 ioctl 的这个打开的文件有效 */
+#define LEDKEY_IOC_SET_EVENTS   _IOW(LEDKEY_IOC_MAGIC, 3, __u32)
+
+#endif /* _LEDKEY_H */
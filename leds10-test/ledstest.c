@@ -1,229 +1,813 @@
 #include <linux/module.h>
 #include <linux/fs.h>
-#include <linux/gpio.h>
-#include <linux/cdev.h>
 #include <linux/device.h>
 #include <linux/uaccess.h>
 #include <linux/slab.h>
+#include <linux/platform_device.h>
+#include <linux/miscdevice.h>
+#include <linux/of_device.h>
+#include <linux/gpio/consumer.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/leds.h>
+#include <linux/of.h>
+#include <linux/workqueue.h>
+#include <linux/kref.h>
 
-#define LED1_GPIO 131  // GPIO5_IO03
-#define LED2_GPIO 3    // GPIO1_IO03
-#define LED3_GPIO 5    // GPIO1_IO05
-#define LED4_GPIO 6    // GPIO1_IO06
+#include "ledstest.h"
+#include "ledstest_cmd.h"
+#include "drvcore.h"
+#include "drvcore_compat.h"
 
 #define DEVICE_NAME "led_control"
-#define CLASS_NAME  "led_class"
 
-static dev_t dev_num;              // 设备号
-static struct cdev led_cdev;       // 字符设备结构
-static struct class *led_class;    // 设备类
-static struct device *led_device;  // 设备
+/*
+ * 设备树示例, LED 按 led-gpios 的顺序编号为 LED1, LED2, ...
+ *
+ *     led-control {
+ *         compatible = "led-control";
+ *         led-gpios = <&gpio5 3 GPIO_ACTIVE_LOW>,
+ *                     <&gpio1 3 GPIO_ACTIVE_LOW>,
+ *                     <&gpio1 5 GPIO_ACTIVE_LOW>,
+ *                     <&gpio1 6 GPIO_ACTIVE_LOW>;
+ *         led-names = "led1", "led2", "led3", "led4";              // 可选
+ *         linux,default-triggers = "heartbeat", "mmc0", "", "";    // 可选
+ *     };
+ *
+ * 每个LED同时注册成 LED class 设备 /sys/class/leds/<名字>, 没给 led-names 时名字是
+ * "led_control:N". 内核触发器(heartbeat, 磁盘, netdev, timer...)直接驱动GPIO,
+ * /dev/led_control 仍用于批量访问.
+ */
+static const struct of_device_id led_of_match[] = {
+    { .compatible = "led-control" },
+    {},
+};
+MODULE_DEVICE_TABLE(of, led_of_match);
+
+// 图案引擎状态, lock 同时被 hrtimer 回调(硬中断上下文)使用
+struct led_pattern_engine {
+    spinlock_t lock;
+    struct mutex upload;         // 串行化上传/停止
+    struct hrtimer timer;
+    struct led_step *steps;
+    unsigned int nsteps;
+    unsigned int flags;
+    unsigned int pwm_period_us;
+    int cur;                     // 当前步骤, -1 表示第一步之前
+    bool pwm_on;                 // 处于PWM周期中输出 value 的部分
+    ktime_t step_end;
+    struct led_pattern_stats stats;
+};
+
+// mmap 状态页的周期刷新
+struct led_refresh {
+    struct mutex lock;           // 串行化 LED_IOC_REFRESH
+    struct hrtimer timer;
+    ktime_t period;
+    unsigned int hz;             // 0 表示未开启
+    struct led_frame *page;      // 映射给用户空间的那一页
+    u64 shown;                   // 上一次从页面写出的帧, 只在定时器里改
+};
+
+/*
+ * 打开的文件在解绑之后还可能读/poll/ioctl/mmap, 所以这个结构不用 devm 分配, 而是引用计数:
+ * probe 持有一个(由 devm 动作释放), 每个打开的文件持有一个. gone 置位之后文件操作
+ * 不再碰GPIO和定时器, led_apply() 也只更新状态.
+ */
+struct led_ctrl {
+    struct kref ref;
+    struct device *dev;
+    bool gone;                   // 设备已经解绑, 在 pattern.upload, refresh.lock 和 apply_lock 里写
+    struct miscdevice miscdev;
+    struct gpio_descs *gpios;    // 设备树顺序, LED(n+1) 是 gpios->desc[n]
+    unsigned int nleds;
+    u64 all;                     // 所有LED的掩码
+    struct drvcore_gpio_array *out;  // 按GPIO控制器分组的输出, 编号同 gpios
+    spinlock_t apply_lock;       // 串行化 out 的暂存数组, 也让并发的多LED更新互不穿插
+    u64 state;                   // 当前所有LED的值, apply_lock 保护
+    u64 dirty;                   // 会睡眠的GPIO上还没写出去的LED, apply_lock 保护
+    struct mutex flush_lock;     // 会睡眠时串行化 out 的暂存数组
+    struct work_struct flush_work;
+    u32 seq;                     // state 每变一次加一, apply_lock 保护
+    wait_queue_head_t wait;      // 有LED变化时唤醒读者
+    struct fasync_struct *async_queue;
+    struct led_pattern_engine pattern;
+    struct led_refresh refresh;
+    struct led_chan *chans;
+};
+
+// LED class 设备, 每个LED一个
+struct led_chan {
+    struct led_classdev cdev;
+    struct led_ctrl *ctrl;
+    unsigned int index;
+};
+
+// 每个打开的文件
+struct led_file {
+    struct led_ctrl *ctrl;
+    u32 seen;                    // 该fd上次读到的 seq
+};
+
+/*
+ * 把 dirty 的LED按当前状态写到会睡眠的GPIO上. 工作队列和进程上下文都会调用,
+ * 两次调用之间多次改动只写最后的值.
+ */
+static void led_flush(struct led_ctrl *ctrl) {
+    unsigned long flags;
+    u64 mask, state;
+
+    mutex_lock(&ctrl->flush_lock);
+    spin_lock_irqsave(&ctrl->apply_lock, flags);
+    mask = ctrl->dirty;
+    state = ctrl->state;
+    ctrl->dirty = 0;
+    spin_unlock_irqrestore(&ctrl->apply_lock, flags);
+    if (mask)
+        drvcore_gpio_array_set(ctrl->out, mask, state);
+    mutex_unlock(&ctrl->flush_lock);
+}
+
+static void led_flush_work(struct work_struct *work) {
+    led_flush(container_of(work, struct led_ctrl, flush_work));
+}
+
+/*
+ * 把 mask 选中的LED设为 value 中对应位的值. drvcore_gpio_array_set() 对每个GPIO控制器
+ * 只做一次 set_multiple, 即每个bank一次寄存器写. 可以在硬中断里调用, GPIO 会睡眠
+ * (I2C扩展芯片, gpio-sim)时只更新状态, 由 flush_work 写出去.
+ */
+static void led_apply(struct led_ctrl *ctrl, u64 mask, u64 value) {
+    bool sleeps = drvcore_gpio_array_can_sleep(ctrl->out);
+    unsigned long flags;
+    bool changed;
+    u64 old;
+
+    spin_lock_irqsave(&ctrl->apply_lock, flags);
+    if (ctrl->gone)
+        sleeps = false;
+    else if (sleeps)
+        ctrl->dirty |= mask;
+    else
+        drvcore_gpio_array_set(ctrl->out, mask, value);
+    old = ctrl->state;
+    ctrl->state = (ctrl->state & ~mask) | (value & mask);
+    changed = ctrl->state != old;
+    if (changed)
+        ctrl->seq++;
+    spin_unlock_irqrestore(&ctrl->apply_lock, flags);
+
+    if (sleeps && mask)
+        schedule_work(&ctrl->flush_work);
+
+    // 可能在硬中断上下文(图案引擎/刷新定时器), 没有观察者时不碰等待队列的锁
+    if (changed) {
+        smp_mb();    // seq 的更新先于 waitqueue_active(), 与 wait_event 配对
+        if (waitqueue_active(&ctrl->wait))
+            wake_up_interruptible(&ctrl->wait);
+        kill_fasync(&ctrl->async_queue, SIGIO, POLL_IN);
+    }
+}
+
+// 进程上下文用: 会睡眠的GPIO也在返回前写完, 用户读线上电平时已经是新值
+static void led_apply_sync(struct led_ctrl *ctrl, u64 mask, u64 value) {
+    led_apply(ctrl, mask, value);
+    if (drvcore_gpio_array_can_sleep(ctrl->out))
+        led_flush(ctrl);
+}
+
+static u64 led_state(struct led_ctrl *ctrl) {
+    unsigned long flags;
+    u64 state;
+
+    spin_lock_irqsave(&ctrl->apply_lock, flags);
+    state = ctrl->state;
+    spin_unlock_irqrestore(&ctrl->apply_lock, flags);
+    return state;
+}
+
+// 触发器可能在软中断/硬中断里调用, led_apply() 不会睡眠
+static void led_chan_set(struct led_classdev *cdev, enum led_brightness value) {
+    struct led_chan *chan = container_of(cdev, struct led_chan, cdev);
+
+    led_apply(chan->ctrl, 1ULL << chan->index, value ? ~0ULL : 0);
+}
+
+// 返回实际状态, 其他接口改过的LED在 sysfs 里也能看到
+static enum led_brightness led_chan_get(struct led_classdev *cdev) {
+    struct led_chan *chan = container_of(cdev, struct led_chan, cdev);
+
+    return (led_state(chan->ctrl) >> chan->index) & 1 ? LED_FULL : LED_OFF;
+}
+
+static int led_register_chans(struct led_ctrl *ctrl) {
+    struct device_node *np = ctrl->dev->of_node;
+    struct led_chan *chan;
+    const char *name;
+    unsigned int i;
+    int ret;
+
+    ctrl->chans = devm_kcalloc(ctrl->dev, ctrl->nleds, sizeof(*ctrl->chans), GFP_KERNEL);
+    if (!ctrl->chans)
+        return -ENOMEM;
+
+    for (i = 0; i < ctrl->nleds; i++) {
+        chan = &ctrl->chans[i];
+        chan->ctrl = ctrl;
+        chan->index = i;
+
+        if (of_property_read_string_index(np, "led-names", i, &name))
+            name = devm_kasprintf(ctrl->dev, GFP_KERNEL, DEVICE_NAME ":%u", i + 1);
+        if (!name)
+            return -ENOMEM;
+        chan->cdev.name = name;
+        if (!of_property_read_string_index(np, "linux,default-triggers", i, &name) && name[0])
+            chan->cdev.default_trigger = name;
+        chan->cdev.max_brightness = 1;
+        chan->cdev.brightness = (ctrl->state >> i) & 1;
+        chan->cdev.brightness_set = led_chan_set;
+        chan->cdev.brightness_get = led_chan_get;
+
+        ret = devm_led_classdev_register(ctrl->dev, &chan->cdev);
+        if (ret) {
+            dev_err(ctrl->dev, "Failed to register LED %s: %d\n", chan->cdev.name, ret);
+            return ret;
+        }
+    }
+    return 0;
+}
+
+static int led_fasync(int fd, struct file *file, int mode) {
+    struct led_file *lf = file->private_data;
 
-// 打开设备
+    return fasync_helper(fd, file, mode, &lf->ctrl->async_queue);
+}
+
+static void led_ctrl_free(struct kref *ref) {
+    struct led_ctrl *ctrl = container_of(ref, struct led_ctrl, ref);
+
+    // 还映射着的状态页由映射自己持有引用
+    free_page((unsigned long)ctrl->refresh.page);
+    kfree(ctrl->pattern.steps);
+    kfree(ctrl);
+}
+
+static void led_ctrl_put(void *data) {
+    struct led_ctrl *ctrl = data;
+
+    kref_put(&ctrl->ref, led_ctrl_free);
+}
+
+/*
+ * 打开设备: misc 核心把 private_data 设成了 miscdevice, 换成每个fd自己的状态.
+ * misc_open 持有 misc_mtx 调用这里, misc_deregister 之后不会再有新的打开.
+ */
 static int led_open(struct inode *inode, struct file *file) {
-    printk(KERN_INFO "LED device opened\n");
+    struct led_ctrl *ctrl = container_of(file->private_data, struct led_ctrl, miscdev);
+    struct led_file *lf;
+
+    lf = kzalloc(sizeof(*lf), GFP_KERNEL);
+    if (!lf)
+        return -ENOMEM;
+    kref_get(&ctrl->ref);
+    lf->ctrl = ctrl;
+    // 让第一次读立即返回当前状态
+    lf->seen = READ_ONCE(ctrl->seq) - 1;
+    file->private_data = lf;
     return 0;
 }
 
-// 关闭设备
 static int led_release(struct inode *inode, struct file *file) {
-    printk(KERN_INFO "LED device closed\n");
+    struct led_file *lf = file->private_data;
+
+    led_fasync(-1, file, 0);
+    led_ctrl_put(lf->ctrl);
+    kfree(lf);
     return 0;
 }
 
-// 写入设备 - 处理用户空间的控制命令
-static ssize_t led_write(struct file *file, const char __user *buf, 
-                         size_t count, loff_t *ppos) {
-    char *cmd;
-    int led_num, value;
-    
-    // 分配内存存储用户空间的数据
-    cmd = kmalloc(count + 1, GFP_KERNEL);
-    if (!cmd) {
-        return -ENOMEM;
+static bool led_changed(struct led_file *lf) {
+    return READ_ONCE(lf->ctrl->seq) != lf->seen;
+}
+
+// 读设备 - 返回所有LED的快照, 没有新变化时等待
+static ssize_t led_read(struct file *file, char __user *buf,
+                        size_t count, loff_t *ppos) {
+    struct led_file *lf = file->private_data;
+    struct led_ctrl *ctrl = lf->ctrl;
+    struct led_status st;
+    unsigned long flags;
+    int ret;
+
+    if (count < sizeof(st))
+        return -EINVAL;
+
+    if (!led_changed(lf)) {
+        if (READ_ONCE(ctrl->gone))
+            return -ENODEV;
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        ret = wait_event_interruptible(ctrl->wait, led_changed(lf) || READ_ONCE(ctrl->gone));
+        if (ret)
+            return ret;
+        if (!led_changed(lf))
+            return -ENODEV;
     }
-    
-    // 将数据从用户空间复制到内核空间
-    if (copy_from_user(cmd, buf, count)) {
-        kfree(cmd);
+
+    spin_lock_irqsave(&ctrl->apply_lock, flags);
+    st.state = ctrl->state;
+    st.seq = ctrl->seq;
+    spin_unlock_irqrestore(&ctrl->apply_lock, flags);
+    st.nleds = ctrl->nleds;
+    lf->seen = st.seq;
+
+    if (copy_to_user(buf, &st, sizeof(st)))
         return -EFAULT;
-    }
-    cmd[count] = '\0';  // 添加字符串结束符
-    
-    // 解析命令格式: "ledX Y" 其中X是1-4, Y是0或1
-    if (sscanf(cmd, "led%d %d", &led_num, &value) != 2) {
-        printk(KERN_ERR "Invalid command! Use: echo 'ledX Y' > /dev/led_control (X=1-4, Y=0-1)\n");
-        kfree(cmd);
+    return sizeof(st);
+}
+
+static unsigned int led_poll(struct file *file, poll_table *wait) {
+    struct led_file *lf = file->private_data;
+    unsigned int mask = POLLOUT | POLLWRNORM;
+
+    poll_wait(file, &lf->ctrl->wait, wait);
+    if (READ_ONCE(lf->ctrl->gone))
+        return POLLHUP | POLLERR;
+    if (led_changed(lf))
+        mask |= POLLIN | POLLRDNORM;
+    return mask;
+}
+
+/*
+ * 写入设备 - 处理用户空间的文本命令 "ledX Y", X 从1开始, Y 是0或1.
+ * 和最初的驱动一样, Y 是引脚的物理电平(板子上的LED低有效, 0 = 亮), 已有的脚本不用改.
+ * ioctl, mmap 和 LED class 接口用逻辑值(1 = 亮).
+ */
+static ssize_t led_write(struct file *file, const char __user *buf,
+                         size_t count, loff_t *ppos) {
+    struct led_file *lf = file->private_data;
+    struct led_ctrl *ctrl = lf->ctrl;
+    char cmd[32];
+    unsigned int led_num;
+    int value;
+
+    if (READ_ONCE(ctrl->gone))
+        return -ENODEV;
+
+    // 命令很短, 用栈上的缓冲区, 多余的部分忽略
+    if (copy_from_user(cmd, buf, min(count, sizeof(cmd) - 1)))
+        return -EFAULT;
+    cmd[min(count, sizeof(cmd) - 1)] = '\0';
+
+    // 解析并验证LED编号和值
+    switch (led_parse_cmd(cmd, ctrl->nleds, &led_num, &value)) {
+    case 0:
+        break;
+    case -ERANGE:
+        dev_err(ctrl->dev, "Invalid LED number! Use 1-%u\n", ctrl->nleds);
         return count;
-    }
-    
-    // 验证LED编号和值
-    if (led_num < 1 || led_num > 4) {
-        printk(KERN_ERR "Invalid LED number! Use 1-4\n");
-        kfree(cmd);
+    case -EDOM:
+        dev_err(ctrl->dev, "Invalid value! Use 0 or 1\n");
         return count;
-    }
-    
-    if (value != 0 && value != 1) {
-        printk(KERN_ERR "Invalid value! Use 0 or 1\n");
-        kfree(cmd);
+    default:
+        dev_err(ctrl->dev, "Invalid command! Use: echo 'ledX Y' > /dev/led_control (X=1-%u, Y=0-1)\n",
+                ctrl->nleds);
         return count;
     }
-    
-    // 根据命令控制相应的LED
-    switch (led_num) {
-        case 1:
-            gpio_set_value(LED1_GPIO, value);
-            printk(KERN_INFO "LED1 set to %d\n", value);
-            break;
-        case 2:
-            gpio_set_value(LED2_GPIO, value);
-            printk(KERN_INFO "LED2 set to %d\n", value);
-            break;
-        case 3:
-            gpio_set_value(LED3_GPIO, value);
-            printk(KERN_INFO "LED3 set to %d\n", value);
-            break;
-        case 4:
-            gpio_set_value(LED4_GPIO, value);
-            printk(KERN_INFO "LED4 set to %d\n", value);
-            break;
-    }
-    
-    kfree(cmd);
+
+    // 物理电平换成逻辑值, 低有效的LED要反相
+    if (gpiod_is_active_low(ctrl->gpios->desc[led_num - 1]))
+        value = !value;
+    led_apply_sync(ctrl, 1ULL << (led_num - 1), value ? ~0ULL : 0);
     return count;
 }
 
+/*
+ * LED_IOC_SET: 一次系统调用更新 mask 选中的所有LED. 热路径上没有内存分配和打印.
+ */
+static int led_ioc_set(struct led_ctrl *ctrl, void __user *argp) {
+    struct led_batch batch;
+
+    if (copy_from_user(&batch, argp, sizeof(batch)))
+        return -EFAULT;
+    if (batch.mask & ~ctrl->all)
+        return -EINVAL;
+
+    led_apply_sync(ctrl, batch.mask, batch.value);
+    return 0;
+}
+
+// 进入下一步, 图案结束(且不循环)时返回 false
+static bool led_pattern_next(struct led_pattern_engine *pat) {
+    if (++pat->cur < pat->nsteps)
+        return true;
+    pat->stats.loops++;
+    if (!(pat->flags & LED_PATTERN_LOOP))
+        return false;
+    pat->cur = 0;
+    return true;
+}
+
+/*
+ * 每次触发处理一个边沿: 步骤开始, 或者步骤内PWM的开/关切换. 下一次触发时刻由
+ * 本次的预定时刻推算, 不会累积漂移; 如果它已经过去(回调迟到太多), 记一次 overrun
+ * 并把整个时间轴顺延到现在, 而不是连续补触发.
+ */
+static enum hrtimer_restart led_pattern_timer(struct hrtimer *timer) {
+    struct led_ctrl *ctrl = container_of(timer, struct led_ctrl, pattern.timer);
+    struct led_pattern_engine *pat = &ctrl->pattern;
+    ktime_t now = hrtimer_cb_get_time(timer);
+    ktime_t t = hrtimer_get_expires(timer);
+    struct led_pattern_stats *st = &pat->stats;
+    struct led_step *step;
+    unsigned int on_us;
+    ktime_t next;
+    s64 late;
+
+    spin_lock(&pat->lock);
+    if (!st->running)
+        goto stop;
+
+    late = ktime_to_ns(ktime_sub(now, t));
+    if (late < 0)
+        late = 0;
+    st->expiries++;
+    st->total_late_ns += late;
+    if (late > st->max_late_ns)
+        st->max_late_ns = late;
+
+    if (ktime_compare(t, pat->step_end) >= 0) {
+        if (!led_pattern_next(pat)) {
+            st->running = 0;
+            goto stop;
+        }
+        step = &pat->steps[pat->cur];
+        pat->step_end = ktime_add_us(t, step->duration_us);
+        pat->pwm_on = true;
+        st->steps++;
+    } else {
+        step = &pat->steps[pat->cur];
+        pat->pwm_on = !pat->pwm_on;
+    }
+
+    if (!pat->pwm_period_us || step->duty == LED_DUTY_MAX || !step->duty) {
+        led_apply(ctrl, step->mask, step->duty ? step->value : ~step->value);
+        next = pat->step_end;
+    } else {
+        // 截断到0的开/关段会让定时器立即再触发, 见 LED_PWM_MIN_PHASE_US
+        on_us = clamp_t(unsigned int, pat->pwm_period_us * step->duty / LED_DUTY_MAX,
+                        LED_PWM_MIN_PHASE_US, pat->pwm_period_us - LED_PWM_MIN_PHASE_US);
+        if (pat->pwm_on) {
+            led_apply(ctrl, step->mask, step->value);
+            next = ktime_add_us(t, on_us);
+        } else {
+            led_apply(ctrl, step->mask, ~step->value);
+            next = ktime_add_us(t, pat->pwm_period_us - on_us);
+        }
+        if (ktime_compare(next, pat->step_end) > 0)
+            next = pat->step_end;
+    }
+
+    if (ktime_compare(next, now) <= 0) {
+        st->overruns++;
+        pat->step_end = ktime_add(pat->step_end, ktime_sub(now, t));
+        next = ktime_add(next, ktime_sub(now, t));
+    }
+    hrtimer_set_expires(timer, next);
+    spin_unlock(&pat->lock);
+    return HRTIMER_RESTART;
+
+stop:
+    spin_unlock(&pat->lock);
+    return HRTIMER_NORESTART;
+}
+
+static void led_pattern_stop(struct led_pattern_engine *pat) {
+    unsigned long flags;
+
+    // 回调会拿 lock, 必须在锁外取消
+    hrtimer_cancel(&pat->timer);
+    spin_lock_irqsave(&pat->lock, flags);
+    pat->stats.running = 0;
+    spin_unlock_irqrestore(&pat->lock, flags);
+}
+
+static int led_ioc_pattern(struct led_ctrl *ctrl, void __user *argp) {
+    struct led_pattern_engine *pat = &ctrl->pattern;
+    struct led_pattern req;
+    struct led_step *steps, *old;
+    unsigned long flags;
+    unsigned int i;
+    ktime_t now;
+
+    // 最短的周期也要放得下开和关两段
+    BUILD_BUG_ON(LED_PWM_MIN_PERIOD_US < 2 * LED_PWM_MIN_PHASE_US);
+
+    if (copy_from_user(&req, argp, sizeof(req)))
+        return -EFAULT;
+    if (!req.nsteps || req.nsteps > LED_PATTERN_MAX_STEPS || req.flags & ~LED_PATTERN_LOOP)
+        return -EINVAL;
+    if (req.pwm_period_us &&
+        (req.pwm_period_us < LED_PWM_MIN_PERIOD_US || req.pwm_period_us > LED_PWM_MAX_PERIOD_US))
+        return -EINVAL;
+
+    steps = memdup_user((void __user *)(unsigned long)req.steps, req.nsteps * sizeof(*steps));
+    if (IS_ERR(steps))
+        return PTR_ERR(steps);
+    for (i = 0; i < req.nsteps; i++) {
+        if (!steps[i].duration_us || steps[i].mask & ~ctrl->all) {
+            kfree(steps);
+            return -EINVAL;
+        }
+    }
+
+    mutex_lock(&pat->upload);
+    // 解绑之后不能再启动定时器
+    if (ctrl->gone) {
+        mutex_unlock(&pat->upload);
+        kfree(steps);
+        return -ENODEV;
+    }
+    led_pattern_stop(pat);
+
+    spin_lock_irqsave(&pat->lock, flags);
+    old = pat->steps;
+    pat->steps = steps;
+    pat->nsteps = req.nsteps;
+    pat->flags = req.flags;
+    pat->pwm_period_us = req.pwm_period_us;
+    pat->cur = -1;
+    now = ktime_get();
+    pat->step_end = now;
+    memset(&pat->stats, 0, sizeof(pat->stats));
+    pat->stats.running = 1;
+    spin_unlock_irqrestore(&pat->lock, flags);
+
+    hrtimer_start(&pat->timer, now, HRTIMER_MODE_ABS);
+    mutex_unlock(&pat->upload);
+
+    kfree(old);
+    return 0;
+}
+
+static int led_ioc_pattern_stats(struct led_ctrl *ctrl, void __user *argp) {
+    struct led_pattern_stats st;
+    unsigned long flags;
+
+    spin_lock_irqsave(&ctrl->pattern.lock, flags);
+    st = ctrl->pattern.stats;
+    spin_unlock_irqrestore(&ctrl->pattern.lock, flags);
+
+    if (copy_to_user(argp, &st, sizeof(st)))
+        return -EFAULT;
+    return 0;
+}
+
+// 把状态页的一帧写到GPIO, 只下发变化的LED, 没有变化的bank不碰
+static enum hrtimer_restart led_refresh_timer(struct hrtimer *timer) {
+    struct led_ctrl *ctrl = container_of(timer, struct led_ctrl, refresh.timer);
+    struct led_refresh *rf = &ctrl->refresh;
+    u64 frame = 0, changed;
+    unsigned int i;
+
+    for (i = 0; i < ctrl->nleds; i++)
+        if (READ_ONCE(rf->page->led[i]))
+            frame |= 1ULL << i;
+
+    changed = frame ^ rf->shown;
+    if (changed) {
+        led_apply(ctrl, changed, frame);
+        rf->shown = frame;
+    }
+
+    hrtimer_forward_now(timer, rf->period);
+    return HRTIMER_RESTART;
+}
+
+static int led_ioc_refresh(struct led_ctrl *ctrl, void __user *argp) {
+    struct led_refresh *rf = &ctrl->refresh;
+    unsigned int i;
+    u32 hz;
+    u64 state;
+
+    if (get_user(hz, (__u32 __user *)argp))
+        return -EFAULT;
+    if (hz > LED_REFRESH_MAX_HZ)
+        return -EINVAL;
+
+    mutex_lock(&rf->lock);
+    if (ctrl->gone) {
+        mutex_unlock(&rf->lock);
+        return -ENODEV;
+    }
+    hrtimer_cancel(&rf->timer);
+    if (hz) {
+        // 刚开启时让页面和当前LED一致, 第一帧不会把LED改掉
+        if (!rf->hz) {
+            state = led_state(ctrl);
+            for (i = 0; i < ctrl->nleds; i++)
+                rf->page->led[i] = (state >> i) & 1;
+            rf->shown = state;
+        }
+        rf->period = ns_to_ktime(NSEC_PER_SEC / hz);
+        hrtimer_start(&rf->timer, rf->period, HRTIMER_MODE_REL);
+    }
+    rf->hz = hz;
+    mutex_unlock(&rf->lock);
+    return 0;
+}
+
+static int led_mmap(struct file *file, struct vm_area_struct *vma) {
+    struct led_file *lf = file->private_data;
+    struct led_ctrl *ctrl = lf->ctrl;
+
+    if (READ_ONCE(ctrl->gone))
+        return -ENODEV;
+    if (vma->vm_pgoff || vma->vm_end - vma->vm_start > PAGE_SIZE)
+        return -EINVAL;
+
+    vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+    return vm_insert_page(vma, vma->vm_start, virt_to_page(ctrl->refresh.page));
+}
+
+static long led_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+    struct led_file *lf = file->private_data;
+    struct led_ctrl *ctrl = lf->ctrl;
+    void __user *argp = (void __user *)arg;
+
+    // 改LED的命令在 gone 之后由 led_apply() 丢掉, 启动定时器的命令在各自的锁里再查一次
+    if (READ_ONCE(ctrl->gone))
+        return -ENODEV;
+
+    switch (cmd) {
+        case LED_IOC_SET:
+            return led_ioc_set(ctrl, argp);
+        case LED_IOC_PATTERN:
+            return led_ioc_pattern(ctrl, argp);
+        case LED_IOC_PATTERN_STOP:
+            mutex_lock(&ctrl->pattern.upload);
+            led_pattern_stop(&ctrl->pattern);
+            mutex_unlock(&ctrl->pattern.upload);
+            return 0;
+        case LED_IOC_PATTERN_STATS:
+            return led_ioc_pattern_stats(ctrl, argp);
+        case LED_IOC_COUNT:
+            return put_user(ctrl->nleds, (__u32 __user *)argp);
+        case LED_IOC_REFRESH:
+            return led_ioc_refresh(ctrl, argp);
+        default:
+            return -ENOTTY;
+    }
+}
+
 // 文件操作结构体
-static struct file_operations fops = {
+static const struct file_operations led_fops = {
     .owner = THIS_MODULE,
     .open = led_open,
     .release = led_release,
+    .read = led_read,
     .write = led_write,
+    .poll = led_poll,
+    .fasync = led_fasync,
+    .unlocked_ioctl = led_ioctl,
+    .mmap = led_mmap,
 };
 
-static int __init led_init(void) {
+static void led_cancel_flush(void *data) {
+    struct led_ctrl *ctrl = data;
+
+    cancel_work_sync(&ctrl->flush_work);
+}
+
+static int led_probe(struct platform_device *pdev) {
+    struct led_ctrl *ctrl;
     int ret;
-    
-    // 申请设备号
-    ret = alloc_chrdev_region(&dev_num, 0, 1, DEVICE_NAME);
-    if (ret < 0) {
-        printk(KERN_ERR "Failed to allocate device number\n");
+
+    // 打开的文件可能比设备活得久, 见 struct led_ctrl
+    ctrl = kzalloc(sizeof(*ctrl), GFP_KERNEL);
+    if (!ctrl)
+        return -ENOMEM;
+    kref_init(&ctrl->ref);
+    ret = devm_add_action_or_reset(&pdev->dev, led_ctrl_put, ctrl);
+    if (ret)
         return ret;
+    ctrl->dev = &pdev->dev;
+
+    // 申请所有LED并输出有效电平, 加载时全部点亮
+    ctrl->gpios = devm_gpiod_get_array(&pdev->dev, "led", GPIOD_OUT_HIGH);
+    if (IS_ERR(ctrl->gpios)) {
+        ret = PTR_ERR(ctrl->gpios);
+        if (ret != -EPROBE_DEFER)
+            dev_err(&pdev->dev, "Failed to get led-gpios: %d\n", ret);
+        return ret;
+    }
+    ctrl->nleds = ctrl->gpios->ndescs;
+    if (!ctrl->nleds || ctrl->nleds > LED_MAX_LEDS) {
+        dev_err(&pdev->dev, "Need 1-%d led-gpios, got %u\n", LED_MAX_LEDS, ctrl->nleds);
+        return -EINVAL;
     }
-    
-    // 初始化字符设备
-    cdev_init(&led_cdev, &fops);
-    led_cdev.owner = THIS_MODULE;
-    
-    // 添加字符设备到系统
-    ret = cdev_add(&led_cdev, dev_num, 1);
-    if (ret < 0) {
-        printk(KERN_ERR "Failed to add cdev\n");
-        unregister_chrdev_region(dev_num, 1);
+    ctrl->all = ctrl->nleds == 64 ? ~0ULL : (1ULL << ctrl->nleds) - 1;
+
+    ctrl->out = devm_drvcore_gpio_array_create(&pdev->dev, ctrl->gpios->desc, ctrl->nleds);
+    if (IS_ERR(ctrl->out))
+        return PTR_ERR(ctrl->out);
+
+    /*
+     * 会睡眠的控制器上, 图案引擎、刷新定时器和触发器的输出由 flush_work 补写, 时序不如
+     * 直接写寄存器准. LED class 设备在 led_remove() 之后才注销, 那之前还可能排队,
+     * 所以取消放在 devm 里, 排在它们之后.
+     */
+    mutex_init(&ctrl->flush_lock);
+    INIT_WORK(&ctrl->flush_work, led_flush_work);
+    ret = devm_add_action(&pdev->dev, led_cancel_flush, ctrl);
+    if (ret)
+        return ret;
+
+    spin_lock_init(&ctrl->apply_lock);
+    spin_lock_init(&ctrl->pattern.lock);
+    mutex_init(&ctrl->pattern.upload);
+    drvcore_hrtimer_setup(&ctrl->pattern.timer, led_pattern_timer, CLOCK_MONOTONIC,
+                          HRTIMER_MODE_ABS);
+    mutex_init(&ctrl->refresh.lock);
+    drvcore_hrtimer_setup(&ctrl->refresh.timer, led_refresh_timer, CLOCK_MONOTONIC,
+                          HRTIMER_MODE_REL);
+    ctrl->state = ctrl->all;
+    init_waitqueue_head(&ctrl->wait);
+
+    // 状态页在用户空间映射期间由映射持有引用, 最后由 led_ctrl_free() 释放
+    ctrl->refresh.page = (struct led_frame *)get_zeroed_page(GFP_KERNEL);
+    if (!ctrl->refresh.page)
+        return -ENOMEM;
+
+    platform_set_drvdata(pdev, ctrl);
+
+    // devm 管理, 在 led_remove() 之后才注销, 那时 ctrl 和 GPIO 都还在
+    ret = led_register_chans(ctrl);
+    if (ret)
+        return ret;
+
+    /* 设置并注册 miscdevice */
+    ctrl->miscdev.minor = MISC_DYNAMIC_MINOR;
+    ctrl->miscdev.name = DEVICE_NAME;
+    ctrl->miscdev.fops = &led_fops;
+    ctrl->miscdev.parent = &pdev->dev;
+
+    ret = misc_register(&ctrl->miscdev);
+    if (ret) {
+        dev_err(&pdev->dev, "Failed to register misc device\n");
         return ret;
     }
-    
-    // 创建设备类
-    led_class = class_create(THIS_MODULE, CLASS_NAME);
-    if (IS_ERR(led_class)) {
-        printk(KERN_ERR "Failed to create class\n");
-        cdev_del(&led_cdev);
-        unregister_chrdev_region(dev_num, 1);
-        return PTR_ERR(led_class);
-    }
-    
-    // 创建设备节点
-    led_device = device_create(led_class, NULL, dev_num, NULL, DEVICE_NAME);
-    if (IS_ERR(led_device)) {
-        printk(KERN_ERR "Failed to create device\n");
-        class_destroy(led_class);
-        cdev_del(&led_cdev);
-        unregister_chrdev_region(dev_num, 1);
-        return PTR_ERR(led_device);
-    }
-    
-    // 释放可能被占用的GPIO
-    gpio_free(LED1_GPIO);
-    gpio_free(LED2_GPIO);
-    gpio_free(LED3_GPIO);
-    gpio_free(LED4_GPIO);
-    
-    // 申请并配置LED1
-    if (gpio_request(LED1_GPIO, "led1")) {
-        printk(KERN_ERR "Failed to request GPIO %d\n", LED1_GPIO);
-        ret = -EBUSY;
-        goto cleanup;
-    }
-    gpio_direction_output(LED1_GPIO, 0);  // 初始低电平点亮
-    
-    // 申请并配置LED2
-    if (gpio_request(LED2_GPIO, "led2")) {
-        printk(KERN_ERR "Failed to request GPIO %d\n", LED2_GPIO);
-        gpio_free(LED1_GPIO);
-        ret = -EBUSY;
-        goto cleanup;
-    }
-    gpio_direction_output(LED2_GPIO, 0);  // 初始低电平点亮
-    
-    // 申请并配置LED3
-    if (gpio_request(LED3_GPIO, "led3")) {
-        printk(KERN_ERR "Failed to request GPIO %d\n", LED3_GPIO);
-        gpio_free(LED1_GPIO);
-        gpio_free(LED2_GPIO);
-        ret = -EBUSY;
-        goto cleanup;
-    }
-    gpio_direction_output(LED3_GPIO, 0);  // 初始低电平点亮
-    
-    // 申请并配置LED4
-    if (gpio_request(LED4_GPIO, "led4")) {
-        printk(KERN_ERR "Failed to request GPIO %d\n", LED4_GPIO);
-        gpio_free(LED1_GPIO);
-        gpio_free(LED2_GPIO);
-        gpio_free(LED3_GPIO);
-        ret = -EBUSY;
-        goto cleanup;
-    }
-    gpio_direction_output(LED4_GPIO, 0);  // 初始低电平点亮
-    
-    printk(KERN_INFO "Four LED driver initialized\n");
+
+    dev_info(&pdev->dev, "%u LEDs on %u GPIO banks%s\n", ctrl->nleds, ctrl->out->nbanks,
+             drvcore_gpio_array_can_sleep(ctrl->out) ? " (sleeping, writes deferred)" : "");
     return 0;
-    
-cleanup:
-    device_destroy(led_class, dev_num);
-    class_destroy(led_class);
-    cdev_del(&led_cdev);
-    unregister_chrdev_region(dev_num, 1);
-    return ret;
-}
-
-static void __exit led_exit(void) {
-    // 关闭所有LED（输出高电平）
-    gpio_set_value(LED1_GPIO, 1);
-    gpio_set_value(LED2_GPIO, 1);
-    gpio_set_value(LED3_GPIO, 1);
-    gpio_set_value(LED4_GPIO, 1);
-    
-    // 释放所有GPIO
-    gpio_free(LED1_GPIO);
-    gpio_free(LED2_GPIO);
-    gpio_free(LED3_GPIO);
-    gpio_free(LED4_GPIO);
-    
-    // 清理设备
-    device_destroy(led_class, dev_num);
-    class_destroy(led_class);
-    cdev_del(&led_cdev);
-    unregister_chrdev_region(dev_num, 1);
-    
-    printk(KERN_INFO "Four LED driver exited\n");
-}
-
-module_init(led_init);
-module_exit(led_exit);
+}
+
+static int led_remove(struct platform_device *pdev) {
+    struct led_ctrl *ctrl = platform_get_drvdata(pdev);
+
+    // 先不让新的文件打开, 再让已经打开的文件和触发器不再碰GPIO, 不能再启动定时器
+    misc_deregister(&ctrl->miscdev);
+    mutex_lock(&ctrl->pattern.upload);
+    mutex_lock(&ctrl->refresh.lock);
+    spin_lock_irq(&ctrl->apply_lock);
+    ctrl->gone = true;
+    spin_unlock_irq(&ctrl->apply_lock);
+    mutex_unlock(&ctrl->refresh.lock);
+    mutex_unlock(&ctrl->pattern.upload);
+
+    led_pattern_stop(&ctrl->pattern);
+    hrtimer_cancel(&ctrl->refresh.timer);
+    wake_up_interruptible(&ctrl->wait);
+    kill_fasync(&ctrl->async_queue, SIGIO, POLL_HUP);
+
+    // 关闭所有LED, GPIO 由 devm 释放. gone 之后 led_apply() 不写GPIO, 这里直接写
+    cancel_work_sync(&ctrl->flush_work);
+    mutex_lock(&ctrl->flush_lock);
+    drvcore_gpio_array_set(ctrl->out, ctrl->all, 0);
+    mutex_unlock(&ctrl->flush_lock);
+    return 0;
+}
+DRVCORE_PLATFORM_REMOVE(led_remove);
+
+static struct platform_driver led_driver = {
+    .driver = {
+        .name = DEVICE_NAME,
+        .owner = THIS_MODULE,
+        .of_match_table = of_match_ptr(led_of_match),
+    },
+    .probe = led_probe,
+    .remove = drvcore_remove_fn(led_remove),
+};
+
+module_platform_driver(led_driver);
 
 MODULE_LICENSE("GPL");
-MODULE_DESCRIPTION("Four LED Control Driver with User Space Interface");
+MODULE_DESCRIPTION("Device tree driven LED array driver with User Space Interface");
 MODULE_AUTHOR("Your Name");
-
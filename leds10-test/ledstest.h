@@ -0,0 +1,102 @@
+/*
+ * /dev/led_control ioctl 接口, 驱动和用户空间程序共用
+ */
+
+#ifndef _LEDSTEST_H
+#define _LEDSTEST_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define LED_IOC_MAGIC 'l'
+
+/*
+ * LED 来自设备树的 led-gpios 列表, 第 n 项是 LED(n+1), 最多 LED_MAX_LEDS 个,
+ * 实际数量用 LED_IOC_COUNT 查询. 值是逻辑值: 1 点亮, 0 熄灭, 有效电平由
+ * 设备树里的 GPIO 标志(如 GPIO_ACTIVE_LOW)决定.
+ */
+#define LED_MAX_LEDS 64
+
+/* 一次更新多个LED: mask 的第 n 位选中 LED(n+1), value 的同一位是它的新值. 未选中的LED保持不变. */
+struct led_batch {
+    __u64 mask;
+    __u64 value;
+};
+
+/*
+ * 内核图案引擎: 上传一组步骤后由 hrtimer 在内核里执行, 用户空间不用再循环写设备.
+ * 每一步在 duration_us 内驱动 mask 选中的LED: 每个PWM周期中 duty/LED_DUTY_MAX
+ * 的时间输出 value, 其余时间输出反相电平. duty 为 LED_DUTY_MAX 时常亮(输出 value),
+ * 为 0 时输出反相电平. pwm_period_us 为 0 表示不做PWM, duty 非0即输出 value.
+ * 开和关两段都至少 LED_PWM_MIN_PHASE_US, 周期很短时很小(或接近满)的 duty 会被
+ * 抬到这个长度, 否则定时器会立即重新触发并被误记成 overrun.
+ */
+#define LED_DUTY_MAX            255
+#define LED_PATTERN_MAX_STEPS   256
+#define LED_PWM_MIN_PERIOD_US   100
+#define LED_PWM_MAX_PERIOD_US   1000000
+#define LED_PWM_MIN_PHASE_US    10
+
+struct led_step {
+    __u64 mask;
+    __u64 value;
+    __u32 duration_us;
+    __u8 duty;
+    __u8 pad[3];
+};
+
+#define LED_PATTERN_LOOP 0x1    /* 执行完最后一步后从头开始 */
+
+struct led_pattern {
+    __u64 steps;                /* 用户空间 struct led_step 数组的地址 */
+    __u32 nsteps;               /* 1..LED_PATTERN_MAX_STEPS */
+    __u32 flags;
+    __u32 pwm_period_us;
+    __u32 pad;
+};
+
+/* 从上次上传开始的统计, 迟到时间是定时器实际触发时刻减去预定时刻 */
+struct led_pattern_stats {
+    __u64 steps;                /* 已开始的步骤数 */
+    __u64 loops;                /* 完整执行完的轮数 */
+    __u64 expiries;             /* 定时器触发次数 */
+    __u64 overruns;             /* 迟到到错过下一个边沿, 时间轴已顺延 */
+    __u64 max_late_ns;
+    __u64 total_late_ns;
+    __u32 running;
+    __u32 pad;
+};
+
+/*
+ * 共享状态页: mmap /dev/led_control (偏移0, 不超过一页) 得到 struct led_frame,
+ * led[n] 非0表示 LED(n+1) 点亮, 用户空间直接写内存更新一帧. LED_IOC_REFRESH 设置
+ * 刷新频率(Hz, 0 停止), 驱动按该频率把页面写到GPIO, 只写有变化的LED所在的bank.
+ * 开启刷新时页面先被初始化为LED的当前状态. 和 LED_IOC_SET/图案引擎同时使用时后写的
+ * 生效: 每次刷新只下发页面里相对上一帧变化了的LED.
+ */
+#define LED_REFRESH_MAX_HZ 2000
+
+struct led_frame {
+    __u8 led[LED_MAX_LEDS];
+};
+
+/*
+ * read() 返回一个 struct led_status 快照, 缓冲区小于它时返回 EINVAL. 每个打开的fd
+ * 第一次读立即返回, 之后要等到有LED变化(不论来自文本命令, ioctl, 图案引擎还是
+ * 状态页刷新)才返回, O_NONBLOCK 时返回 EAGAIN. poll() 在有未读的变化时报告可读,
+ * 也支持 fasync (SIGIO). 变化很快时(比如软件PWM)多次变化合并成一次读.
+ */
+struct led_status {
+    __u64 state;                /* 第 n 位是 LED(n+1) 的当前值 */
+    __u32 seq;                  /* 每次有LED变化加一 */
+    __u32 nleds;
+};
+
+#define LED_IOC_SET             _IOW(LED_IOC_MAGIC, 1, struct led_batch)
+#define LED_IOC_PATTERN         _IOW(LED_IOC_MAGIC, 2, struct led_pattern)  /* 上传并启动, 替换正在执行的图案 */
+#define LED_IOC_PATTERN_STOP    _IO(LED_IOC_MAGIC, 3)  /* LED保持当前状态 */
+#define LED_IOC_PATTERN_STATS   _IOR(LED_IOC_MAGIC, 4, struct led_pattern_stats)
+#define LED_IOC_COUNT           _IOR(LED_IOC_MAGIC, 5, __u32)
+#define LED_IOC_REFRESH         _IOW(LED_IOC_MAGIC, 6, __u32)
+
+#endif /* _LEDSTEST_H */
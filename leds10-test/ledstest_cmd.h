@@ -0,0 +1,68 @@
+/*
+ * ledstest_cmd: /dev/led_control 文本命令 "ledX Y" 的解析
+ *
+ * 和内核 sscanf(cmd, "led%d %d") 接受同样的输入: "led" 必须在开头原样出现, 每个数字前
+ * 可以有空白, 只认 '-' 号, 数字后面多余的内容忽略. 不同的是太长的数字饱和而不是回绕,
+ * 所以 "led4294967297 1" 不会变成 LED1.
+ * 不依赖内核的其他部分, uspace-test/ 在用户空间对它做模糊测试和压测.
+ */
+
+#ifndef _LEDSTEST_CMD_H
+#define _LEDSTEST_CMD_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/errno.h>
+#else
+#include "drvcore_uspace.h"
+#endif
+
+// 和内核 ctype 的 isspace() 一致, 包括 0xa0
+static inline bool led_cmd_isspace(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r') || c == 0xa0;
+}
+
+// 解析一个 %d, 失败返回 NULL. 超过 2^32 的绝对值饱和, 一定落在合法范围外
+static inline const char *led_cmd_int(const char *s, s64 *out) {
+    bool neg = false;
+    u64 v = 0;
+
+    while (led_cmd_isspace(*s))
+        s++;
+    if (*s == '-') {
+        neg = true;
+        s++;
+    }
+    if (*s < '0' || *s > '9')
+        return NULL;
+    for (; *s >= '0' && *s <= '9'; s++)
+        if (v < (1ULL << 32))
+            v = v * 10 + (*s - '0');
+    *out = neg ? -(s64)v : (s64)v;
+    return s;
+}
+
+/*
+ * 解析 "ledX Y", X 是 1..nleds 的LED编号, Y 是0或1. 成功返回0;
+ * 格式错误返回 -EINVAL, 编号越界返回 -ERANGE, 值不是0/1返回 -EDOM.
+ */
+static inline int led_parse_cmd(const char *cmd, unsigned int nleds,
+                                unsigned int *led, int *value) {
+    s64 n, v;
+
+    if (cmd[0] != 'l' || cmd[1] != 'e' || cmd[2] != 'd')
+        return -EINVAL;
+    cmd = led_cmd_int(cmd + 3, &n);
+    if (!cmd || !led_cmd_int(cmd, &v))
+        return -EINVAL;
+
+    if (n < 1 || n > nleds)
+        return -ERANGE;
+    if (v != 0 && v != 1)
+        return -EDOM;
+    *led = n;
+    *value = v;
+    return 0;
+}
+
+#endif /* _LEDSTEST_CMD_H */
@@ -25,7 +25,10 @@
 
 #include <linux/input.h>
 
-#define GLOBALFIFO_SIZE 0x1000  // FIFO缓冲区大小4KB
+#include "drvcore_compat.h"
+#include "globalfifo_core.h"
+
+#define GLOBALFIFO_SIZE 0x1000  // FIFO缓冲区大小4KB, 必须是2的幂
 #define FIFO_CLEAR 0x1          // IOCTL清除命令
 #define GLOBALFIFO_MAJOR 231    // 主设备号
 
@@ -35,14 +38,10 @@ static const struct of_device_id globalfifo_of_match[] = {
 };
 MODULE_DEVICE_TABLE(of, globalfifo_of_match);
 
-/* 设备结构体 */
+/* 设备结构体. 缓冲区、锁和等待队列在 globalfifo_core 里 */
 struct globalfifo_dev {
     struct cdev cdev;           // 字符设备结构
-    unsigned int current_len;    // 当前数据长度
-    unsigned char mem[GLOBALFIFO_SIZE]; // 数据缓冲区
-    struct mutex mutex;         // 互斥锁
-    wait_queue_head_t r_wait;   // 读等待队列
-    wait_queue_head_t w_wait;   // 写等待队列
+    struct globalfifo_core core; // FIFO缓冲区
     struct fasync_struct *async_queue; // 异步通知队列
     struct miscdevice miscdev;  // 杂项设备结构
     struct device *dev;
@@ -57,19 +56,15 @@ static ssize_t status_show(struct device *dev,
                          char *buf)
 {
     struct globalfifo_dev *my_dev = dev_get_drvdata(dev);
-    ssize_t count = 0;
-    
-    mutex_lock(&my_dev->mutex);
-    count = sprintf(buf, "FIFO Status:\n"
+    unsigned int len = globalfifo_core_len(&my_dev->core);
+
+    return sprintf(buf, "FIFO Status:\n"
                    "Size: %d\n"
-                   "Used: %d\n"
-                   "Free: %d\n",
+                   "Used: %u\n"
+                   "Free: %u\n",
                    GLOBALFIFO_SIZE,
-                   my_dev->current_len,
-                   GLOBALFIFO_SIZE - my_dev->current_len);
-    mutex_unlock(&my_dev->mutex);
-    
-    return count;
+                   len,
+                   GLOBALFIFO_SIZE - len);
 }
 
 static ssize_t clear_store(struct device *dev,
@@ -79,10 +74,7 @@ static ssize_t clear_store(struct device *dev,
     struct globalfifo_dev *my_dev = dev_get_drvdata(dev);
     
     if (strncmp(buf, "1", 1) == 0) {
-        mutex_lock(&my_dev->mutex);
-        my_dev->current_len = 0;
-        memset(my_dev->mem, 0, GLOBALFIFO_SIZE);
-        mutex_unlock(&my_dev->mutex);
+        globalfifo_core_clear(&my_dev->core);
         printk(KERN_INFO "FIFO cleared via sysfs\n");
     }
     
@@ -128,10 +120,7 @@ static long globalfifo_ioctl(struct file *filp, unsigned int cmd,
 
     switch (cmd) {
     case FIFO_CLEAR:  // 清除FIFO命令
-        mutex_lock(&dev->mutex);  // 加锁
-        dev->current_len = 0;     // 重置长度
-        memset(dev->mem, 0, GLOBALFIFO_SIZE); // 清空缓冲区
-        mutex_unlock(&dev->mutex); // 解锁
+        globalfifo_core_clear(&dev->core);
 
         printk(KERN_INFO "globalfifo is set to zero\n");
         break;
@@ -150,23 +139,20 @@ static unsigned int globalfifo_poll(struct file *filp, poll_table * wait)
     struct globalfifo_dev *dev = container_of(filp->private_data,
         struct globalfifo_dev, miscdev);
 
-    mutex_lock(&dev->mutex);  // 加锁
-
     // 将等待队列添加到poll_table
-    poll_wait(filp, &dev->r_wait, wait);
-    poll_wait(filp, &dev->w_wait, wait);
+    poll_wait(filp, &dev->core.r_wait, wait);
+    poll_wait(filp, &dev->core.w_wait, wait);
 
-    // 检查可读状态
-    if (dev->current_len != 0) {
+    // 检查可读状态, 不用加锁: 看到的长度最多是稍旧的值
+    if (globalfifo_core_len(&dev->core) != 0) {
         mask |= POLLIN | POLLRDNORM;
     }
 
     // 检查可写状态
-    if (dev->current_len != GLOBALFIFO_SIZE) {
+    if (globalfifo_core_space(&dev->core) != 0) {
         mask |= POLLOUT | POLLWRNORM;
     }
 
-    mutex_unlock(&dev->mutex); // 解锁
     return mask;
 }
 
@@ -174,106 +160,16 @@ static unsigned int globalfifo_poll(struct file *filp, poll_table * wait)
 static ssize_t globalfifo_read(struct file *filp, char __user *buf,
                size_t count, loff_t *ppos)
 {
-    int ret;
     // 获取设备结构
     struct globalfifo_dev *dev = container_of(filp->private_data,
         struct globalfifo_dev, miscdev);
 
-    DECLARE_WAITQUEUE(wait, current);  // 定义等待队列项
-
-    mutex_lock(&dev->mutex);  // 加锁
-    add_wait_queue(&dev->r_wait, &wait); // 添加到读等待队列
-
-    // 等待直到有数据可读
-    while (dev->current_len == 0) {
-        if (filp->f_flags & O_NONBLOCK) {  // 非阻塞模式
-            ret = -EAGAIN;
-            goto out;
-        }
-        __set_current_state(TASK_INTERRUPTIBLE); // 设置可中断状态
-        mutex_unlock(&dev->mutex);  // 解锁
-
-        schedule();  // 调度其他进程
-        if (signal_pending(current)) {  // 检查信号
-            ret = -ERESTARTSYS;
-            goto out2;
-        }
-
-        mutex_lock(&dev->mutex);  // 重新加锁
-    }
-
-    // 调整读取长度
-    if (count > dev->current_len)
-        count = dev->current_len;
-
-    // 拷贝数据到用户空间
-    if (copy_to_user(buf, dev->mem, count)) {
-        ret = -EFAULT;
-        goto out;
-    } else {
-        // 移动剩余数据
-        memcpy(dev->mem, dev->mem + count, dev->current_len - count);
-        dev->current_len -= count;  // 更新长度
-        printk(KERN_INFO "read %d bytes(s),current_len:%d\n", count,
-               dev->current_len);
-
-        wake_up_interruptible(&dev->w_wait);  // 唤醒写等待队列
-
-        ret = count;
-    }
- out:
-    mutex_unlock(&dev->mutex);  // 解锁
- out2:
-    remove_wait_queue(&dev->r_wait, &wait);  // 移除等待队列
-    set_current_state(TASK_RUNNING);  // 设置运行状态
-    return ret;
+    return globalfifo_core_read(&dev->core, buf, count, filp->f_flags & O_NONBLOCK);
 }
 
-/* 写函数 */
-static ssize_t globalfifo_write(struct file *filp, const char __user *buf,
-                size_t count, loff_t *ppos)
+/* 按最后写入的字符上报按键 */
+static void globalfifo_report_key(struct globalfifo_dev *dev, char last_char)
 {
-    // 获取设备结构
-    struct globalfifo_dev *dev = container_of(filp->private_data,
-        struct globalfifo_dev, miscdev);
-
-    int ret;
-    DECLARE_WAITQUEUE(wait, current);  // 定义等待队列项
-
-    mutex_lock(&dev->mutex);  // 加锁
-    add_wait_queue(&dev->w_wait, &wait); // 添加到写等待队列
-
-    // 等待直到有空间可写
-    while (dev->current_len == GLOBALFIFO_SIZE) {
-        if (filp->f_flags & O_NONBLOCK) {  // 非阻塞模式
-            ret = -EAGAIN;
-            goto out;
-        }
-        __set_current_state(TASK_INTERRUPTIBLE); // 设置可中断状态
-        mutex_unlock(&dev->mutex);  // 解锁
-
-        schedule();  // 调度其他进程
-        if (signal_pending(current)) {  // 检查信号
-            ret = -ERESTARTSYS;
-            goto out2;
-        }
-
-        mutex_lock(&dev->mutex);  // 重新加锁
-    }
-
-    // 调整写入长度
-    if (count > GLOBALFIFO_SIZE - dev->current_len)
-        count = GLOBALFIFO_SIZE - dev->current_len;
-
-    // 从用户空间拷贝数据
-    if (copy_from_user(dev->mem + dev->current_len, buf, count)) {
-        ret = -EFAULT;
-        goto out;
-    } else {
-        dev->current_len += count;  // 更新长度
-
-        if (count > 0) {
-    char last_char = dev->mem[dev->current_len - 1]; // 获取最后写入的字符
     printk(KERN_DEBUG "globalfifo: 收到字符 '%c' (ASCII: %d)\n", last_char, last_char);
 
     switch (last_char) {
@@ -310,25 +206,29 @@ static ssize_t globalfifo_write(struct file *filp, const char __user *buf,
     }
 }
 
-        //printk(KERN_INFO "written %d bytes(s),current_len:%d\n", count,
-               //dev->current_len);
+/* 写函数 */
+static ssize_t globalfifo_write(struct file *filp, const char __user *buf,
+                size_t count, loff_t *ppos)
+{
+    // 获取设备结构
+    struct globalfifo_dev *dev = container_of(filp->private_data,
+        struct globalfifo_dev, miscdev);
+    char last_char;
+    long ret;
 
-        wake_up_interruptible(&dev->r_wait);  // 唤醒读等待队列
+    ret = globalfifo_core_write(&dev->core, buf, count, filp->f_flags & O_NONBLOCK);
+    if (ret <= 0)
+        return ret;
 
-        // 发送异步通知
-        if (dev->async_queue) {
-            kill_fasync(&dev->async_queue, SIGIO, POLL_IN);
-            printk(KERN_DEBUG "%s kill SIGIO\n", __func__);
-        }
+    // 最后写入的字符从用户缓冲区取, 读者可能已经把它读走了
+    if (!get_user(last_char, buf + ret - 1))
+        globalfifo_report_key(dev, last_char);
 
-        ret = count;
+    // 发送异步通知
+    if (dev->async_queue) {
+        kill_fasync(&dev->async_queue, SIGIO, POLL_IN);
+        printk(KERN_DEBUG "%s kill SIGIO\n", __func__);
     }
-
- out:
-    mutex_unlock(&dev->mutex);  // 解锁
- out2:
-    remove_wait_queue(&dev->w_wait, &wait);  // 移除等待队列
-    set_current_state(TASK_RUNNING);  // 设置运行状态
     return ret;
 }
 
@@ -348,24 +248,23 @@ static const struct file_operations globalfifo_fops = {
 static int globalfifo_proc_show(struct seq_file *m, void *v)
 {
     struct globalfifo_dev *dev = m->private;
-    int i;
-    
-    mutex_lock(&dev->mutex);
+    unsigned char head[20];
+    unsigned int len, n, i;
+
+    n = globalfifo_core_peek(&dev->core, head, sizeof(head), &len);
+
     seq_printf(m, "GlobalFIFO Status:\n");
     seq_printf(m, "Buffer size: %d bytes\n", GLOBALFIFO_SIZE);
-    seq_printf(m, "Current data length: %d bytes\n", dev->current_len);
-    seq_printf(m, "Available space: %d bytes\n", 
-               GLOBALFIFO_SIZE - dev->current_len);
-    
-    if (dev->current_len > 0) {
-        seq_printf(m, "First %d bytes: ", 
-                   dev->current_len < 20 ? dev->current_len : 20);
-        for (i = 0; i < (dev->current_len < 20 ? dev->current_len : 20); i++) {
-            seq_printf(m, "%02x ", dev->mem[i]);
+    seq_printf(m, "Current data length: %u bytes\n", len);
+    seq_printf(m, "Available space: %u bytes\n", GLOBALFIFO_SIZE - len);
+
+    if (n > 0) {
+        seq_printf(m, "First %u bytes: ", n);
+        for (i = 0; i < n; i++) {
+            seq_printf(m, "%02x ", head[i]);
         }
         seq_puts(m, "\n");
     }
-    mutex_unlock(&dev->mutex);
     return 0;
 }
 
@@ -375,14 +274,8 @@ static int globalfifo_proc_open(struct inode *inode, struct file *file)
     return single_open(file, globalfifo_proc_show, PDE_DATA(inode));
 }
 
-/* proc文件操作结构体 */
-static const struct file_operations globalfifo_proc_fops = {
-    .owner = THIS_MODULE,
-    .open = globalfifo_proc_open,
-    .read = seq_read,
-    .llseek = seq_lseek,
-    .release = single_release,
-};
+/* proc文件操作结构体, 5.6 起是 struct proc_ops */
+DRVCORE_PROC_SINGLE_OPS(globalfifo_proc_fops, globalfifo_proc_open);
 
 static int create_globalfifo_proc(struct globalfifo_dev *dev)
 {
@@ -450,10 +343,10 @@ static int globalfifo_probe(struct platform_device *pdev)
     platform_set_drvdata(pdev, gl);
     gl->dev = &pdev->dev;
 
-    /* 初始化互斥锁和等待队列 */
-    mutex_init(&gl->mutex);
-    init_waitqueue_head(&gl->r_wait);
-    init_waitqueue_head(&gl->w_wait);
+    /* 初始化缓冲区, 互斥锁和等待队列 */
+    ret = globalfifo_core_init(&gl->core, GLOBALFIFO_SIZE);
+    if (ret)
+        return ret;
 
     /* 设置并注册 miscdevice */
     gl->miscdev.minor = MISC_DYNAMIC_MINOR;
@@ -464,7 +357,7 @@ static int globalfifo_probe(struct platform_device *pdev)
     ret = misc_register(&gl->miscdev);
     if (ret) {
         dev_err(&pdev->dev, "Failed to register misc device\n");
-        return ret;
+        goto err_fifo;
     }
 
     /* 创建 sysfs 属性文件 */
@@ -492,6 +385,8 @@ err_status:
     device_remove_file(&pdev->dev, &dev_attr_status);
 err_misc:
     misc_deregister(&gl->miscdev);
+err_fifo:
+    globalfifo_core_free(&gl->core);
     return ret;
 err_input:
     // input设备会自动释放，因为使用了devm
@@ -514,10 +409,12 @@ static int globalfifo_remove(struct platform_device *pdev)
 
     // 注销杂项设备
     misc_deregister(&gl->miscdev);
+    globalfifo_core_free(&gl->core);
 
     dev_info(&pdev->dev, "globalfifo drv removed\n");
     return 0;
 }
+DRVCORE_PLATFORM_REMOVE(globalfifo_remove);
 
 /* 平台驱动结构体 */
 static struct platform_driver globalfifo_driver = {
@@ -527,7 +424,7 @@ static struct platform_driver globalfifo_driver = {
         .of_match_table = of_match_ptr(globalfifo_of_match),  // 添加设备树匹配表
     },
     .probe = globalfifo_probe,  // 探测函数
-    .remove = globalfifo_remove, // 移除函数
+    .remove = drvcore_remove_fn(globalfifo_remove), // 移除函数
 };
 
 static int __init globalfifo_init(void)
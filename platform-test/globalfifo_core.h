@@ -0,0 +1,147 @@
+/*
+ * globalfifo_core: globalfifo 的缓冲区逻辑, 和字符设备、input、proc 分开
+ *
+ * 数据放在 drvcore 的单生产者单消费者环形缓冲区里: 读写不再搬移数据,
+ * 读者之间用 read_lock 串行化, 写者之间用 write_lock 串行化, 读和写互不阻塞.
+ * 等待时不持锁, 这样清空FIFO(读一端的操作)不会被等数据的读者挡住.
+ *
+ * 只依赖 drvcore_ring.h 和锁/等待队列, 在用户空间包含 drvcore_uspace.h 也能编译,
+ * 见 uspace-test/.
+ *
+ * 基于GPLv2或更高版本授权
+ */
+
+#ifndef _GLOBALFIFO_CORE_H
+#define _GLOBALFIFO_CORE_H
+
+#ifdef __KERNEL__
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#endif
+
+#include "drvcore_ring.h"
+
+struct globalfifo_core {
+    struct drvcore_spsc fifo;   // 数据缓冲区
+    struct mutex read_lock;     // 消费者一端
+    struct mutex write_lock;    // 生产者一端
+    wait_queue_head_t r_wait;   // 读等待队列
+    wait_queue_head_t w_wait;   // 写等待队列
+};
+
+// size 必须是2的幂
+static inline int globalfifo_core_init(struct globalfifo_core *c, unsigned int size)
+{
+    int ret;
+
+    ret = drvcore_spsc_init(&c->fifo, size);
+    if (ret)
+        return ret;
+    mutex_init(&c->read_lock);
+    mutex_init(&c->write_lock);
+    init_waitqueue_head(&c->r_wait);
+    init_waitqueue_head(&c->w_wait);
+    return 0;
+}
+
+static inline void globalfifo_core_free(struct globalfifo_core *c)
+{
+    drvcore_spsc_free(&c->fifo);
+}
+
+static inline unsigned int globalfifo_core_len(const struct globalfifo_core *c)
+{
+    return drvcore_spsc_len(&c->fifo);
+}
+
+static inline unsigned int globalfifo_core_space(const struct globalfifo_core *c)
+{
+    return drvcore_spsc_space(&c->fifo);
+}
+
+/* 清空FIFO: 丢弃数据是消费者一端的操作, 写者可以同时继续写 */
+static inline void globalfifo_core_clear(struct globalfifo_core *c)
+{
+    mutex_lock(&c->read_lock);
+    drvcore_spsc_discard(&c->fifo);
+    mutex_unlock(&c->read_lock);
+    wake_up_interruptible(&c->w_wait);
+}
+
+/*
+ * 读: 没有数据时阻塞(nonblock 时返回 -EAGAIN), 然后直接从环形缓冲区拷贝到用户空间.
+ * 返回读到的字节数, -EAGAIN, -ERESTARTSYS 或 -EFAULT.
+ */
+static inline long globalfifo_core_read(struct globalfifo_core *c, char __user *buf,
+                                        size_t count, bool nonblock)
+{
+    int ret;
+
+    // 等待直到有数据可读
+    for (;;) {
+        if (mutex_lock_interruptible(&c->read_lock))
+            return -ERESTARTSYS;
+        if (drvcore_spsc_len(&c->fifo) != 0)
+            break;
+        mutex_unlock(&c->read_lock);
+
+        if (nonblock)
+            return -EAGAIN;
+        ret = wait_event_interruptible(c->r_wait, drvcore_spsc_len(&c->fifo) != 0);
+        if (ret)
+            return ret;
+    }
+
+    ret = drvcore_spsc_to_user(&c->fifo, buf, min_t(size_t, count, c->fifo.size));
+    mutex_unlock(&c->read_lock);
+
+    if (ret > 0)
+        wake_up_interruptible(&c->w_wait);  // 唤醒写等待队列
+    return ret;
+}
+
+/* 写: 和读对称, 返回写入的字节数(可能小于 count), -EAGAIN, -ERESTARTSYS 或 -EFAULT */
+static inline long globalfifo_core_write(struct globalfifo_core *c, const char __user *buf,
+                                         size_t count, bool nonblock)
+{
+    int ret;
+
+    // 等待直到有空间可写
+    for (;;) {
+        if (mutex_lock_interruptible(&c->write_lock))
+            return -ERESTARTSYS;
+        if (drvcore_spsc_space(&c->fifo) != 0)
+            break;
+        mutex_unlock(&c->write_lock);
+
+        if (nonblock)
+            return -EAGAIN;
+        ret = wait_event_interruptible(c->w_wait, drvcore_spsc_space(&c->fifo) != 0);
+        if (ret)
+            return ret;
+    }
+
+    ret = drvcore_spsc_from_user(&c->fifo, buf, min_t(size_t, count, c->fifo.size));
+    mutex_unlock(&c->write_lock);
+
+    if (ret > 0)
+        wake_up_interruptible(&c->r_wait);  // 唤醒读等待队列
+    return ret;
+}
+
+// 拷贝开头最多 len 字节, 不取走; 同时返回当前长度
+static inline unsigned int globalfifo_core_peek(struct globalfifo_core *c, void *dst,
+                                               unsigned int len, unsigned int *used)
+{
+    unsigned int n;
+
+    // peek 属于消费者一端
+    mutex_lock(&c->read_lock);
+    *used = drvcore_spsc_len(&c->fifo);
+    n = drvcore_spsc_peek(&c->fifo, dst, len);
+    mutex_unlock(&c->read_lock);
+    return n;
+}
+
+#endif /* _GLOBALFIFO_CORE_H */
@@ -0,0 +1,177 @@
+/*
+ * drvsim: 在没有设备树的开发机上, 把 ledstest 和 ledkey 接到 gpio-sim 的线上
+ *
+ * 用软件节点(software node)代替设备树, 注册两个平台设备, 驱动按名字匹配:
+ *   led_control: led-gpios = 第 0 .. nleds-1 条线
+ *   ledkey:      nkeys 个子节点, 第 k 个的 key-gpios = nleds + 2k, led-gpios = nleds + 2k + 1
+ * GPIO 引用指向一个名字等于 gpio-sim bank 标签(chip 参数)的软件节点, gpiolib
+ * 按这个名字找到对应的 gpio_device. 所有线都是高有效, 按键按下 = 线为高.
+ *
+ * 需要 Linux 6.2 以上(软件节点的GPIO查找). run_sim.sh 负责创建 gpio-sim, 加载模块.
+ *
+ * 基于GPLv2或更高版本授权
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/version.h>
+#include <linux/platform_device.h>
+#include <linux/property.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+#include <dt-bindings/gpio/gpio.h>
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+#error "drvsim needs software node GPIO lookup (Linux 6.2+)"
+#endif
+
+#define DRVSIM_MAX_KEYS 16
+
+static char *chip = "drvsim";
+module_param(chip, charp, S_IRUGO);
+MODULE_PARM_DESC(chip, "label of the gpio-sim bank");
+
+static unsigned int nleds = 8;
+module_param(nleds, uint, S_IRUGO);
+MODULE_PARM_DESC(nleds, "LEDs for led_control, 0 to skip it");
+
+static unsigned int nkeys = 2;
+module_param(nkeys, uint, S_IRUGO);
+MODULE_PARM_DESC(nkeys, "key/LED pairs for ledkey, 0 to skip it");
+
+static struct software_node drvsim_chip_node;
+
+static struct fwnode_handle *led_node;
+static struct fwnode_handle *ledkey_node;
+static struct fwnode_handle *key_nodes[DRVSIM_MAX_KEYS];
+static struct platform_device *led_pdev;
+static struct platform_device *ledkey_pdev;
+
+static struct platform_device *drvsim_add_device(const char *name, struct fwnode_handle *fwnode)
+{
+    struct platform_device_info info = {
+        .name = name,
+        .id = PLATFORM_DEVID_NONE,
+        .fwnode = fwnode,
+    };
+
+    return platform_device_register_full(&info);
+}
+
+static int drvsim_add_led_control(void)
+{
+    struct software_node_ref_args *refs;
+    unsigned int i;
+
+    refs = kcalloc(nleds, sizeof(*refs), GFP_KERNEL);
+    if (!refs)
+        return -ENOMEM;
+    for (i = 0; i < nleds; i++)
+        refs[i] = SOFTWARE_NODE_REFERENCE(&drvsim_chip_node, i, GPIO_ACTIVE_HIGH);
+
+    {
+        // 属性连同引用数组一起被复制, refs 用完就可以释放
+        const struct property_entry props[] = {
+            PROPERTY_ENTRY_REF_ARRAY_LEN("led-gpios", refs, nleds),
+            { }
+        };
+
+        led_node = fwnode_create_software_node(props, NULL);
+    }
+    kfree(refs);
+    if (IS_ERR(led_node))
+        return PTR_ERR(led_node);
+
+    led_pdev = drvsim_add_device("led_control", led_node);
+    return PTR_ERR_OR_ZERO(led_pdev);
+}
+
+static int drvsim_add_ledkey(void)
+{
+    unsigned int k, line;
+    char label[16];
+
+    ledkey_node = fwnode_create_software_node(NULL, NULL);
+    if (IS_ERR(ledkey_node))
+        return PTR_ERR(ledkey_node);
+
+    // 子节点要在设备注册前建好, ledkey 在 probe 里数子节点
+    for (k = 0; k < nkeys; k++) {
+        line = nleds + 2 * k;
+        snprintf(label, sizeof(label), "KEY%u", k + 1);
+        {
+            const struct property_entry props[] = {
+                PROPERTY_ENTRY_STRING("label", label),
+                PROPERTY_ENTRY_REF("key-gpios", &drvsim_chip_node, line, GPIO_ACTIVE_HIGH),
+                PROPERTY_ENTRY_REF("led-gpios", &drvsim_chip_node, line + 1, GPIO_ACTIVE_HIGH),
+                { }
+            };
+
+            key_nodes[k] = fwnode_create_software_node(props, ledkey_node);
+        }
+        if (IS_ERR(key_nodes[k])) {
+            int ret = PTR_ERR(key_nodes[k]);
+
+            key_nodes[k] = NULL;
+            return ret;
+        }
+    }
+
+    ledkey_pdev = drvsim_add_device("ledkey", ledkey_node);
+    return PTR_ERR_OR_ZERO(ledkey_pdev);
+}
+
+static void drvsim_cleanup(void)
+{
+    unsigned int k;
+
+    if (!IS_ERR_OR_NULL(ledkey_pdev))
+        platform_device_unregister(ledkey_pdev);
+    if (!IS_ERR_OR_NULL(led_pdev))
+        platform_device_unregister(led_pdev);
+    for (k = 0; k < DRVSIM_MAX_KEYS; k++)
+        if (key_nodes[k])
+            fwnode_remove_software_node(key_nodes[k]);
+    if (!IS_ERR_OR_NULL(ledkey_node))
+        fwnode_remove_software_node(ledkey_node);
+    if (!IS_ERR_OR_NULL(led_node))
+        fwnode_remove_software_node(led_node);
+    software_node_unregister(&drvsim_chip_node);
+}
+
+static int __init drvsim_init(void)
+{
+    int ret;
+
+    if (nleds > 64 || nkeys > DRVSIM_MAX_KEYS || (!nleds && !nkeys))
+        return -EINVAL;
+
+    drvsim_chip_node.name = chip;
+    ret = software_node_register(&drvsim_chip_node);
+    if (ret)
+        return ret;
+
+    ret = nleds ? drvsim_add_led_control() : 0;
+    if (!ret && nkeys)
+        ret = drvsim_add_ledkey();
+    if (ret) {
+        pr_err("drvsim: failed to set up devices: %d\n", ret);
+        drvsim_cleanup();
+        return ret;
+    }
+
+    pr_info("drvsim: %u LEDs and %u key/LED pairs on %s\n", nleds, nkeys, chip);
+    return 0;
+}
+
+static void __exit drvsim_exit(void)
+{
+    drvsim_cleanup();
+}
+
+module_init(drvsim_init);
+module_exit(drvsim_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("JIU");
+MODULE_DESCRIPTION("gpio-sim board for ledstest and ledkey");
@@ -0,0 +1,180 @@
+#!/bin/sh
+#
+# 不需要硬件的 ledstest/ledkey 功能和性能测试:
+#   1. 用正在运行的内核的头文件编译 drvcore, ledstest, ledkey, drvsim 和 bench/drvbench
+#   2. 通过 configfs 建一个 gpio-sim bank, 加载模块, drvsim 把两个驱动接到 bank 的线上
+#   3. 逐个点亮/熄灭 /dev/led_control 的LED, 检查 gpio-sim 上的输出电平
+#   4. 用 drvbench 测 LED_IOC_SET 和文本命令的 ops/s 和延迟
+#   5. 在每个按键线上用 pull 注入边沿, 每个边沿后检查对应的LED跟随, 最后读
+#      /sys/kernel/debug/ledkey/latency 得到中断到LED输出的延迟
+# 结果每行一个 JSON 对象输出到 stdout, 第一行是内核版本和参数, 贴结果时一起贴上.
+# 过程信息输出到 stderr. 有不一致时返回非0, 环境不满足时在改动任何东西之前退出.
+#
+# 需要 root, CONFIG_GPIO_SIM, configfs 和 debugfs, 内核 6.2 以上.
+#
+# 用法: run_sim.sh [-l LED数] [-k 按键数] [-n 边沿数] [-i 间隔秒] [-D 压测秒数] [-B]
+#   -B  不重新编译, 用已有的 .ko
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+NLEDS=8
+NKEYS=2
+EDGES=200
+INTERVAL=0.005
+DURATION=3
+DEBOUNCE_US=1000
+BUILD=1
+NAME=drvsim
+CFG=/sys/kernel/config/gpio-sim/$NAME
+LATENCY=/sys/kernel/debug/ledkey/latency
+
+usage() {
+    echo "usage: $0 [-l NLEDS] [-k NKEYS] [-n EDGES] [-i INTERVAL] [-D SECONDS] [-B]" >&2
+    exit 2
+}
+
+while getopts "l:k:n:i:D:Bh" opt; do
+    case $opt in
+    l) NLEDS=$OPTARG ;;
+    k) NKEYS=$OPTARG ;;
+    n) EDGES=$OPTARG ;;
+    i) INTERVAL=$OPTARG ;;
+    D) DURATION=$OPTARG ;;
+    B) BUILD=0 ;;
+    *) usage ;;
+    esac
+done
+
+log() {
+    echo "run_sim: $*" >&2
+}
+
+die() {
+    log "$*"
+    exit 1
+}
+
+cleanup() {
+    for m in drvsim ledkey ledstest drvcore; do
+        rmmod $m 2>/dev/null
+    done
+    if [ -d "$CFG" ]; then
+        echo 0 > "$CFG/live" 2>/dev/null
+        rmdir "$CFG/bank0" "$CFG" 2>/dev/null
+    fi
+}
+
+[ "$(id -u)" -eq 0 ] || die "must run as root"
+
+# gpio-sim 的 configfs 接口和 pull 属性从 6.2 开始才有
+KREL=$(uname -r)
+kmaj=${KREL%%.*}
+kmin=${KREL#*.}
+kmin=${kmin%%[!0-9]*}
+[ "$kmaj" -gt 6 ] || { [ "$kmaj" -eq 6 ] && [ "$kmin" -ge 2 ]; } ||
+    die "kernel $KREL is older than 6.2, gpio-sim cannot be configured"
+for t in modprobe insmod rmmod; do
+    command -v $t >/dev/null || die "$t not found"
+done
+if [ "$BUILD" -eq 1 ] && [ ! -d "/lib/modules/$KREL/build" ]; then
+    die "no headers for $KREL in /lib/modules/$KREL/build, install them or use -B"
+fi
+
+echo "{\"test\":\"env\",\"kernel\":\"$KREL\",\"leds\":$NLEDS,\"keys\":$NKEYS,\"edges\":$EDGES,\"interval_s\":$INTERVAL,\"debounce_us\":$DEBOUNCE_US}"
+
+if [ "$BUILD" -eq 1 ]; then
+    make -C "$ROOT" MODULE_DIRS="core-test leds10-test ledkey-test sim-test" >&2 ||
+        die "module build failed"
+    make -C "$ROOT/bench" >&2 || die "bench build failed"
+fi
+
+trap cleanup EXIT INT TERM
+cleanup
+
+modprobe gpio-sim || die "gpio-sim not available (CONFIG_GPIO_SIM)"
+mountpoint -q /sys/kernel/config || mount -t configfs none /sys/kernel/config
+mountpoint -q /sys/kernel/debug || mount -t debugfs none /sys/kernel/debug
+
+# 一个 bank: LED 在前, 后面是按键/LED对
+mkdir "$CFG" "$CFG/bank0" || die "cannot create gpio-sim device"
+echo $((NLEDS + 2 * NKEYS)) > "$CFG/bank0/num_lines"
+echo "$NAME" > "$CFG/bank0/label"
+echo 1 > "$CFG/live" || die "cannot enable gpio-sim device"
+SIM=/sys/devices/platform/$(cat "$CFG/dev_name")/$(cat "$CFG/bank0/chip_name")
+[ -d "$SIM" ] || die "$SIM not found"
+
+insmod "$ROOT/core-test/drvcore.ko" || die "insmod drvcore failed"
+insmod "$ROOT/leds10-test/ledstest.ko" || die "insmod ledstest failed"
+insmod "$ROOT/ledkey-test/ledkey.ko" debounce_us=$DEBOUNCE_US || die "insmod ledkey failed"
+insmod "$ROOT/sim-test/drvsim.ko" chip=$NAME nleds=$NLEDS nkeys=$NKEYS ||
+    die "insmod drvsim failed"
+udevadm settle 2>/dev/null || sleep 1
+
+fail=0
+
+# ---- ledstest: 文本命令点亮/熄灭每个LED, 检查线上的电平 ----
+if [ "$NLEDS" -gt 0 ]; then
+    [ -e /dev/led_control ] || die "/dev/led_control not found, led_control did not bind"
+    bad=0
+    for v in 1 0; do
+        i=0
+        while [ "$i" -lt "$NLEDS" ]; do
+            echo "led$((i + 1)) $v" > /dev/led_control
+            got=$(cat "$SIM/sim_gpio$i/value")
+            if [ "$got" != "$v" ]; then
+                log "led$((i + 1)): wrote $v, line is $got"
+                bad=$((bad + 1))
+            fi
+            i=$((i + 1))
+        done
+    done
+    echo "{\"test\":\"led_verify\",\"leds\":$NLEDS,\"checks\":$((2 * NLEDS)),\"mismatches\":$bad}"
+    fail=$((fail + bad))
+
+    "$ROOT/bench/drvbench" -j -d led -t 1 -r 1 -D "$DURATION"
+    "$ROOT/bench/drvbench" -j -d led -t 1 -r 1 -D "$DURATION" -x
+fi
+
+# ---- ledkey: 按键线上注入边沿, LED 应该跟随(默认规则 MOMENTARY) ----
+if [ "$NKEYS" -gt 0 ]; then
+    [ -e "$LATENCY" ] || die "$LATENCY not found, ledkey did not bind"
+    k=0
+    while [ "$k" -lt "$NKEYS" ]; do
+        key=$((NLEDS + 2 * k))
+        led=$((key + 1))
+        echo pull-down > "$SIM/sim_gpio$key/pull"
+        sleep "$INTERVAL"
+        echo 0 > "$LATENCY"
+
+        bad=0
+        i=0
+        start=$(date +%s%N)
+        while [ "$i" -lt "$EDGES" ]; do
+            v=$(((i + 1) % 2))
+            if [ "$v" -eq 1 ]; then
+                echo pull-up > "$SIM/sim_gpio$key/pull"
+            else
+                echo pull-down > "$SIM/sim_gpio$key/pull"
+            fi
+            sleep "$INTERVAL"
+            got=$(cat "$SIM/sim_gpio$led/value")
+            if [ "$got" != "$v" ]; then
+                log "KEY$((k + 1)) edge $i: key=$v led=$got"
+                bad=$((bad + 1))
+            fi
+            i=$((i + 1))
+        done
+        end=$(date +%s%N)
+        echo pull-down > "$SIM/sim_gpio$key/pull"
+
+        # "KEY1 led: count=N min=.. avg=.. max=.. p50=.. p90=.. p99=.. p999=.."
+        line=$(grep "^KEY$((k + 1)) led:" "$LATENCY")
+        stats=$(echo "$line" | sed -n 's/.*count=\([0-9]*\).* min=\([0-9]*\) avg=\([0-9]*\) max=\([0-9]*\) p50=\([0-9]*\) p90=\([0-9]*\) p99=\([0-9]*\) p999=\([0-9]*\).*/"count":\1,"min_ns":\2,"avg_ns":\3,"max_ns":\4,"p50_ns":\5,"p90_ns":\6,"p99_ns":\7,"p999_ns":\8/p')
+        [ -n "$stats" ] || stats='"count":0'
+        echo "{\"test\":\"ledkey_edges\",\"key\":$((k + 1)),\"edges\":$EDGES,\"mismatches\":$bad,\"edges_per_s\":$((EDGES * 1000000000 / (end - start))),$stats}"
+        fail=$((fail + bad))
+        k=$((k + 1))
+    done
+    cat "$LATENCY" >&2
+fi
+
+[ "$fail" -eq 0 ]
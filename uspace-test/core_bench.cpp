@@ -0,0 +1,177 @@
+/*
+ * 驱动核心头文件的微基准. 结果是本机用户空间的 ns/op, 和板子上的绝对值不同,
+ * 用来比较环形缓冲区布局、解析器等改动前后的差别:
+ *
+ *   core_bench --benchmark_out=before.json --benchmark_out_format=json
+ *   (改代码, 重新编译)
+ *   core_bench --benchmark_out=after.json --benchmark_out_format=json
+ *   compare.py benchmarks before.json after.json    # Google Benchmark 自带的脚本
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include "drvcore_ring.h"
+#include "globalfifo_core.h"
+#include "globalmem_bounds.h"
+#include "ledstest_cmd.h"
+
+/* ---- drvcore_spsc ---- */
+
+// 4KB 环形缓冲区(globalfifo 的大小)里放入再取出 size 字节
+static void BM_SpscPutGet(benchmark::State &state)
+{
+    unsigned int size = state.range(0);
+    std::vector<char> buf(size);
+    struct drvcore_spsc r;
+
+    drvcore_spsc_init(&r, 4096);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(drvcore_spsc_put(&r, buf.data(), size));
+        benchmark::DoNotOptimize(drvcore_spsc_get(&r, buf.data(), size));
+    }
+    state.SetBytesProcessed(state.iterations() * size);
+    drvcore_spsc_free(&r);
+}
+BENCHMARK(BM_SpscPutGet)->Arg(1)->Arg(16)->Arg(64)->Arg(512)->Arg(4096);
+
+// 走 copy_*_user 的路径, 用户空间里就是 memcpy 加上 fault 检查
+static void BM_SpscUserCopy(benchmark::State &state)
+{
+    unsigned int size = state.range(0);
+    std::vector<char> buf(size);
+    struct drvcore_spsc r;
+
+    drvcore_spsc_init(&r, 4096);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(drvcore_spsc_from_user(&r, buf.data(), size));
+        benchmark::DoNotOptimize(drvcore_spsc_to_user(&r, buf.data(), size));
+    }
+    state.SetBytesProcessed(state.iterations() * size);
+    drvcore_spsc_free(&r);
+}
+BENCHMARK(BM_SpscUserCopy)->Arg(16)->Arg(4096);
+
+/* ---- drvcore_mpsc ---- */
+
+// ledkey 的事件是 16 字节
+static void BM_MpscPushPop(benchmark::State &state)
+{
+    struct drvcore_mpsc q;
+    char elem[16] = {}, out[16];
+
+    drvcore_mpsc_init(&q, 64, sizeof(elem));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(drvcore_mpsc_push(&q, elem));
+        benchmark::DoNotOptimize(drvcore_mpsc_pop(&q, out));
+    }
+    state.SetItemsProcessed(state.iterations());
+    drvcore_mpsc_free(&q);
+}
+BENCHMARK(BM_MpscPushPop);
+
+/* ---- globalfifo_core ---- */
+
+// 单线程非阻塞写再读, 包括加锁和唤醒的开销
+static void BM_FifoRoundTrip(benchmark::State &state)
+{
+    size_t size = state.range(0);
+    std::vector<char> buf(size);
+    struct globalfifo_core c;
+
+    globalfifo_core_init(&c, 4096);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(globalfifo_core_write(&c, buf.data(), size, true));
+        benchmark::DoNotOptimize(globalfifo_core_read(&c, buf.data(), size, true));
+    }
+    state.SetBytesProcessed(state.iterations() * size);
+    globalfifo_core_free(&c);
+}
+BENCHMARK(BM_FifoRoundTrip)->Arg(16)->Arg(512)->Arg(4096);
+
+/*
+ * 一个写线程一个读线程, 阻塞模式, 每次迭代各自搬完 size 字节. 两个线程的迭代次数相同,
+ * 所以总量对得上. 缓冲区在所有运行之间共用, 每次运行结束时是空的.
+ */
+static struct globalfifo_core shared_fifo;
+static std::once_flag shared_fifo_once;
+
+static void BM_FifoThreaded(benchmark::State &state)
+{
+    size_t size = state.range(0);
+    std::vector<char> buf(size);
+    bool writer = state.thread_index() == 0;
+
+    std::call_once(shared_fifo_once, [] { globalfifo_core_init(&shared_fifo, 4096); });
+    for (auto _ : state) {
+        size_t done = 0;
+
+        while (done < size) {
+            long ret = writer ?
+                globalfifo_core_write(&shared_fifo, buf.data() + done, size - done, false) :
+                globalfifo_core_read(&shared_fifo, buf.data() + done, size - done, false);
+
+            if (ret <= 0) {
+                state.SkipWithError("fifo read/write failed");
+                return;
+            }
+            done += ret;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_FifoThreaded)->Arg(64)->Arg(1024)->Threads(2)->UseRealTime();
+
+/* ---- ledstest_cmd ---- */
+
+static const char *const led_cmds[] = {
+    "led1 1\n", "led4 0\n", "led12 1\n", "led 3 0\n", "led9 7\n", "led1\n",
+};
+
+static void BM_LedParseCmd(benchmark::State &state)
+{
+    unsigned int led, i = 0;
+    int value;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(led_parse_cmd(led_cmds[i], 16, &led, &value));
+        i = (i + 1) % (sizeof(led_cmds) / sizeof(led_cmds[0]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LedParseCmd);
+
+// 对照: 换成 led_parse_cmd 之前 led_write 用的 sscanf (这里是 glibc 的)
+static void BM_LedSscanf(benchmark::State &state)
+{
+    unsigned int i = 0;
+    int led, value;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sscanf(led_cmds[i], "led%d %d", &led, &value));
+        i = (i + 1) % (sizeof(led_cmds) / sizeof(led_cmds[0]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LedSscanf);
+
+/* ---- globalmem_bounds ---- */
+
+static void BM_GlobalmemClampSeek(benchmark::State &state)
+{
+    s64 pos = 0;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(globalmem_clamp(1 << 20, pos, 4096));
+        pos = globalmem_seek(1 << 20, pos, 4096, 1);
+        if (pos < 0)
+            pos = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GlobalmemClampSeek);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,323 @@
+/*
+ * 驱动核心头文件的单元测试: 环形缓冲区, globalfifo 读写, globalmem 边界, LED 命令解析
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "drvcore_ring.h"
+#include "globalfifo_core.h"
+#include "globalmem_bounds.h"
+#include "ledstest_cmd.h"
+
+#include "cores_c.h"
+
+/* ---- drvcore_spsc ---- */
+
+TEST(Spsc, RejectsBadSize)
+{
+    struct drvcore_spsc r;
+
+    EXPECT_EQ(drvcore_spsc_init(&r, 0), -EINVAL);
+    EXPECT_EQ(drvcore_spsc_init(&r, 12), -EINVAL);
+}
+
+TEST(Spsc, WrapsAround)
+{
+    struct drvcore_spsc r;
+    char out[8];
+
+    ASSERT_EQ(drvcore_spsc_init(&r, 8), 0);
+    EXPECT_EQ(drvcore_spsc_put(&r, "abcdef", 6), 6u);
+    EXPECT_EQ(drvcore_spsc_get(&r, out, 4), 4u);
+    EXPECT_EQ(memcmp(out, "abcd", 4), 0);
+    // 剩下 "ef", 再放6个字节会绕过缓冲区末尾
+    EXPECT_EQ(drvcore_spsc_put(&r, "ghijkl", 6), 6u);
+    EXPECT_EQ(drvcore_spsc_len(&r), 8u);
+    EXPECT_EQ(drvcore_spsc_space(&r), 0u);
+    EXPECT_EQ(drvcore_spsc_put(&r, "z", 1), 0u);
+    EXPECT_EQ(drvcore_spsc_peek(&r, out, 8), 8u);
+    EXPECT_EQ(memcmp(out, "efghijkl", 8), 0);
+    EXPECT_EQ(drvcore_spsc_discard(&r), 8u);
+    EXPECT_EQ(drvcore_spsc_len(&r), 0u);
+    drvcore_spsc_free(&r);
+}
+
+TEST(Spsc, CountersWrapAt32Bits)
+{
+    struct drvcore_spsc r;
+    char out[5];
+
+    ASSERT_EQ(drvcore_spsc_init(&r, 8), 0);
+    r.head = r.tail = UINT_MAX - 2;
+    EXPECT_EQ(drvcore_spsc_put(&r, "hello", 5), 5u);
+    EXPECT_EQ(drvcore_spsc_len(&r), 5u);
+    EXPECT_EQ(drvcore_spsc_get(&r, out, 5), 5u);
+    EXPECT_EQ(memcmp(out, "hello", 5), 0);
+    EXPECT_EQ(drvcore_spsc_space(&r), 8u);
+    drvcore_spsc_free(&r);
+}
+
+TEST(Spsc, FaultCommitsNothing)
+{
+    struct drvcore_spsc r;
+
+    ASSERT_EQ(drvcore_spsc_init(&r, 8), 0);
+    EXPECT_EQ(drvcore_spsc_from_user(&r, nullptr, 4), -EFAULT);
+    EXPECT_EQ(drvcore_spsc_len(&r), 0u);
+    EXPECT_EQ(drvcore_spsc_from_user(&r, "abcd", 4), 4);
+    EXPECT_EQ(drvcore_spsc_to_user(&r, nullptr, 4), -EFAULT);
+    EXPECT_EQ(drvcore_spsc_len(&r), 4u);
+    drvcore_spsc_free(&r);
+}
+
+/* ---- drvcore_mpsc ---- */
+
+TEST(Mpsc, OrderAndOverflow)
+{
+    struct drvcore_mpsc q;
+    int v;
+
+    ASSERT_EQ(drvcore_mpsc_init(&q, 4, sizeof(int)), 0);
+    EXPECT_TRUE(drvcore_mpsc_empty(&q));
+    for (int i = 0; i < 4; i++)
+        EXPECT_TRUE(drvcore_mpsc_push(&q, &i));
+    v = 99;
+    EXPECT_FALSE(drvcore_mpsc_push(&q, &v));
+    EXPECT_EQ(drvcore_mpsc_overflows(&q), 1u);
+    for (int i = 0; i < 4; i++) {
+        ASSERT_TRUE(drvcore_mpsc_pop(&q, &v));
+        EXPECT_EQ(v, i);
+    }
+    EXPECT_FALSE(drvcore_mpsc_pop(&q, &v));
+    drvcore_mpsc_free(&q);
+}
+
+TEST(Mpsc, ConcurrentProducers)
+{
+    constexpr int kProducers = 4, kPerProducer = 20000;
+    struct drvcore_mpsc q;
+    std::vector<std::thread> producers;
+    std::vector<int> next(kProducers, 0);
+    uint32_t rec;
+    int got = 0;
+
+    ASSERT_EQ(drvcore_mpsc_init(&q, 64, sizeof(rec)), 0);
+    for (int p = 0; p < kProducers; p++)
+        producers.emplace_back([&q, p] {
+            for (int i = 0; i < kPerProducer; i++) {
+                uint32_t r = (uint32_t)p << 24 | i;
+
+                while (!drvcore_mpsc_push(&q, &r))
+                    std::this_thread::yield();
+            }
+        });
+
+    // 每个生产者自己的记录必须按顺序出现, 一条不丢
+    while (got < kProducers * kPerProducer) {
+        if (!drvcore_mpsc_pop(&q, &rec)) {
+            std::this_thread::yield();
+            continue;
+        }
+        int p = rec >> 24;
+
+        ASSERT_LT(p, kProducers);
+        ASSERT_EQ((int)(rec & 0xffffff), next[p]);
+        next[p]++;
+        got++;
+    }
+    for (auto &t : producers)
+        t.join();
+    EXPECT_TRUE(drvcore_mpsc_empty(&q));
+    drvcore_mpsc_free(&q);
+}
+
+/* ---- globalfifo_core ---- */
+
+class FifoCore : public ::testing::Test {
+protected:
+    void SetUp() override { ASSERT_EQ(globalfifo_core_init(&c, 64), 0); }
+    void TearDown() override { globalfifo_core_free(&c); }
+
+    struct globalfifo_core c;
+};
+
+TEST_F(FifoCore, NonblockEmptyAndFull)
+{
+    char buf[128] = {};
+
+    EXPECT_EQ(globalfifo_core_read(&c, buf, 16, true), -EAGAIN);
+    // 写入量被剩余空间截断
+    EXPECT_EQ(globalfifo_core_write(&c, buf, sizeof(buf), true), 64);
+    EXPECT_EQ(globalfifo_core_write(&c, buf, 1, true), -EAGAIN);
+    EXPECT_EQ(globalfifo_core_read(&c, buf, sizeof(buf), true), 64);
+}
+
+TEST_F(FifoCore, FaultLeavesData)
+{
+    char buf[4];
+
+    EXPECT_EQ(globalfifo_core_write(&c, nullptr, 4, true), -EFAULT);
+    EXPECT_EQ(globalfifo_core_len(&c), 0u);
+    EXPECT_EQ(globalfifo_core_write(&c, "wxyz", 4, true), 4);
+    EXPECT_EQ(globalfifo_core_read(&c, nullptr, 4, true), -EFAULT);
+    EXPECT_EQ(globalfifo_core_len(&c), 4u);
+    EXPECT_EQ(globalfifo_core_read(&c, buf, 4, true), 4);
+    EXPECT_EQ(memcmp(buf, "wxyz", 4), 0);
+}
+
+TEST_F(FifoCore, PeekDoesNotConsume)
+{
+    unsigned char head[2];
+    unsigned int used;
+
+    EXPECT_EQ(globalfifo_core_write(&c, "abc", 3, true), 3);
+    EXPECT_EQ(globalfifo_core_peek(&c, head, sizeof(head), &used), 2u);
+    EXPECT_EQ(used, 3u);
+    EXPECT_EQ(globalfifo_core_len(&c), 3u);
+}
+
+TEST_F(FifoCore, ClearWakesBlockedWriter)
+{
+    char buf[64] = {};
+    std::atomic<long> ret{0};
+
+    ASSERT_EQ(globalfifo_core_write(&c, buf, sizeof(buf), true), 64);
+    std::thread writer([&] { ret = globalfifo_core_write(&c, "q", 1, false); });
+    globalfifo_core_clear(&c);
+    writer.join();
+    EXPECT_EQ(ret, 1);
+}
+
+TEST_F(FifoCore, BlockingStreamKeepsOrder)
+{
+    constexpr size_t kTotal = 1 << 20;
+
+    // 写者用长短不一的块写入递增的字节序列, 读者检查收到的顺序
+    std::thread writer([this] {
+        unsigned char chunk[97];
+        size_t sent = 0, n = 1;
+
+        while (sent < kTotal) {
+            size_t len = std::min(kTotal - sent, n);
+
+            for (size_t i = 0; i < len; i++)
+                chunk[i] = (unsigned char)(sent + i);
+            size_t off = 0;
+            while (off < len) {
+                long ret = globalfifo_core_write(&c, (const char *)chunk + off, len - off, false);
+
+                ASSERT_GT(ret, 0);
+                off += ret;
+            }
+            sent += len;
+            n = n % sizeof(chunk) + 1;
+        }
+    });
+
+    unsigned char buf[53];
+    size_t recv = 0;
+
+    while (recv < kTotal) {
+        long ret = globalfifo_core_read(&c, (char *)buf, sizeof(buf), false);
+
+        ASSERT_GT(ret, 0);
+        for (long i = 0; i < ret; i++)
+            ASSERT_EQ(buf[i], (unsigned char)(recv + i)) << "at byte " << recv + i;
+        recv += ret;
+    }
+    writer.join();
+    EXPECT_EQ(globalfifo_core_len(&c), 0u);
+}
+
+/* ---- globalmem_bounds ---- */
+
+TEST(GlobalmemBounds, Clamp)
+{
+    EXPECT_EQ(globalmem_clamp(4096, 0, 100), 100u);
+    EXPECT_EQ(globalmem_clamp(4096, 4000, 200), 96u);
+    EXPECT_EQ(globalmem_clamp(4096, 4096, 1), 0u);
+    EXPECT_EQ(globalmem_clamp(4096, -1, 1), 0u);
+    EXPECT_EQ(globalmem_clamp(4096, 0, SIZE_MAX), 4096u);
+}
+
+TEST(GlobalmemBounds, Seek)
+{
+    EXPECT_EQ(globalmem_seek(4096, 100, 4096, 0), 4096);
+    EXPECT_EQ(globalmem_seek(4096, 100, 4097, 0), -EINVAL);
+    EXPECT_EQ(globalmem_seek(4096, 100, -1, 0), -EINVAL);
+    EXPECT_EQ(globalmem_seek(4096, 100, -100, 1), 0);
+    EXPECT_EQ(globalmem_seek(4096, 100, -101, 1), -EINVAL);
+    EXPECT_EQ(globalmem_seek(4096, 100, 3996, 1), 4096);
+    EXPECT_EQ(globalmem_seek(4096, 100, 0, 2), -EINVAL);
+    // 以前 f_pos + offset 会有符号溢出
+    EXPECT_EQ(globalmem_seek(4096, 4096, INT64_MAX, 1), -EINVAL);
+    EXPECT_EQ(globalmem_seek(4096, 0, INT64_MIN, 1), -EINVAL);
+    EXPECT_EQ(globalmem_seek(4096, -5, 10, 1), -EINVAL);
+}
+
+TEST(GlobalmemBounds, RangeOk)
+{
+    EXPECT_TRUE(globalmem_range_ok(4096, 0, 4096));
+    EXPECT_TRUE(globalmem_range_ok(4096, 4096, 0));
+    EXPECT_FALSE(globalmem_range_ok(4096, 4096, 1));
+    EXPECT_FALSE(globalmem_range_ok(4096, 1, UINT64_MAX));
+}
+
+/* ---- ledstest_cmd ---- */
+
+struct CmdCase {
+    const char *cmd;
+    int ret;
+    unsigned int led;
+    int value;
+};
+
+TEST(LedCmd, Table)
+{
+    static const CmdCase cases[] = {
+        { "led1 1", 0, 1, 1 },
+        { "led4 0\n", 0, 4, 0 },
+        { "led 2 1", 0, 2, 1 },
+        { "led2\t1 trailing", 0, 2, 1 },
+        { "led3\xa0" "0", 0, 3, 0 },
+        { "led001 01", 0, 1, 1 },
+        { "led5 1", -ERANGE, 0, 0 },
+        { "led0 1", -ERANGE, 0, 0 },
+        { "led-1 1", -ERANGE, 0, 0 },
+        { "led4294967297 1", -ERANGE, 0, 0 },
+        { "led1 2", -EDOM, 0, 0 },
+        { "led1 -1", -EDOM, 0, 0 },
+        { "led1", -EINVAL, 0, 0 },
+        { "led1 ", -EINVAL, 0, 0 },
+        { "led+1 1", -EINVAL, 0, 0 },
+        { "led1 +1", -EINVAL, 0, 0 },
+        { "led- 1", -EINVAL, 0, 0 },
+        { "LED1 1", -EINVAL, 0, 0 },
+        { " led1 1", -EINVAL, 0, 0 },
+        { "le", -EINVAL, 0, 0 },
+        { "", -EINVAL, 0, 0 },
+    };
+
+    for (const auto &tc : cases) {
+        unsigned int led = 0;
+        int value = -1;
+
+        EXPECT_EQ(led_parse_cmd(tc.cmd, 4, &led, &value), tc.ret) << tc.cmd;
+        if (tc.ret == 0) {
+            EXPECT_EQ(led, tc.led) << tc.cmd;
+            EXPECT_EQ(value, tc.value) << tc.cmd;
+        }
+    }
+}
+
+TEST(CoresC, Selftest)
+{
+    EXPECT_EQ(cores_c_selftest(), 0);
+}
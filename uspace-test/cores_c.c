@@ -0,0 +1,38 @@
+/*
+ * 按C编译所有驱动核心头文件, 和内核里一样. 自检函数由 core_test 调用.
+ */
+
+#include "drvcore_ring.h"
+#include "globalfifo_core.h"
+#include "globalmem_bounds.h"
+#include "ledstest_cmd.h"
+
+#include "cores_c.h"
+
+int cores_c_selftest(void)
+{
+    struct globalfifo_core c;
+    struct drvcore_mpsc q;
+    char buf[8];
+    unsigned int led;
+    int value, x = 42;
+
+    if (globalfifo_core_init(&c, 16))
+        return -1;
+    if (globalfifo_core_write(&c, "abc", 3, true) != 3 ||
+        globalfifo_core_read(&c, buf, sizeof(buf), true) != 3 || memcmp(buf, "abc", 3))
+        return -2;
+    globalfifo_core_free(&c);
+
+    if (drvcore_mpsc_init(&q, 4, sizeof(int)))
+        return -3;
+    if (!drvcore_mpsc_push(&q, &x) || !drvcore_mpsc_pop(&q, &value) || value != 42)
+        return -4;
+    drvcore_mpsc_free(&q);
+
+    if (globalmem_clamp(4096, 4000, 200) != 96 || globalmem_seek(4096, 10, -10, 1) != 0)
+        return -5;
+    if (led_parse_cmd("led2 1\n", 4, &led, &value) || led != 2 || value != 1)
+        return -6;
+    return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef _CORES_C_H
+#define _CORES_C_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 按C编译的头文件做一遍简单操作, 成功返回0
+int cores_c_selftest(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CORES_C_H */
@@ -0,0 +1,50 @@
+/*
+ * 模糊测试目标的公共部分. 每个 fuzz_*.cpp 定义 LLVMFuzzerTestOneInput 和一组种子,
+ * 种子只给 fuzz_main.cpp 的简单驱动用, libFuzzer 从语料目录或空输入开始.
+ */
+
+#ifndef _FUZZ_H
+#define _FUZZ_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+struct fuzz_seed {
+    const char *data;
+    size_t len;
+};
+
+#define FUZZ_SEED(s) { s, sizeof(s) - 1 }
+
+extern const fuzz_seed fuzz_seeds[];
+extern const size_t fuzz_nseeds;
+
+// 不变式不成立时打印并中止, libFuzzer 和 ASan 会把输入保存下来
+#define FUZZ_CHECK(cond)                                                    \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            abort();                                                        \
+        }                                                                   \
+    } while (0)
+
+// 从输入里按顺序取值, 取完之后都是0
+struct fuzz_input {
+    const uint8_t *p;
+    size_t left;
+
+    template <typename T> T take()
+    {
+        T v = 0;
+
+        for (size_t i = 0; i < sizeof(T) && left; i++, left--)
+            v = (T)(v | (T)((uint64_t)*p++ << (8 * i)));
+        return v;
+    }
+};
+
+#endif /* _FUZZ_H */
@@ -0,0 +1,58 @@
+/*
+ * globalmem_bounds.h 的模糊测试: 用 __int128 算出不会溢出的结果, 和 globalmem_clamp,
+ * globalmem_seek, globalmem_range_ok 比较. 设备大小限制在 S64_MAX 以内(内核里是
+ * unsigned long, 不会更大), 位置和偏移取任意值.
+ */
+
+#include <algorithm>
+
+#include "fuzz.h"
+
+#include "globalmem_bounds.h"
+
+extern const fuzz_seed fuzz_seeds[] = {
+    // size, pos, offset/count, whence
+    FUZZ_SEED("\x00\x10\x00\x00\x00\x00\x00\x00" "\x64\x00\x00\x00\x00\x00\x00\x00"
+              "\x9c\xff\xff\xff\xff\xff\xff\xff" "\x01"),
+    FUZZ_SEED("\x00\x10\x00\x00\x00\x00\x00\x00" "\x00\x10\x00\x00\x00\x00\x00\x00"
+              "\xff\xff\xff\xff\xff\xff\xff\x7f" "\x01"),
+    FUZZ_SEED("\xff\xff\xff\xff\xff\xff\xff\x7f" "\xff\xff\xff\xff\xff\xff\xff\x7f"
+              "\x00\x00\x00\x00\x00\x00\x00\x80" "\x00"),
+};
+extern const size_t fuzz_nseeds = sizeof(fuzz_seeds) / sizeof(fuzz_seeds[0]);
+
+typedef __int128 s128;
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    fuzz_input in{data, size};
+    u64 dev_size = in.take<u64>() & INT64_MAX;
+    s64 pos = (s64)in.take<u64>();
+    s64 offset = (s64)in.take<u64>();
+    int whence = in.take<uint8_t>() % 4;
+    size_t count = (size_t)offset;
+    s128 base, target;
+    s64 ret;
+
+    // clamp: 位置在设备内时取 count 和剩余字节数中较小的一个
+    size_t n = globalmem_clamp(dev_size, pos, count);
+
+    if (pos < 0 || (s128)pos >= (s128)dev_size)
+        FUZZ_CHECK(n == 0);
+    else
+        FUZZ_CHECK((s128)n == std::min<s128>(count, (s128)dev_size - pos));
+
+    // seek: 0 从开头, 1 从当前位置, 结果必须落在 [0, dev_size]
+    ret = globalmem_seek(dev_size, pos, offset, whence);
+    base = whence == 0 ? 0 : pos;
+    target = base + offset;
+    if (whence > 1 || base < 0 || base > (s128)dev_size || target < 0 || target > (s128)dev_size)
+        FUZZ_CHECK(ret == -EINVAL);
+    else
+        FUZZ_CHECK((s128)ret == target);
+
+    // range_ok: [offset, offset + len) 在设备内
+    FUZZ_CHECK(globalmem_range_ok(dev_size, (u64)pos, (u64)offset) ==
+               ((s128)(u64)pos + (s128)(u64)offset <= (s128)dev_size));
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * led_parse_cmd 的模糊测试. 第一个字节给出LED个数(0..64), 其余部分按 led_write 的方式
+ * 截到31字节作为命令. 总是检查返回值和输出的范围; 输入里没有 glibc 和内核解释不同
+ * 的东西('+' 号, 非ASCII字节, 会溢出的长数字)时, 再和 sscanf("led%d %d") 比较.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "fuzz.h"
+
+#include "ledstest_cmd.h"
+
+extern const fuzz_seed fuzz_seeds[] = {
+    FUZZ_SEED("\x04" "led1 1\n"),
+    FUZZ_SEED("\x04" "led4 0"),
+    FUZZ_SEED("\x40" "led64 1"),
+    FUZZ_SEED("\x08" "led 3\t\v-0"),
+    FUZZ_SEED("\x04" "led-1 1"),
+    FUZZ_SEED("\x04" "led2 2"),
+    FUZZ_SEED("\x04" "led4294967297 1"),
+    FUZZ_SEED("\x04" "led1\xa0" "1"),
+    FUZZ_SEED("\x04" "led+1 1"),
+    FUZZ_SEED("\x04" "led1"),
+};
+extern const size_t fuzz_nseeds = sizeof(fuzz_seeds) / sizeof(fuzz_seeds[0]);
+
+// glibc 的 sscanf 和内核的 vsscanf 对这个输入的解释是否相同
+static bool sscanf_comparable(const char *s)
+{
+    unsigned int digits = 0;
+
+    for (; *s; s++) {
+        unsigned char c = *s;
+
+        if (c >= 0x80 || c == '+')
+            return false;
+        digits = (c >= '0' && c <= '9') ? digits + 1 : 0;
+        if (digits > 9)
+            return false;
+    }
+    return true;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    unsigned int nleds, led = 0;
+    int value = -1, ret;
+    char cmd[32];
+
+    if (!size)
+        return 0;
+    nleds = data[0] % 65;
+    size = std::min<size_t>(size - 1, sizeof(cmd) - 1);
+    memcpy(cmd, data + 1, size);
+    cmd[size] = '\0';
+
+    ret = led_parse_cmd(cmd, nleds, &led, &value);
+    FUZZ_CHECK(ret == 0 || ret == -EINVAL || ret == -ERANGE || ret == -EDOM);
+    if (ret == 0)
+        FUZZ_CHECK(led >= 1 && led <= nleds && (value == 0 || value == 1));
+
+    if (sscanf_comparable(cmd)) {
+        int n, v, expect;
+
+        if (sscanf(cmd, "led%d %d", &n, &v) != 2)
+            expect = -EINVAL;
+        else if (n < 1 || (unsigned int)n > nleds)
+            expect = -ERANGE;
+        else if (v != 0 && v != 1)
+            expect = -EDOM;
+        else
+            expect = 0;
+        FUZZ_CHECK(ret == expect);
+        if (ret == 0)
+            FUZZ_CHECK((int)led == n && value == v);
+    }
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * 没有 libFuzzer(比如只有 gcc)时的模糊测试驱动.
+ *
+ * 和 libFuzzer 一样接受 -runs=N 和语料文件/目录, 另外有 -seed=S. 给了语料就逐个运行,
+ * 然后从种子出发做 N 次随机变异(翻转、插入、删除、复制字节), 随机数种子固定,
+ * 失败可以复现. 没有覆盖率反馈, 所以靠种子把输入带到有意思的格式附近.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "fuzz.h"
+
+namespace fs = std::filesystem;
+
+static const size_t kMaxLen = 256;
+
+// 单独分配正好 len 字节, 越界读能被 ASan 发现
+static void run_one(const std::vector<uint8_t> &in)
+{
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[in.size()]);
+
+    std::copy(in.begin(), in.end(), buf.get());
+    LLVMFuzzerTestOneInput(buf.get(), in.size());
+}
+
+static void run_file(const fs::path &path)
+{
+    std::ifstream f(path, std::ios::binary);
+    std::vector<uint8_t> in((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+    run_one(in);
+}
+
+static uint8_t interesting_byte(std::mt19937_64 &rng)
+{
+    static const uint8_t bytes[] = {
+        0, 1, 0x7f, 0x80, 0xa0, 0xff, ' ', '\t', '\n', '-', '+', '0', '1', '9',
+    };
+
+    return bytes[rng() % sizeof(bytes)];
+}
+
+static void mutate(std::vector<uint8_t> &in, std::mt19937_64 &rng)
+{
+    unsigned int n = 1 + rng() % 4;
+
+    while (n--) {
+        size_t pos = in.empty() ? 0 : rng() % in.size();
+
+        switch (rng() % 6) {
+        case 0:     // 翻转一位
+            if (!in.empty())
+                in[pos] ^= 1u << (rng() % 8);
+            break;
+        case 1:     // 换成随机或特殊字节
+            if (!in.empty())
+                in[pos] = rng() % 2 ? (uint8_t)rng() : interesting_byte(rng);
+            break;
+        case 2:     // 插入
+            if (in.size() < kMaxLen)
+                in.insert(in.begin() + pos, rng() % 2 ? (uint8_t)rng() : interesting_byte(rng));
+            break;
+        case 3:     // 删除
+            if (!in.empty())
+                in.erase(in.begin() + pos);
+            break;
+        case 4: {   // 复制一段到别处
+            if (in.empty() || in.size() >= kMaxLen)
+                break;
+            size_t len = 1 + rng() % std::min<size_t>(in.size() - pos, 16);
+            std::vector<uint8_t> piece(in.begin() + pos, in.begin() + pos + len);
+            size_t to = rng() % (in.size() + 1);
+
+            in.insert(in.begin() + to, piece.begin(), piece.end());
+            if (in.size() > kMaxLen)
+                in.resize(kMaxLen);
+            break;
+        }
+        default:    // 追加随机字节
+            for (unsigned int i = rng() % 8; i && in.size() < kMaxLen; i--)
+                in.push_back((uint8_t)rng());
+            break;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long runs = 100000;
+    unsigned long seed = 1;
+    std::vector<fs::path> corpus;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "-runs=", 6))
+            runs = strtoul(argv[i] + 6, NULL, 0);
+        else if (!strncmp(argv[i], "-seed=", 6))
+            seed = strtoul(argv[i] + 6, NULL, 0);
+        else if (argv[i][0] == '-')
+            continue;   // 其他 libFuzzer 参数忽略
+        else
+            corpus.push_back(argv[i]);
+    }
+
+    for (const auto &p : corpus) {
+        if (fs::is_directory(p)) {
+            for (const auto &e : fs::directory_iterator(p))
+                if (e.is_regular_file())
+                    run_file(e.path());
+        } else {
+            run_file(p);
+        }
+    }
+
+    std::mt19937_64 rng(seed);
+    std::vector<uint8_t> in;
+
+    for (size_t i = 0; i < fuzz_nseeds; i++) {
+        in.assign(fuzz_seeds[i].data, fuzz_seeds[i].data + fuzz_seeds[i].len);
+        run_one(in);
+    }
+    for (unsigned long r = 0; r < runs; r++) {
+        // 大多数从种子变异, 少数完全随机
+        if (fuzz_nseeds && rng() % 8) {
+            const fuzz_seed &s = fuzz_seeds[rng() % fuzz_nseeds];
+
+            in.assign(s.data, s.data + s.len);
+        } else {
+            in.resize(rng() % 64);
+            for (auto &b : in)
+                b = (uint8_t)rng();
+        }
+        mutate(in, rng);
+        run_one(in);
+    }
+
+    printf("%s: %zu corpus inputs, %zu seeds, %lu mutated runs, seed %lu\n",
+           argv[0], corpus.size(), fuzz_nseeds, runs, seed);
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * 环形缓冲区的模糊测试: 输入是一串操作, 同时作用在 drvcore_spsc/drvcore_mpsc 和
+ * std::deque 模型上, 每一步比较返回值、长度和取出的数据. 计数器从任意值开始,
+ * 覆盖32位回绕.
+ */
+
+#include <algorithm>
+#include <deque>
+
+#include "fuzz.h"
+
+#include "drvcore_ring.h"
+
+extern const fuzz_seed fuzz_seeds[] = {
+    FUZZ_SEED("\x03\xfc\xff\xff\xff" "\x00\x05\x01\x03\x00\x07\x04\x09\x05\x02\x03\x00"),
+    FUZZ_SEED("\x07\x00\x00\x00\x00" "\x00\xff\x04\x10\x02\x20\x01\xff\x06\x08\x05\x08"),
+    FUZZ_SEED("\x02\x00\x00\x00\x80" "\x80\x01\x80\x02\x80\x03\x80\x04\x80\x05\x81\x00\x81\x00"),
+};
+extern const size_t fuzz_nseeds = sizeof(fuzz_seeds) / sizeof(fuzz_seeds[0]);
+
+static void check_spsc(const struct drvcore_spsc *r, const std::deque<uint8_t> &model)
+{
+    FUZZ_CHECK(drvcore_spsc_len(r) == model.size());
+    FUZZ_CHECK(drvcore_spsc_space(r) == r->size - model.size());
+}
+
+// 从模型开头取 n 个字节和 out 比较, take 为真时同时取走
+static void expect_front(std::deque<uint8_t> &model, const uint8_t *out, unsigned int n, bool take)
+{
+    FUZZ_CHECK(n <= model.size());
+    for (unsigned int i = 0; i < n; i++)
+        FUZZ_CHECK(out[i] == model[i]);
+    if (take)
+        model.erase(model.begin(), model.begin() + n);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    fuzz_input in{data, size};
+    unsigned int ring_size = 1u << (in.take<uint8_t>() % 9);    // 1 .. 256
+    unsigned int start = in.take<uint32_t>();
+    struct drvcore_spsc r;
+    struct drvcore_mpsc q;
+    std::deque<uint8_t> model;
+    std::deque<uint32_t> qmodel;
+    unsigned int overflows = 0;
+    uint8_t buf[256], next = 0;
+    uint32_t rec = 0, got;
+
+    if (drvcore_spsc_init(&r, ring_size))
+        return 0;
+    if (drvcore_mpsc_init(&q, 8, sizeof(rec))) {
+        drvcore_spsc_free(&r);
+        return 0;
+    }
+    r.head = r.tail = start;
+
+    while (in.left) {
+        uint8_t op = in.take<uint8_t>();
+        unsigned int len = in.take<uint8_t>();
+        unsigned int want, n;
+        int ret;
+
+        if (op & 0x80) {
+            // mpsc: 单线程下就是一个有界队列, 满了丢新记录
+            if (op & 1) {
+                bool ok = drvcore_mpsc_pop(&q, &got);
+
+                FUZZ_CHECK(ok == !qmodel.empty());
+                if (ok) {
+                    FUZZ_CHECK(got == qmodel.front());
+                    qmodel.pop_front();
+                }
+            } else {
+                bool ok = drvcore_mpsc_push(&q, &rec);
+
+                FUZZ_CHECK(ok == (qmodel.size() < q.nslots));
+                if (ok)
+                    qmodel.push_back(rec);
+                else
+                    overflows++;
+                rec++;
+            }
+            FUZZ_CHECK(drvcore_mpsc_empty(&q) == qmodel.empty());
+            FUZZ_CHECK(drvcore_mpsc_overflows(&q) == overflows);
+            continue;
+        }
+
+        want = std::min<unsigned int>(len, sizeof(buf));
+        switch (op % 7) {
+        case 0:     // put
+        case 4:     // from_user
+            for (unsigned int i = 0; i < want; i++)
+                buf[i] = next + i;
+            if (op % 7 == 0) {
+                n = drvcore_spsc_put(&r, buf, want);
+            } else {
+                ret = drvcore_spsc_from_user(&r, buf, want);
+                FUZZ_CHECK(ret >= 0);
+                n = ret;
+            }
+            FUZZ_CHECK(n == std::min<size_t>(want, ring_size - model.size()));
+            for (unsigned int i = 0; i < n; i++)
+                model.push_back(buf[i]);
+            next += n;
+            break;
+        case 1:     // get
+            n = drvcore_spsc_get(&r, buf, want);
+            FUZZ_CHECK(n == std::min<size_t>(want, model.size()));
+            expect_front(model, buf, n, true);
+            break;
+        case 2:     // peek
+            n = drvcore_spsc_peek(&r, buf, want);
+            FUZZ_CHECK(n == std::min<size_t>(want, model.size()));
+            expect_front(model, buf, n, false);
+            break;
+        case 3:     // discard
+            FUZZ_CHECK(drvcore_spsc_discard(&r) == model.size());
+            model.clear();
+            break;
+        case 5:     // to_user
+            ret = drvcore_spsc_to_user(&r, buf, want);
+            FUZZ_CHECK(ret >= 0 && (size_t)ret == std::min<size_t>(want, model.size()));
+            expect_front(model, buf, ret, true);
+            break;
+        default:    // 用户指针无效: 有东西要拷时返回 -EFAULT, 状态不变
+            if (len & 1) {
+                ret = drvcore_spsc_from_user(&r, NULL, want);
+                FUZZ_CHECK(ret == (std::min<size_t>(want, ring_size - model.size()) ? -EFAULT : 0));
+            } else {
+                ret = drvcore_spsc_to_user(&r, NULL, want);
+                FUZZ_CHECK(ret == (std::min<size_t>(want, model.size()) ? -EFAULT : 0));
+            }
+            break;
+        }
+        check_spsc(&r, model);
+    }
+
+    drvcore_mpsc_free(&q);
+    drvcore_spsc_free(&r);
+    return 0;
+}